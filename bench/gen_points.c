@@ -0,0 +1,147 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Same coordinate range as the Data/ sets: integers around 5,000,000
+#define CENTER 5000000.0
+#define SPREAD 1000000.0
+#define EXTENT 10000000.0
+#define NR_CLUSTERS 16
+#define CLUSTER_SPREAD 50000.0
+#define PI 3.14159265358979323846
+
+// xorshift64*, so a seed gives the same data set on every machine
+static uint64_t rng_state;
+
+static double uniform01(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / 9007199254740992.0;
+}
+
+// Function to draw a standard normal value (Box-Muller)
+static double normal01(void)
+{
+    double u = uniform01();
+    double v = uniform01();
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2.0 * PI * v);
+}
+
+static long clamp_coordinate(double c)
+{
+    if (c < 0)
+        return 0;
+    if (c >= EXTENT)
+        return (long)EXTENT - 1;
+    return (long)c;
+}
+
+// Function to draw one point of a distribution
+static void draw_point(const char *distribution, double centers[][2], long *x, long *y)
+{
+    if (strcmp(distribution, "gaussian") == 0)
+    {
+        *x = clamp_coordinate(CENTER + SPREAD * normal01());
+        *y = clamp_coordinate(CENTER + SPREAD * normal01());
+    }
+    else if (strcmp(distribution, "uniform") == 0)
+    {
+        *x = clamp_coordinate(EXTENT * uniform01());
+        *y = clamp_coordinate(EXTENT * uniform01());
+    }
+    else
+    {
+        int c = (int)(uniform01() * NR_CLUSTERS) % NR_CLUSTERS;
+        *x = clamp_coordinate(centers[c][0] + CLUSTER_SPREAD * normal01());
+        *y = clamp_coordinate(centers[c][1] + CLUSTER_SPREAD * normal01());
+    }
+}
+
+// Function to read the points of a data file, used to draw query hits
+static long *read_points(const char *filename, long *count)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror("Unable to open data file");
+        return NULL;
+    }
+    long capacity = 1024;
+    long *coords = (long *)malloc(capacity * 2 * sizeof(long));
+    long x, y;
+    *count = 0;
+    while (coords != NULL && fscanf(file, " %ld , %ld", &x, &y) == 2)
+    {
+        if (*count == capacity)
+        {
+            capacity *= 2;
+            coords = (long *)realloc(coords, capacity * 2 * sizeof(long));
+            if (coords == NULL)
+                break;
+        }
+        coords[2 * *count] = x;
+        coords[2 * *count + 1] = y;
+        (*count)++;
+    }
+    fclose(file);
+    return coords;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        printf("Usage: %s gaussian|uniform|clustered COUNT SEED [HIT_FILE HIT_PERCENT]\n", argv[0]);
+        printf("Writes COUNT \"x,y\" lines to stdout. With HIT_FILE, HIT_PERCENT%% of them are drawn from its points.\n");
+        return 1;
+    }
+    const char *distribution = argv[1];
+    if (strcmp(distribution, "gaussian") != 0 && strcmp(distribution, "uniform") != 0 && strcmp(distribution, "clustered") != 0)
+    {
+        fprintf(stderr, "Unknown distribution %s\n", distribution);
+        return 1;
+    }
+    long count = atol(argv[2]);
+    rng_state = strtoull(argv[3], NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+
+    long *hits = NULL;
+    long num_hits = 0;
+    int hit_percent = 0;
+    if (argc >= 6)
+    {
+        hits = read_points(argv[4], &num_hits);
+        hit_percent = atoi(argv[5]);
+        if (hits == NULL || num_hits == 0)
+            return 1;
+    }
+
+    // Cluster centers stay away from the border so clusters are not clipped
+    double centers[NR_CLUSTERS][2];
+    for (int c = 0; c < NR_CLUSTERS; c++)
+    {
+        centers[c][0] = EXTENT * (0.1 + 0.8 * uniform01());
+        centers[c][1] = EXTENT * (0.1 + 0.8 * uniform01());
+    }
+
+    for (long i = 0; i < count; i++)
+    {
+        long x, y;
+        if (hits != NULL && uniform01() * 100 < hit_percent)
+        {
+            long h = (long)(uniform01() * num_hits) % num_hits;
+            x = hits[2 * h];
+            y = hits[2 * h + 1];
+        }
+        else
+        {
+            draw_point(distribution, centers, &x, &y);
+        }
+        printf("%ld,%ld\n", x, y);
+    }
+    free(hits);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#!/bin/sh
+# Sweep data sets and build configurations, appending one row per configuration to a results table.
+# Every list can be overridden from the environment, e.g.
+#   DATASETS="gaussian_100k uniform_100k" NR_DPUS_LIST="16 64" RUNS=10 make bench
+set -e
+
+DATASETS=${DATASETS:-"gaussian_1k gaussian_100k gaussian_1M uniform_100k clustered_100k"}
+FANOUT_LIST=${FANOUT_LIST:-"16 50"}
+BUNDLEFACTOR_LIST=${BUNDLEFACTOR_LIST:-"30"}
+NR_DPUS_LIST=${NR_DPUS_LIST:-"16 50"}
+NR_TASKLETS_LIST=${NR_TASKLETS_LIST:-"11 16"}
+ENCODING_LIST=${ENCODING_LIST:-"float u32 rel16 hybrid"}
+QUERY_ORDER_LIST=${QUERY_ORDER_LIST:-"arrival zorder"}
+TRAVERSAL_LIST=${TRAVERSAL_LIST:-"query group"}
+RUNS=${RUNS:-5}
+NUM_QUERIES=${NUM_QUERIES:-10000}
+HIT_PERCENT=${HIT_PERCENT:-50}
+SEED=${SEED:-1}
+
+BUILDDIR=${BUILDDIR:-build}
+BENCHDIR=${BUILDDIR}/bench
+GEN=${BUILDDIR}/gen_points
+RESULTS=${RESULTS:-${BENCHDIR}/results.csv}
+
+mkdir -p "${BENCHDIR}/data" "${BENCHDIR}/logs"
+rm -f "${RESULTS}"
+failed=0
+
+# Data set names are <distribution>_<size>, e.g. clustered_100k; the checked-in
+# Data/ files are used when they exist so results stay comparable with earlier runs
+points_of() {
+    case "$1" in
+        *_1k) echo 1000 ;;
+        *_100k) echo 100000 ;;
+        *_1M) echo 1000000 ;;
+        *) echo "Unknown data set size in $1" >&2; exit 1 ;;
+    esac
+}
+
+for dataset in ${DATASETS}; do
+    distribution=${dataset%_*}
+    data=Data/${distribution}_data_points_${dataset##*_}.csv
+    if [ ! -f "${data}" ]; then
+        data=${BENCHDIR}/data/${dataset}.csv
+        [ -f "${data}" ] || "${GEN}" "${distribution}" "$(points_of "${dataset}")" "${SEED}" > "${data}"
+    fi
+    queries=${BENCHDIR}/data/${dataset}_queries.csv
+    [ -f "${queries}" ] || "${GEN}" "${distribution}" "${NUM_QUERIES}" "$((SEED + 1))" "${data}" "${HIT_PERCENT}" > "${queries}"
+done
+
+# The tree shape is a run-time option up to the node capacity the binaries are built with,
+# so only DPU and tasklet counts need a rebuild
+max_of() {
+    echo "$@" | tr ' ' '\n' | sort -n | tail -n 1
+}
+capacity_fanout=$(max_of ${FANOUT_LIST})
+capacity_bundlefactor=$(max_of ${BUNDLEFACTOR_LIST})
+
+for nr_dpus in ${NR_DPUS_LIST}; do
+for nr_tasklets in ${NR_TASKLETS_LIST}; do
+    echo "Building D${nr_dpus}_T${nr_tasklets}"
+    make -s BUILDDIR="${BUILDDIR}" FANOUT="${capacity_fanout}" BUNDLEFACTOR="${capacity_bundlefactor}" \
+        NR_DPUS="${nr_dpus}" NR_TASKLETS="${nr_tasklets}" all
+
+for fanout in ${FANOUT_LIST}; do
+for bundlefactor in ${BUNDLEFACTOR_LIST}; do
+for encoding in ${ENCODING_LIST}; do
+for order in ${QUERY_ORDER_LIST}; do
+for traversal in ${TRAVERSAL_LIST}; do
+    config=F${fanout}_B${bundlefactor}_D${nr_dpus}_T${nr_tasklets}_${encoding}_${order}_${traversal}
+    # "hybrid" is not an encoding but the host-index mode with leaf-only DPU images
+    if [ "${encoding}" = hybrid ]; then mode="--hybrid"; else mode="--encoding ${encoding}"; fi
+    if [ "${order}" = zorder ]; then mode="${mode} --sort-queries"; fi
+    if [ "${traversal}" = group ]; then mode="${mode} --group"; fi
+    for dataset in ${DATASETS}; do
+        data=Data/${dataset%_*}_data_points_${dataset##*_}.csv
+        [ -f "${data}" ] || data=${BENCHDIR}/data/${dataset}.csv
+        echo "  ${config} ${dataset}"
+        # A mismatch between host and DPU answers fails the host, which then writes no row; the
+        # sweep goes on and fails at the end
+        if ! "./${BUILDDIR}/host" --data "${data}" --max-points "$(points_of "${dataset}")" \
+            --fanout "${fanout}" --bundlefactor "${bundlefactor}" ${mode} \
+            --queries "${BENCHDIR}/data/${dataset}_queries.csv" --runs "${RUNS}" \
+            --timing-out "${BENCHDIR}/logs/${config}_${dataset}.json" --bench-out "${RESULTS}" \
+            > "${BENCHDIR}/logs/${config}_${dataset}.log" 2>&1; then
+            echo "  ${dataset} failed, see ${BENCHDIR}/logs/${config}_${dataset}.log"
+            failed=$((failed + 1))
+        fi
+    done
+done
+done
+done
+done
+done
+done
+done
+
+echo
+column -t -s, "${RESULTS}" 2>/dev/null || cat "${RESULTS}"
+
+if [ "${failed}" -gt 0 ]; then
+    echo "${failed} configuration(s) failed and are missing from ${RESULTS}"
+    exit 1
+fi
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Run every query set through every search path, then fail if any run disagreed. Each run adds
+# stored points and probes next to them to the query set and compares the pointer tree, the
+# serialized images searched on the host and the DPU kernel (host --verify). Lists can be
+# overridden from the environment, e.g.
+#   HOST=build/host MODES="float u32" GENERATED=5000 ./bench/run_verify.sh
+set -e
+
+# Besides HOST, the emulator is built again for each of NR_DPUS_LIST: with fewer DPUs than the
+# root fanout, every partition must still land on a DPU. Only the given host runs when HOST is set.
+[ -n "${HOST}" ] && NR_DPUS_LIST=${NR_DPUS_LIST-}
+NR_DPUS_LIST=${NR_DPUS_LIST-16}
+HOST=${HOST:-build/host_emu}
+DATA=${DATA:-Data/gaussian_data_points_100k.csv}
+MAX_POINTS=${MAX_POINTS:-100000}
+QUERY_SETS=${QUERY_SETS:-"Query/*.csv Query/*.txt"}
+GENERATED=${GENERATED:-1000}
+MODES=${MODES:-"float u32 rel16 hybrid group zorder route bloom cache interleave repartition updates buffered"}
+
+BUILDDIR=${BUILDDIR:-build}
+LOGDIR=${BUILDDIR}/verify
+mkdir -p "${LOGDIR}"
+
+# Inserts and deletes for the update modes, drawn from the data set: every 5th point is deleted and
+# a point one unit off every 7th is inserted, enough for the delta buffers to fill up and merge
+UPDATES=${LOGDIR}/updates.txt
+awk -F, -v max="${MAX_POINTS}" 'NR > max { exit }
+    NR % 5 == 0 { print "d " $1 "," $2 }
+    NR % 7 == 0 { print "i " $1 + 1 "," $2 }' "${DATA}" > "${UPDATES}"
+
+options_of() {
+    case "$1" in
+        float|u32|rel16) echo "--encoding $1" ;;
+        hybrid) echo "--hybrid" ;;
+        group) echo "--group" ;;
+        zorder) echo "--sort-queries --group" ;;
+        route) echo "--fanout 20 --route --replicate 500" ;;
+        bloom) echo "--bloom 8 --bloom-dpu" ;;
+        cache) echo "--cache 1024" ;;
+        interleave) echo "--interleave 16" ;;
+        repartition) echo "--repartition 4" ;;
+        updates) echo "--updates ${UPDATES}" ;;
+        buffered) echo "--buffered-updates ${UPDATES}" ;;
+        *) echo "Unknown mode $1" >&2; exit 1 ;;
+    esac
+}
+
+failed=0
+# Run every query set through every mode on one host binary, labelled with its shape
+run_modes() {
+    host=$1
+    shape=$2
+    prefix=
+    [ "${shape}" = default ] || prefix=${shape}_
+    for queries in ${QUERY_SETS}; do
+        [ -f "${queries}" ] || continue
+        for mode in ${MODES}; do
+            log=${LOGDIR}/${prefix}$(basename "${queries%.*}")_${mode}.log
+            printf '%-8s %-40s %-12s ' "${shape}" "$(basename "${queries}")" "${mode}"
+            if "${host}" --data "${DATA}" --max-points "${MAX_POINTS}" --queries "${queries}" --verify "${GENERATED}" \
+                $(options_of "${mode}") > "${log}" 2>&1; then
+                echo "ok"
+            else
+                echo "FAILED, see ${log}"
+                failed=$((failed + 1))
+            fi
+            # Engine throughputs of the run, from the table the host prints
+            sed -n '/^engine/,/agree\|disagree/p' "${log}" | sed '1d;$d' | sed 's/^/    /'
+        done
+    done
+}
+
+run_modes "${HOST}" default
+for nr_dpus in ${NR_DPUS_LIST}; do
+    make -s BUILDDIR="${BUILDDIR}/emu_d${nr_dpus}" NR_DPUS="${nr_dpus}" emu
+    run_modes "${BUILDDIR}/emu_d${nr_dpus}/host_emu" "D${nr_dpus}"
+done
+
+if [ "${failed}" -gt 0 ]; then
+    echo "${failed} run(s) disagreed"
+    exit 1
+fi
+echo "All runs agree"
@@ -1,6 +1,8 @@
 #ifndef __COMMON_H__
 #define __COMMON_H__
 
+#include <stdint.h>
+
 #define XSTR(x) STR(x)
 #define STR(x) #x
 
@@ -14,15 +16,199 @@ static inline uint32_t pceil8(uint32_t *a) {
     return (*a + 0x07) & ~(0x07UL);
 }
 
+// Capacity of a SerializedNode, overridable from the Makefile (make FANOUT=.. BUNDLEFACTOR=..).
+// The shape of a given tree is chosen at run time up to these bounds (TreeParams).
+#ifndef BUNDLEFACTOR
 #define BUNDLEFACTOR 30 // Number of points to form a leaf node
+#endif
+#ifndef FANOUT
 #define FANOUT 50   // Number of children per non-leaf node
-#define MAX_POINTS 10000
+#endif
+#define MAX_POINTS 10000 // Default cap on points read from the data set (host --max-points)
 #define MAX_NODES 10000
 
 //#define ELEMENT_SIZE sizeof(uint32_t)
 
 /* Structure used by both the host and the DPU to communicate results */
-#include <stdint.h>
+
+// Structure to define a point
+typedef struct Point
+{
+    float x, y;
+} Point;
+
+// Structure to define a bounding box (MBR)
+typedef struct MBR
+{
+    float xmin, ymin;
+    float xmax, ymax;
+} MBR;
+
+// Structure for a serialized node, sized so a full internal node or leaf fits
+typedef struct SerializedNode
+{
+    int isLeaf;                // 1 if it's a leaf node, 0 if it's an internal node
+    int count;                 // Number of entries in the node
+    MBR mbr;                   // Bounding box for the node
+    int children[FANOUT];      // Indices of child nodes (internal node)
+    Point points[BUNDLEFACTOR]; // Points (leaf node)
+} SerializedNode;
+
+/* Fixed-point coordinates: integer offsets from the data set's lower-left corner.
+ * The DPU has no FPU, so integer compares are much cheaper than emulated float ones. */
+typedef struct QPoint
+{
+    uint32_t x, y;
+} QPoint;
+
+typedef struct QMBR
+{
+    uint32_t xmin, ymin;
+    uint32_t xmax, ymax;
+} QMBR;
+
+#define QCOORD_NONE 0xFFFFFFFFu // Never inside an MBR: marks queries no stored point can equal
+
+// SerializedNode with quantized coordinates, same size and field offsets
+typedef struct QuantizedNode
+{
+    int isLeaf;
+    int count;
+    QMBR mbr;
+    int children[FANOUT];
+    QPoint points[BUNDLEFACTOR];
+} QuantizedNode;
+
+/* TREE_ENCODING_REL16 stream: variable-size nodes laid out back to back, each a RelNode
+ * followed by count entries and padded to 8 bytes. Nodes are addressed by their offset
+ * in 8-byte words from the start of DPU_TREE. Entries are uint32 child offsets for an
+ * internal node, REL_PACK'ed offsets from the MBR's min corner for a leaf, or full QPoints
+ * for a REL_WIDE leaf whose extent does not fit 16 bits. */
+typedef struct RelNode
+{
+    uint32_t flags; // REL_LEAF, REL_WIDE
+    uint32_t count; // Number of entries after the node
+    QMBR mbr;
+} RelNode;
+
+#define REL_LEAF 1u
+#define REL_WIDE 2u
+#define REL_MAX_OFFSET 0xFFFFu
+#define REL_PACK(dx, dy) (((uint32_t)(dy) << 16) | (uint32_t)(dx))
+
+/* A query as it travels to the DPU, in the encoding of the resident tree */
+typedef union EncodedPoint
+{
+    Point f;
+    QPoint q;
+} EncodedPoint;
+
+#define DELTA_BUFFER_SIZE 1024 // Buffered inserts/tombstones per DPU
+#define DELTA_DELETE 0
+#define DELTA_INSERT 1
+
+/* One buffered write. The newest entry for a point overrides what the static tree says. */
+typedef struct DeltaEntry
+{
+    Point point;
+    uint32_t op; // DELTA_INSERT or DELTA_DELETE
+    uint32_t reserved;
+} DeltaEntry;
+
+#define QUERY_BATCH_SIZE 256 // Queries per DPU launch
+#define NR_QUERY_BUFFERS 2   // MRAM query/result regions used for double buffering
+
+/* Hybrid mode: the host keeps the upper levels of the tree and a DPU only holds the leaves
+ * of its partition, as uint32 leaf_start[num_leaves + 1] (index of each leaf's first point)
+ * followed, 8-byte aligned, by the points of all leaves in order. The host resolves a query
+ * to runs of leaves whose MBR holds it and sends one request per run. */
+typedef struct LeafRequest
+{
+    Point query;
+    uint32_t first_leaf;
+    uint32_t num_leaves;
+} LeafRequest;
+
+#define LEAF_POINTS_OFFSET(num_leaves) ((((num_leaves) + 1) * sizeof(uint32_t) + 7) & ~(size_t)7)
+
+#define BATCH_GROUP_TRAVERSAL 1u // Descend the tree once per block of queries instead of once per query
+
+/* Arguments of one launch: which query/result region to use and how many queries it holds */
+typedef struct BatchArgs
+{
+    uint32_t buffer;
+    uint32_t count;
+    uint32_t flags; // BATCH_* options of the kernel
+    uint32_t reserved;
+} BatchArgs;
+
+/* Work done by one tasklet during one launch, written to MRAM before the kernel returns */
+typedef struct TaskletStats
+{
+    uint64_t cycles;          // Perfcounter cycles from the start of the search to the tasklet's return
+    uint64_t nodes_visited;   // Tree nodes whose MBR was tested
+    uint64_t mbr_tests;       // Point-in-MBR tests, one per visited node
+    uint64_t points_compared; // Leaf points compared with a query
+    uint64_t mram_bytes;      // Node, query and delta bytes read from MRAM
+    uint64_t bloom_skips;     // Queries the partition's Bloom filter ruled out (counted by tasklet 0 only)
+    uint64_t early_exits;     // Searches cut short because another tasklet had matched the query
+} TaskletStats;
+
+#define BLOOM_WRAM_BYTES 16384 // Largest partition filter the kernel keeps in WRAM
+
+/* Bloom filter of the points of one partition, set by the host (num_bits 0: no filter) */
+typedef struct BloomArgs
+{
+    uint32_t num_bits; // Power of two
+    uint32_t num_hashes;
+} BloomArgs;
+
+// Function to derive the two base hashes of a point from the bits of its float coordinates.
+// Probe i of a filter is bit (h1 + i * h2) & (num_bits - 1), on the host and on the DPU.
+static inline void bloom_hashes(uint32_t x, uint32_t y, uint32_t *h1, uint32_t *h2)
+{
+    // -0.0 compares equal to 0.0 in every search, so it has to hash like it
+    if (x == 0x80000000u)
+        x = 0;
+    if (y == 0x80000000u)
+        y = 0;
+    uint32_t h = x * 0x9e3779b1u ^ y;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    *h1 = h;
+    *h2 = (h >> 17 | h << 15) | 1; // Odd, so the probes of a power-of-two filter never repeat early
+}
+
+#define TREE_MAGIC 0x45525452u // "RTRE"
+#define TREE_VERSION 4
+
+#define TREE_ENCODING_FLOAT 0 // SerializedNode, float coordinates
+#define TREE_ENCODING_U32 1   // QuantizedNode, uint32 offsets from the data set origin
+#define TREE_ENCODING_REL16 2 // RelNode stream, leaf points as 16-bit offsets from their leaf's corner
+#define TREE_ENCODING_LEAVES 3 // Leaves only, for hybrid mode (see LeafRequest)
+
+/* Shape a tree was built with, at most FANOUT children and BUNDLEFACTOR points per node */
+typedef struct TreeParams
+{
+    uint32_t fanout;       // Maximum children of an internal node
+    uint32_t bundlefactor; // Maximum points of a leaf
+} TreeParams;
+
+/* Header stored in MRAM next to DPU_TREE. A later session compares it with the
+ * header of the tree it is about to push and skips the transfer on a match. */
+typedef struct TreeHeader
+{
+    uint32_t magic;       // TREE_MAGIC once a tree has been written
+    uint32_t version;     // TREE_VERSION of the serialized layout
+    uint32_t num_nodes;   // Number of nodes in DPU_TREE
+    uint32_t checksum;    // FNV-1a over the image
+    TreeParams params;    // Shape the kernel specializes its search for
+    uint32_t encoding;    // TREE_ENCODING_* of the nodes and of the queries sent for them
+    uint32_t image_bytes; // Bytes of DPU_TREE the image uses
+} TreeHeader;
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
 #define ANSI_COLOR_LIGHT_BLUE    "\x1b[34m"
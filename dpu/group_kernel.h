@@ -0,0 +1,95 @@
+/* Body of the group traversal, included once per node encoding by rtree_query.c.
+ * Before each inclusion define:
+ *   GROUP_NAME      name of the generated function
+ *   GROUP_TREE      node array to search, DPU_TREE (float) or DPU_QTREE (quantized)
+ *   GROUP_HEADER    NodeHeader or QNodeHeader, the leading fields of a GROUP_TREE entry
+ *   GROUP_FIELD     member of EncodedPoint matching the node encoding, f or q
+ *   GROUP_FALLBACK  per-query kernel for subtrees deeper than GROUP_MAX_DEPTH
+ * No include guard on purpose. */
+
+// Recursive function to search a block of queries at once: the node is read from MRAM once and
+// the queries inside its MBR become the list its children are searched with
+void GROUP_NAME(int node_index, const uint8_t *list, uint32_t size, uint32_t depth, int start_child, int end_child, GroupState *state)
+{
+    TaskletStats *stats = state->stats;
+    if (depth >= GROUP_MAX_DEPTH)
+    {
+        // No list left for this level, finish the subtree one query at a time
+        for (uint32_t i = 0; i < size; i++)
+        {
+            uint32_t q = list[i];
+            if (!batch_found[q] && GROUP_FALLBACK(node_index, batch_queries[q], start_child, end_child, &batch_found[q], stats))
+            {
+                batch_found[q] = 1;
+            }
+        }
+        return;
+    }
+
+    GROUP_HEADER header = *(__mram_ptr GROUP_HEADER *)&GROUP_TREE[node_index];
+    stats->nodes_visited++;
+    stats->mram_bytes += sizeof(GROUP_HEADER);
+
+    // Keep the queries inside the MBR that no tasklet matched yet
+    uint8_t *inside = state->lists[depth];
+    uint32_t num_inside = 0;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        uint32_t q = list[i];
+        if (batch_found[q])
+        {
+            stats->early_exits++;
+            continue;
+        }
+        stats->mbr_tests++;
+        EncodedPoint query = batch_queries[q];
+        if (query.GROUP_FIELD.x >= header.mbr.xmin && query.GROUP_FIELD.x <= header.mbr.xmax &&
+            query.GROUP_FIELD.y >= header.mbr.ymin && query.GROUP_FIELD.y <= header.mbr.ymax)
+        {
+            inside[num_inside++] = (uint8_t)q;
+        }
+    }
+    if (num_inside == 0)
+    {
+        return;
+    }
+
+    if (header.isLeaf)
+    {
+        // Read the points once, then compare every query of the list against the WRAM copy
+        int count = header.count < (int)tree_header.params.bundlefactor ? header.count : (int)tree_header.params.bundlefactor;
+        for (int p = 0; p < count; p++)
+        {
+            state->points[p].GROUP_FIELD = GROUP_TREE[node_index].points[p];
+        }
+        stats->mram_bytes += count * sizeof(Point);
+
+        for (uint32_t i = 0; i < num_inside; i++)
+        {
+            uint32_t q = inside[i];
+            EncodedPoint query = batch_queries[q];
+            for (int p = 0; p < count; p++)
+            {
+                stats->points_compared++;
+                if (query.GROUP_FIELD.x == state->points[p].GROUP_FIELD.x && query.GROUP_FIELD.y == state->points[p].GROUP_FIELD.y)
+                {
+                    batch_found[q] = 1;
+                    break;
+                }
+            }
+        }
+        return;
+    }
+
+    for (int i = start_child; i < end_child && i < header.count && i < (int)tree_header.params.fanout; i++)
+    {
+        stats->mram_bytes += sizeof(int);
+        GROUP_NAME(GROUP_TREE[node_index].children[i], inside, num_inside, depth + 1, 0, (int)tree_header.params.fanout, state);
+    }
+}
+
+#undef GROUP_NAME
+#undef GROUP_TREE
+#undef GROUP_HEADER
+#undef GROUP_FIELD
+#undef GROUP_FALLBACK
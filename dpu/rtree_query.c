@@ -1,93 +1,315 @@
+#include <barrier.h>
 #include <defs.h>
 #include <mram.h>
 #include <perfcounter.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <stdio.h>
 
 #include "common.h"
 
 #define BLOCK_SIZE (256)
 
-// Structure to define a point
-typedef struct Point
-{
-    float x, y;
-} Point;
+// MRAM Variables
+__mram_noinit uint64_t DPU_INDEX;
+__mram_noinit BatchArgs DPU_BATCH_ARGS;
+__mram_noinit EncodedPoint DPU_QUERIES[NR_QUERY_BUFFERS][QUERY_BATCH_SIZE];
+__mram_noinit uint64_t DPU_RESULTS[NR_QUERY_BUFFERS][QUERY_BATCH_SIZE];
+__mram_noinit TreeHeader DPU_TREE_HEADER; // Survives program reloads, checked before every search
+__mram_noinit SerializedNode DPU_TREE[MAX_NODES];
+#define DPU_QTREE ((__mram_ptr QuantizedNode *)DPU_TREE) // DPU_TREE holding a TREE_ENCODING_U32 tree
+#define DPU_RELTREE ((__mram_ptr uint64_t *)DPU_TREE)    // DPU_TREE holding a TREE_ENCODING_REL16 stream, in 8-byte words
+__mram_noinit LeafRequest DPU_LEAF_REQUESTS[QUERY_BATCH_SIZE]; // Hybrid mode: leaf runs to scan, answers go to DPU_RESULTS
+__mram_noinit uint64_t DPU_DELTA_COUNT;                // Entries used in DPU_DELTA
+__mram_noinit DeltaEntry DPU_DELTA[DELTA_BUFFER_SIZE]; // Writes not yet merged into DPU_TREE
+__mram_noinit TaskletStats DPU_STATS[NR_TASKLETS];     // Counters of the last launch, one entry per tasklet
+__mram_noinit BloomArgs DPU_BLOOM_ARGS;                // Shape of DPU_BLOOM, num_bits 0 when the host sent no filter
+__mram_noinit uint64_t DPU_BLOOM[BLOOM_WRAM_BYTES / sizeof(uint64_t)];
+
+BARRIER_INIT(batch_barrier, NR_TASKLETS);
+
+// Counters of the running launch, copied to DPU_STATS by each tasklet on return
+TaskletStats tasklet_stats[NR_TASKLETS];
+
+// Per-query answer of the delta buffer: -1 when it holds no entry for the point
+int8_t delta_verdict[QUERY_BATCH_SIZE];
+
+// Per-query match flag shared by all tasklets: set by whichever finds the point, polled by the
+// others to stop searching it, and copied to DPU_RESULTS once after the last barrier
+volatile uint8_t batch_found[QUERY_BATCH_SIZE];
 
-// Structure to define a bounding box (MBR)
-typedef struct MBR
+// Function to find the newest buffered write for a point
+int8_t lookup_delta(Point query_point, uint32_t delta_count, TaskletStats *stats)
 {
-    float xmin, ymin;
-    float xmax, ymax;
-} MBR;
+    for (uint32_t i = delta_count; i-- > 0;)
+    {
+        DeltaEntry entry = DPU_DELTA[i];
+        stats->mram_bytes += sizeof(DeltaEntry);
+        if (entry.point.x == query_point.x && entry.point.y == query_point.y)
+        {
+            return entry.op == DELTA_INSERT ? 1 : 0;
+        }
+    }
+    return -1;
+}
+
+// Header of the resident tree, read from DPU_TREE_HEADER by tasklet 0 at every launch
+TreeHeader tree_header;
+
+#define BLOOM_CHUNK 2048 // Bytes per mram_read of the filter
+
+// Bloom filter of this DPU's partition, loaded into WRAM by all tasklets at every launch
+__dma_aligned uint64_t bloom_filter[BLOOM_WRAM_BYTES / sizeof(uint64_t)];
 
-// Structure for a serialized node
-typedef struct SerializedNode
+// Function to test a float query against the WRAM filter, false when the partition cannot hold it
+bool bloom_may_contain(BloomArgs bloom, EncodedPoint query)
 {
-    int isLeaf;       // 1 if it's a leaf node, 0 if it's an internal node
-    int count;        // Number of entries in the node
-    MBR mbr;          // Bounding box for the node
-    int children[16]; // Indices of child nodes (internal node), max FANOUT assumed to be 16
-    Point points[16]; // Points (leaf node), max BUNDLEFACTOR assumed to be 16
-} SerializedNode;
+    uint32_t h1, h2;
+    bloom_hashes(query.q.x, query.q.y, &h1, &h2);
+    for (uint32_t i = 0; i < bloom.num_hashes; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & (bloom.num_bits - 1);
+        if (!(bloom_filter[bit / 64] >> (bit % 64) & 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
 
-// MRAM Variables
-__mram_noinit uint64_t DPU_INDEX;
-__mram_noinit Point DPU_QUERY_POINT;
-__mram_noinit SerializedNode DPU_TREE[MAX_NODES];
-__mram_noinit uint64_t DPU_RESULT;
+typedef bool (*search_kernel_t)(int node_index, EncodedPoint query, int start_child, int end_child, const volatile uint8_t *found,
+                                TaskletStats *stats);
 
-// Recursive function to search a query point in the serialized R-tree
-bool search_rtree_dpu(int node_index, Point query_point, int start_child, int end_child)
+// Generic kernels, bounded by the shape in the header
+#define KERNEL_NAME search_rtree_dpu
+#define KERNEL_TREE DPU_TREE
+#define KERNEL_FIELD f
+#define KERNEL_FANOUT (int)tree_header.params.fanout
+#define KERNEL_BUNDLEFACTOR (int)tree_header.params.bundlefactor
+#include "search_kernel.h"
+
+#define KERNEL_NAME search_rtree_dpu_q
+#define KERNEL_TREE DPU_QTREE
+#define KERNEL_FIELD q
+#define KERNEL_FANOUT (int)tree_header.params.fanout
+#define KERNEL_BUNDLEFACTOR (int)tree_header.params.bundlefactor
+#include "search_kernel.h"
+
+// Unrolled kernels for the shapes we build most often
+#define KERNEL_NAME search_rtree_dpu_default
+#define KERNEL_TREE DPU_TREE
+#define KERNEL_FIELD f
+#define KERNEL_FANOUT FANOUT
+#define KERNEL_BUNDLEFACTOR BUNDLEFACTOR
+#define KERNEL_UNROLL
+#include "search_kernel.h"
+
+#define KERNEL_NAME search_rtree_dpu_q_default
+#define KERNEL_TREE DPU_QTREE
+#define KERNEL_FIELD q
+#define KERNEL_FANOUT FANOUT
+#define KERNEL_BUNDLEFACTOR BUNDLEFACTOR
+#define KERNEL_UNROLL
+#include "search_kernel.h"
+
+#if FANOUT >= 16 && BUNDLEFACTOR >= 16 && !(FANOUT == 16 && BUNDLEFACTOR == 16)
+#define HAVE_KERNEL_16
+#define KERNEL_NAME search_rtree_dpu_16
+#define KERNEL_TREE DPU_TREE
+#define KERNEL_FIELD f
+#define KERNEL_FANOUT 16
+#define KERNEL_BUNDLEFACTOR 16
+#define KERNEL_UNROLL
+#include "search_kernel.h"
+#endif
+
+// Recursive function to search a TREE_ENCODING_REL16 stream; node_index is the node's offset in words
+bool search_rtree_dpu_rel16(int node_index, EncodedPoint query, int start_child, int end_child, const volatile uint8_t *found,
+                            TaskletStats *stats)
 {
+    if (*found)
+    {
+        stats->early_exits++;
+        return true;
+    }
+    __mram_ptr RelNode *node = (__mram_ptr RelNode *)(DPU_RELTREE + node_index);
+    RelNode header = *node;
+    stats->nodes_visited++;
+    stats->mbr_tests++;
+    stats->mram_bytes += sizeof(RelNode);
+
     // Check if the query point is within the MBR of the current node
-    if (!(query_point.x >= DPU_TREE[node_index].mbr.xmin && query_point.x <= DPU_TREE[node_index].mbr.xmax && query_point.y >= DPU_TREE[node_index].mbr.ymin && query_point.y <= DPU_TREE[node_index].mbr.ymax))
+    if (!(query.q.x >= header.mbr.xmin && query.q.x <= header.mbr.xmax && query.q.y >= header.mbr.ymin && query.q.y <= header.mbr.ymax))
     {
-        return false; // Query point is outside the MBR
+        return false;
     }
 
-    if (DPU_TREE[node_index].isLeaf)
+    int count = header.count;
+    if (header.flags & REL_WIDE)
     {
-        // Search in the points of the leaf node
-        for (int i = 0; i < DPU_TREE[node_index].count; i++)
+        // Extent too large for 16-bit offsets, the leaf holds full points
+        __mram_ptr QPoint *points = (__mram_ptr QPoint *)(node + 1);
+        for (int i = 0; i < count; i++)
         {
-            if (query_point.x == DPU_TREE[node_index].points[i].x && query_point.y == DPU_TREE[node_index].points[i].y)
+            stats->points_compared++;
+            stats->mram_bytes += sizeof(QPoint);
+            QPoint p = points[i];
+            if (query.q.x == p.x && query.q.y == p.y)
             {
                 return true;
             }
         }
-        return false; // Not found in this leaf node
+        return false;
+    }
+    else if (header.flags & REL_LEAF)
+    {
+        // Inside the MBR the query's offsets fit 16 bits: encode it once, then one compare per point
+        __mram_ptr uint32_t *points = (__mram_ptr uint32_t *)(node + 1);
+        uint32_t packed = REL_PACK(query.q.x - header.mbr.xmin, query.q.y - header.mbr.ymin);
+        for (int i = 0; i < count; i++)
+        {
+            stats->points_compared++;
+            stats->mram_bytes += sizeof(uint32_t);
+            if (points[i] == packed)
+            {
+                return true;
+            }
+        }
+        return false;
     }
     else
     {
         // Recursively search in the assigned child nodes
-        for (int i = start_child; i < end_child; i++)
+        __mram_ptr uint32_t *children = (__mram_ptr uint32_t *)(node + 1);
+        for (int i = start_child; i < end_child && i < count; i++)
         {
-            if (i >= DPU_TREE[node_index].count) // Ensure we don't access out-of-bounds
-                break;
-
-            if (search_rtree_dpu(DPU_TREE[node_index].children[i], query_point, 0, DPU_TREE[DPU_TREE[node_index].children[i]].count))
+            stats->mram_bytes += sizeof(uint32_t);
+            if (search_rtree_dpu_rel16(children[i], query, 0, (int)tree_header.params.fanout, found, stats))
             {
                 return true;
             }
         }
-        return false; // Not found in any child nodes
+        return false;
     }
 }
 
-int main()
+#define GROUP_MAX_DEPTH 4 // Tree levels with a query list in WRAM, deeper subtrees are searched per query
+
+_Static_assert(QUERY_BATCH_SIZE <= 256, "group traversal lists hold batch indices as uint8_t");
+
+/* Leading fields of a SerializedNode and of a QuantizedNode, read in one go by the group traversal */
+typedef struct NodeHeader
 {
-    DPU_RESULT = 0;
-    uint32_t tasklet_id = me(); // Tasklet ID (0 to NR_TASKLETS - 1)
-    uint64_t dpu_index = DPU_INDEX;
+    int isLeaf;
+    int count;
+    MBR mbr;
+} NodeHeader;
 
-    if (tasklet_id == 0)
+typedef struct QNodeHeader
+{
+    int isLeaf;
+    int count;
+    QMBR mbr;
+} QNodeHeader;
+
+/* Per-tasklet state of a group traversal */
+typedef struct GroupState
+{
+    uint8_t lists[GROUP_MAX_DEPTH][QUERY_BATCH_SIZE]; // Queries inside the node being searched at each level
+    EncodedPoint points[BUNDLEFACTOR];                // Leaf being compared
+    TaskletStats *stats;
+} GroupState;
+
+GroupState group_state[NR_TASKLETS];
+
+// WRAM copy of the batch, filled by all tasklets before the first barrier
+EncodedPoint batch_queries[QUERY_BATCH_SIZE];
+
+#define GROUP_NAME group_search_dpu
+#define GROUP_TREE DPU_TREE
+#define GROUP_HEADER NodeHeader
+#define GROUP_FIELD f
+#define GROUP_FALLBACK search_rtree_dpu
+#include "group_kernel.h"
+
+#define GROUP_NAME group_search_dpu_q
+#define GROUP_TREE DPU_QTREE
+#define GROUP_HEADER QNodeHeader
+#define GROUP_FIELD q
+#define GROUP_FALLBACK search_rtree_dpu_q
+#include "group_kernel.h"
+
+// Function to answer one hybrid-mode request: scan the points of a run of leaves the host matched
+bool scan_leaves(LeafRequest request, uint32_t num_leaves, TaskletStats *stats)
+{
+    if (request.first_leaf >= num_leaves || request.num_leaves > num_leaves - request.first_leaf)
     {
-       // printf("\n|| Printing DPU_TREE in DPU ID: %lu ||\n", dpu_index);
+        return false;
     }
 
+    __mram_ptr uint32_t *leaf_start = (__mram_ptr uint32_t *)DPU_TREE;
+    __mram_ptr Point *points = (__mram_ptr Point *)((__mram_ptr uint8_t *)DPU_TREE + LEAF_POINTS_OFFSET(num_leaves));
+    uint32_t first = leaf_start[request.first_leaf];
+    uint32_t end = leaf_start[request.first_leaf + request.num_leaves];
+    stats->nodes_visited += request.num_leaves;
+    stats->mram_bytes += 2 * sizeof(uint32_t);
+
+    for (uint32_t i = first; i < end; i++)
+    {
+        stats->points_compared++;
+        stats->mram_bytes += sizeof(Point);
+        Point p = points[i];
+        if (request.query.x == p.x && request.query.y == p.y)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to pick the kernel specialized for the tree's encoding and shape, the generic one otherwise
+search_kernel_t select_kernel(TreeParams params, uint32_t encoding)
+{
+    if (encoding == TREE_ENCODING_REL16)
+        return search_rtree_dpu_rel16;
+    if (encoding == TREE_ENCODING_U32)
+        return params.fanout == FANOUT && params.bundlefactor == BUNDLEFACTOR ? search_rtree_dpu_q_default : search_rtree_dpu_q;
+    if (params.fanout == FANOUT && params.bundlefactor == BUNDLEFACTOR)
+        return search_rtree_dpu_default;
+#ifdef HAVE_KERNEL_16
+    if (params.fanout == 16 && params.bundlefactor == 16)
+        return search_rtree_dpu_16;
+#endif
+    return search_rtree_dpu;
+}
+
+// Function to search this tasklet's share of a batch, setting batch_found for every match
+void search_batch(uint32_t tasklet_id, BatchArgs args, uint32_t count, BloomArgs bloom, TaskletStats *stats)
+{
+    // Only search a tree whose header says it was completely written by the host
+    TreeHeader header = tree_header;
+    if (header.magic != TREE_MAGIC || header.version != TREE_VERSION || header.num_nodes == 0 || header.image_bytes > sizeof(DPU_TREE) ||
+        header.params.fanout < 2 || header.params.fanout > FANOUT || header.params.bundlefactor < 1 || header.params.bundlefactor > BUNDLEFACTOR ||
+        header.encoding > TREE_ENCODING_LEAVES)
+    {
+        return;
+    }
+
+    if (header.encoding == TREE_ENCODING_LEAVES)
+    {
+        // Hybrid mode: the host walked the upper levels already, requests are split across tasklets
+        for (uint32_t r = tasklet_id; r < count; r += NR_TASKLETS)
+        {
+            stats->mram_bytes += sizeof(LeafRequest);
+            batch_found[r] = scan_leaves(DPU_LEAF_REQUESTS[r], header.num_nodes, stats);
+        }
+        return;
+    }
+
+    search_kernel_t search = select_kernel(header.params, header.encoding);
+
     // Calculate the number of children per tasklet
-    int total_children = DPU_TREE[0].count; // Root node's child count
+    // Root node's child count
+    int total_children = header.encoding == TREE_ENCODING_REL16 ? (int)((__mram_ptr RelNode *)DPU_RELTREE)->count : DPU_TREE[0].count;
     int children_per_tasklet = total_children / NR_TASKLETS;
     uint32_t extra_children = total_children % NR_TASKLETS;
 
@@ -95,18 +317,137 @@ int main()
     int start_child = tasklet_id * children_per_tasklet + (tasklet_id < extra_children ? tasklet_id : extra_children);
     int end_child = start_child + children_per_tasklet + (tasklet_id < extra_children ? 1 : 0);
 
-    // Perform the search on the assigned range of children
-    bool found = search_rtree_dpu(0, DPU_QUERY_POINT, start_child, end_child);
+    if ((args.flags & BATCH_GROUP_TRAVERSAL) && (header.encoding == TREE_ENCODING_FLOAT || header.encoding == TREE_ENCODING_U32))
+    {
+        GroupState *state = &group_state[tasklet_id];
+        state->stats = stats;
+
+        // The root consumes its list before any level is written below it, so the deepest list can hold it
+        uint8_t *candidates = state->lists[GROUP_MAX_DEPTH - 1];
+        uint32_t num_candidates = 0;
+        for (uint32_t q = 0; q < count; q++)
+        {
+            if (delta_verdict[q] != -1)
+            {
+                continue;
+            }
+            if (bloom.num_bits != 0 && !bloom_may_contain(bloom, batch_queries[q]))
+            {
+                if (tasklet_id == 0)
+                {
+                    stats->bloom_skips++;
+                }
+                continue;
+            }
+            candidates[num_candidates++] = (uint8_t)q;
+        }
+
+        // Every tasklet takes the whole block down its range of the root's children
+        if (header.encoding == TREE_ENCODING_U32)
+        {
+            group_search_dpu_q(0, candidates, num_candidates, 0, start_child, end_child, state);
+        }
+        else
+        {
+            group_search_dpu(0, candidates, num_candidates, 0, start_child, end_child, state);
+        }
+        return;
+    }
+
+    // Every tasklet searches its range of children for every query the delta buffer did not answer
+    for (uint32_t q = 0; q < count; q++)
+    {
+        if (delta_verdict[q] != -1)
+        {
+            continue;
+        }
+        if (batch_found[q])
+        {
+            stats->early_exits++;
+            continue;
+        }
+        EncodedPoint query = batch_queries[q];
+        if (bloom.num_bits != 0 && !bloom_may_contain(bloom, query))
+        {
+            // Every tasklet skips it, one counts it
+            if (tasklet_id == 0)
+            {
+                stats->bloom_skips++;
+            }
+            continue;
+        }
+        if (search(0, query, start_child, end_child, &batch_found[q], stats))
+        {
+            batch_found[q] = 1;
+        }
+    }
+}
+
+int main()
+{
+    uint32_t tasklet_id = me(); // Tasklet ID (0 to NR_TASKLETS - 1)
+    TaskletStats *stats = &tasklet_stats[tasklet_id];
+    *stats = (TaskletStats){0, 0, 0, 0, 0, 0, 0};
 
-    
-    if (found)
+    // Start counting cycles before any tasklet takes its first timestamp
+    if (tasklet_id == 0)
     {
-        DPU_RESULT = 1;
-        printf("\nTasklet %d " ANSI_COLOR_GREEN "found" ANSI_COLOR_RESET " query point (%.1f, %.1f) on DPU ID: %lu.\n",
-               tasklet_id, DPU_QUERY_POINT.x, DPU_QUERY_POINT.y, dpu_index);
+        perfcounter_config(COUNT_CYCLES, true);
     }
+    barrier_wait(&batch_barrier);
+    perfcounter_t start_cycles = perfcounter_get();
+
+    BatchArgs args = DPU_BATCH_ARGS;
+    uint32_t buffer = args.buffer < NR_QUERY_BUFFERS ? args.buffer : 0;
+    uint32_t count = args.count < QUERY_BATCH_SIZE ? args.count : QUERY_BATCH_SIZE;
 
-    
+    uint64_t delta_count = DPU_DELTA_COUNT;
+    if (delta_count > DELTA_BUFFER_SIZE)
+    {
+        delta_count = 0;
+    }
 
+    // The host only sends filters for float trees; anything else than a power of two up to the WRAM copy is ignored
+    BloomArgs bloom = DPU_BLOOM_ARGS;
+    if (bloom.num_bits < 64 || bloom.num_bits > BLOOM_WRAM_BYTES * 8 || (bloom.num_bits & (bloom.num_bits - 1)) != 0 ||
+        bloom.num_hashes == 0)
+    {
+        bloom.num_bits = 0;
+    }
+
+    // Load the tree header and the filter, and resolve the queries the delta buffer answers (split across tasklets)
+    if (tasklet_id == 0)
+    {
+        tree_header = DPU_TREE_HEADER;
+    }
+    for (uint32_t offset = tasklet_id * BLOOM_CHUNK; offset < bloom.num_bits / 8; offset += NR_TASKLETS * BLOOM_CHUNK)
+    {
+        uint32_t size = bloom.num_bits / 8 - offset < BLOOM_CHUNK ? bloom.num_bits / 8 - offset : BLOOM_CHUNK;
+        mram_read(&DPU_BLOOM[offset / sizeof(uint64_t)], &bloom_filter[offset / sizeof(uint64_t)], size);
+        stats->mram_bytes += size;
+    }
+    for (uint32_t q = tasklet_id; q < count; q += NR_TASKLETS)
+    {
+        // The host leaves the delta buffer empty for quantized trees
+        batch_queries[q] = DPU_QUERIES[buffer][q];
+        delta_verdict[q] = lookup_delta(batch_queries[q].f, delta_count, stats);
+        stats->mram_bytes += sizeof(Point);
+        // A buffered insert or tombstone overrides the static tree
+        batch_found[q] = delta_verdict[q] == 1;
+    }
+    barrier_wait(&batch_barrier);
+
+    search_batch(tasklet_id, args, count, bloom, stats);
+
+    // Cycles cover the tasklet's own work, not the wait for the slowest one below
+    stats->cycles = perfcounter_get() - start_cycles;
+    DPU_STATS[tasklet_id] = *stats;
+
+    // Once every tasklet is done, the flags become the results; each entry has a single writer
+    barrier_wait(&batch_barrier);
+    for (uint32_t q = tasklet_id; q < count; q += NR_TASKLETS)
+    {
+        DPU_RESULTS[buffer][q] = batch_found[q];
+    }
     return 0;
 }
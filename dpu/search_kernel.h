@@ -0,0 +1,79 @@
+/* Body of the recursive tree search, included once per kernel by rtree_query.c.
+ * Before each inclusion define:
+ *   KERNEL_NAME          name of the generated function
+ *   KERNEL_TREE          node array to search, DPU_TREE (float) or DPU_QTREE (quantized)
+ *   KERNEL_FIELD         member of EncodedPoint matching the node encoding, f or q
+ *   KERNEL_FANOUT        bound of the child loop
+ *   KERNEL_BUNDLEFACTOR  bound of the leaf scan
+ *   KERNEL_UNROLL        (optional) unroll both loops by 4; partial so a wide fanout still fits IRAM
+ * No include guard on purpose. */
+
+// Recursive function to search a query point in the serialized R-tree
+bool KERNEL_NAME(int node_index, EncodedPoint query, int start_child, int end_child, const volatile uint8_t *found, TaskletStats *stats)
+{
+    // Another tasklet matched the query: report it found so the callers unwind at once
+    if (*found)
+    {
+        stats->early_exits++;
+        return true;
+    }
+    stats->nodes_visited++;
+    stats->mbr_tests++;
+    stats->mram_bytes += 2 * sizeof(int) + sizeof(MBR); // isLeaf, count and mbr
+
+    // Check if the query point is within the MBR of the current node
+    if (!(query.KERNEL_FIELD.x >= KERNEL_TREE[node_index].mbr.xmin && query.KERNEL_FIELD.x <= KERNEL_TREE[node_index].mbr.xmax && query.KERNEL_FIELD.y >= KERNEL_TREE[node_index].mbr.ymin && query.KERNEL_FIELD.y <= KERNEL_TREE[node_index].mbr.ymax))
+    {
+        return false; // Query point is outside the MBR
+    }
+
+    int count = KERNEL_TREE[node_index].count;
+    if (KERNEL_TREE[node_index].isLeaf)
+    {
+        // Search in the points of the leaf node
+#ifdef KERNEL_UNROLL
+#pragma unroll 4
+#endif
+        for (int i = 0; i < KERNEL_BUNDLEFACTOR; i++)
+        {
+            if (i >= count)
+                break;
+
+            stats->points_compared++;
+            stats->mram_bytes += sizeof(Point);
+            if (query.KERNEL_FIELD.x == KERNEL_TREE[node_index].points[i].x && query.KERNEL_FIELD.y == KERNEL_TREE[node_index].points[i].y)
+            {
+                return true;
+            }
+        }
+        return false; // Not found in this leaf node
+    }
+    else
+    {
+        // Recursively search in the assigned child nodes
+#ifdef KERNEL_UNROLL
+#pragma unroll 4
+#endif
+        for (int i = 0; i < KERNEL_FANOUT; i++)
+        {
+            if (i < start_child)
+                continue;
+            if (i >= end_child || i >= count) // Ensure we don't access out-of-bounds
+                break;
+
+            stats->mram_bytes += 2 * sizeof(int); // Child index and the child's count
+            if (KERNEL_NAME(KERNEL_TREE[node_index].children[i], query, 0, KERNEL_TREE[KERNEL_TREE[node_index].children[i]].count, found, stats))
+            {
+                return true;
+            }
+        }
+        return false; // Not found in any child nodes
+    }
+}
+
+#undef KERNEL_NAME
+#undef KERNEL_TREE
+#undef KERNEL_FIELD
+#undef KERNEL_FANOUT
+#undef KERNEL_BUNDLEFACTOR
+#undef KERNEL_UNROLL
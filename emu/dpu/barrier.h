@@ -0,0 +1,24 @@
+#ifndef __EMU_BARRIER_H__
+#define __EMU_BARRIER_H__
+
+/* Emulated DPU runtime: the tasklets of a virtual DPU take turns on one host thread and only
+ * give the thread up in barrier_wait, so a barrier is just a counter. Implemented by emu/emu.c.
+ *
+ * Tasklets therefore never interleave between two barriers. A tasklet sees the batch_found flags
+ * that tasklets before it set in the same phase, but never one that changes while it searches,
+ * so the kernel's exit from a search on another tasklet's match is not exercised concurrently
+ * here; only hardware runs it. */
+
+#include <stdint.h>
+
+typedef struct barrier_t
+{
+    uint32_t count;   // Tasklets taking part
+    uint32_t arrived; // Tasklets waiting for the rest
+} barrier_t;
+
+#define BARRIER_INIT(name, counter) barrier_t name = {(counter), 0}
+
+void barrier_wait(barrier_t *barrier);
+
+#endif /* __EMU_BARRIER_H__ */
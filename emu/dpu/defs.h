@@ -0,0 +1,13 @@
+#ifndef __EMU_DEFS_H__
+#define __EMU_DEFS_H__
+
+/* Emulated DPU runtime: the subset of <defs.h> the kernel uses. Implemented by emu/emu.c. */
+
+#include <stdint.h>
+
+typedef uint32_t sysname_t;
+
+// ID of the running tasklet (0 to NR_TASKLETS - 1)
+sysname_t me(void);
+
+#endif /* __EMU_DEFS_H__ */
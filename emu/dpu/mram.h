@@ -0,0 +1,39 @@
+#ifndef __EMU_MRAM_H__
+#define __EMU_MRAM_H__
+
+/* Emulated DPU runtime: MRAM and WRAM are both plain host memory, so the address space
+ * qualifiers vanish and DMA is a copy. Every virtual DPU loads its own copy of the kernel,
+ * which gives each one private __mram_noinit symbols. */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define __mram
+#define __mram_noinit
+#define __mram_ptr
+#define __dma_aligned __attribute__((aligned(8)))
+
+#define MRAM_DMA_MAX_BYTES 2048
+
+// The DMA engine of a real DPU moves 8 to 2048 bytes, a multiple of 8, between 8-byte aligned
+// addresses; a transfer breaking that has to fail here rather than only on hardware
+static inline void mram_check_dma(const void *from, const void *to, unsigned int nb_of_bytes)
+{
+    assert((uintptr_t)from % 8 == 0 && (uintptr_t)to % 8 == 0);
+    assert(nb_of_bytes >= 8 && nb_of_bytes <= MRAM_DMA_MAX_BYTES && nb_of_bytes % 8 == 0);
+}
+
+static inline void mram_read(const void *from, void *to, unsigned int nb_of_bytes)
+{
+    mram_check_dma(from, to, nb_of_bytes);
+    memcpy(to, from, nb_of_bytes);
+}
+
+static inline void mram_write(const void *from, void *to, unsigned int nb_of_bytes)
+{
+    mram_check_dma(from, to, nb_of_bytes);
+    memcpy(to, from, nb_of_bytes);
+}
+
+#endif /* __EMU_MRAM_H__ */
@@ -0,0 +1,23 @@
+#ifndef __EMU_PERFCOUNTER_H__
+#define __EMU_PERFCOUNTER_H__
+
+/* Emulated DPU runtime: the counter of a tasklet is the host CPU time it ran for, scaled to
+ * DPU cycles at EMU_DPU_MHZ. Implemented by emu/emu.c. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint64_t perfcounter_t;
+
+typedef enum perfcounter_config_t
+{
+    COUNT_SAME,
+    COUNT_CYCLES,
+    COUNT_INSTRUCTIONS,
+    COUNT_NOTHING
+} perfcounter_config_t;
+
+perfcounter_t perfcounter_config(perfcounter_config_t config, bool reset_value);
+perfcounter_t perfcounter_get(void);
+
+#endif /* __EMU_PERFCOUNTER_H__ */
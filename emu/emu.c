@@ -0,0 +1,659 @@
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "common.h"
+#include "dpu/barrier.h"
+#include "dpu/defs.h"
+#include "dpu/perfcounter.h"
+#include "host/dpu.h"
+#include "host/dpu_management.h"
+
+/* Virtual DPUs for hardware-free runs. Every DPU loads its own copy of the kernel shared object,
+ * so its globals are the DPU's MRAM and WRAM and transfers are copies into them by symbol name.
+ * A launch hands the DPUs to a pool of host threads; each runs the tasklets of one DPU as
+ * coroutines that only switch in barrier_wait, which keeps the kernel's synchronisation exact. */
+
+#define EMU_KERNEL_ENTRY "emu_kernel_main" // What the Makefile renames the kernel's main to
+#define EMU_TASKLET_STACK (256 * 1024)
+
+enum
+{
+    EMU_SET_ALL,
+    EMU_SET_RANK,
+    EMU_SET_DPU
+};
+
+typedef struct EmuDpu
+{
+    void *program;      // This DPU's copy of the kernel
+    int (*kernel)(void);
+    void *xfer_buffer;  // Set by dpu_prepare_xfer for the next dpu_push_xfer
+    uint64_t launches;
+    uint64_t bytes_to;  // Host to DPU
+    uint64_t bytes_from;
+    uint64_t cycles;         // Sum over launches of the busiest tasklet
+    uint64_t tasklet_cycles; // Sum over launches and tasklets
+} EmuDpu;
+
+struct dpu_rank_t
+{
+    dpu_id_t rank_id;
+};
+
+typedef struct EmuTasklet
+{
+    ucontext_t context;
+    barrier_t *waiting_on; // NULL when runnable
+    bool done;
+    uint64_t cpu_ns; // Host CPU time run so far in this launch
+} EmuTasklet;
+
+typedef struct EmuWorker
+{
+    pthread_t thread;
+    ucontext_t scheduler;
+    EmuTasklet tasklets[NR_TASKLETS];
+    uint8_t *stacks;
+    EmuDpu *dpu;
+    uint32_t current;    // Tasklet holding the thread
+    uint64_t resumed_ns; // Thread CPU time when it got it
+} EmuWorker;
+
+typedef struct EmuState
+{
+    EmuDpu *dpus;
+    uint32_t nr_dpus;
+    struct dpu_rank_t *ranks;
+    struct dpu_rank_t **rank_list; // What the list of a set points into
+    uint32_t nr_ranks;
+    EmuWorker *workers;
+    uint32_t nr_workers;
+    pthread_mutex_t launch_lock; // Rank threads may launch concurrently, launches run one at a time
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    uint32_t next; // Next DPU of the launch to hand out, equal to end when idle
+    uint32_t end;
+    uint32_t finished;
+    uint32_t total;
+    bool stop;
+    double launch_time;
+} EmuState;
+
+static EmuState emu_state = {NULL, 0, NULL, NULL, 0, NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                             PTHREAD_COND_INITIALIZER, 0, 0, 0, 0, false, 0.0};
+static __thread EmuWorker *current_worker;
+
+static uint64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static double wall_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t ns_to_cycles(uint64_t ns)
+{
+    return ns * EMU_DPU_MHZ / 1000;
+}
+
+/* DPU runtime seen by the kernel */
+
+sysname_t me(void)
+{
+    return current_worker->current;
+}
+
+void barrier_wait(barrier_t *barrier)
+{
+    EmuWorker *worker = current_worker;
+    if (++barrier->arrived < barrier->count)
+    {
+        EmuTasklet *tasklet = &worker->tasklets[worker->current];
+        tasklet->waiting_on = barrier;
+        swapcontext(&tasklet->context, &worker->scheduler);
+        return;
+    }
+    barrier->arrived = 0;
+    for (uint32_t t = 0; t < NR_TASKLETS; t++)
+    {
+        if (worker->tasklets[t].waiting_on == barrier)
+            worker->tasklets[t].waiting_on = NULL;
+    }
+}
+
+perfcounter_t perfcounter_get(void)
+{
+    EmuWorker *worker = current_worker;
+    return ns_to_cycles(worker->tasklets[worker->current].cpu_ns + thread_cpu_ns() - worker->resumed_ns);
+}
+
+// Counters are per tasklet and start at zero every launch, so there is nothing to reset
+perfcounter_t perfcounter_config(perfcounter_config_t config, bool reset_value)
+{
+    (void)config;
+    (void)reset_value;
+    return perfcounter_get();
+}
+
+/* Launches */
+
+static void tasklet_entry(void)
+{
+    EmuWorker *worker = current_worker;
+    worker->dpu->kernel();
+    worker->tasklets[worker->current].done = true;
+}
+
+// Function to run one launch of a DPU: resume runnable tasklets in turn until all returned
+static void run_dpu(EmuWorker *worker, EmuDpu *dpu)
+{
+    worker->dpu = dpu;
+    for (uint32_t t = 0; t < NR_TASKLETS; t++)
+    {
+        EmuTasklet *tasklet = &worker->tasklets[t];
+        tasklet->waiting_on = NULL;
+        tasklet->done = false;
+        tasklet->cpu_ns = 0;
+        getcontext(&tasklet->context);
+        tasklet->context.uc_stack.ss_sp = worker->stacks + (size_t)t * EMU_TASKLET_STACK;
+        tasklet->context.uc_stack.ss_size = EMU_TASKLET_STACK;
+        tasklet->context.uc_link = &worker->scheduler;
+        makecontext(&tasklet->context, tasklet_entry, 0);
+    }
+
+    uint32_t remaining = NR_TASKLETS;
+    while (remaining > 0)
+    {
+        bool progress = false;
+        for (uint32_t t = 0; t < NR_TASKLETS; t++)
+        {
+            EmuTasklet *tasklet = &worker->tasklets[t];
+            if (tasklet->done || tasklet->waiting_on != NULL)
+                continue;
+            worker->current = t;
+            worker->resumed_ns = thread_cpu_ns();
+            swapcontext(&worker->scheduler, &tasklet->context);
+            tasklet->cpu_ns += thread_cpu_ns() - worker->resumed_ns;
+            progress = true;
+            if (tasklet->done)
+                remaining--;
+        }
+        if (!progress)
+        {
+            fprintf(stderr, "Emulated DPU %ld: every tasklet left is waiting on a barrier\n", (long)(dpu - emu_state.dpus));
+            exit(1);
+        }
+    }
+
+    uint64_t busiest = 0;
+    for (uint32_t t = 0; t < NR_TASKLETS; t++)
+    {
+        uint64_t cycles = ns_to_cycles(worker->tasklets[t].cpu_ns);
+        dpu->tasklet_cycles += cycles;
+        busiest = cycles > busiest ? cycles : busiest;
+    }
+    dpu->cycles += busiest;
+    dpu->launches++;
+}
+
+static void *worker_main(void *arg)
+{
+    current_worker = (EmuWorker *)arg;
+    pthread_mutex_lock(&emu_state.lock);
+    while (true)
+    {
+        while (!emu_state.stop && emu_state.next == emu_state.end)
+            pthread_cond_wait(&emu_state.work, &emu_state.lock);
+        if (emu_state.stop)
+            break;
+        EmuDpu *dpu = &emu_state.dpus[emu_state.next++];
+        pthread_mutex_unlock(&emu_state.lock);
+
+        run_dpu(current_worker, dpu);
+
+        pthread_mutex_lock(&emu_state.lock);
+        if (++emu_state.finished == emu_state.total)
+            pthread_cond_signal(&emu_state.done);
+    }
+    pthread_mutex_unlock(&emu_state.lock);
+    return NULL;
+}
+
+/* Sets */
+
+static uint32_t rank_end(uint32_t begin, uint32_t limit)
+{
+    uint32_t end = (begin / EMU_DPUS_PER_RANK + 1) * EMU_DPUS_PER_RANK;
+    return end < limit ? end : limit;
+}
+
+// Function to build a set, pointing the list of a rank set at its rank
+static struct dpu_set_t make_set(uint32_t kind, uint32_t begin, uint32_t end, uint32_t limit)
+{
+    struct dpu_set_t set = {kind, begin, end, limit, {0, NULL}};
+    if (kind == EMU_SET_ALL)
+    {
+        set.list.nr_ranks = emu_state.nr_ranks;
+        set.list.ranks = emu_state.rank_list;
+    }
+    else if (kind == EMU_SET_RANK && begin < emu_state.nr_dpus)
+    {
+        set.list.nr_ranks = 1;
+        set.list.ranks = &emu_state.rank_list[begin / EMU_DPUS_PER_RANK];
+    }
+    return set;
+}
+
+struct dpu_set_t emu_first_dpu(struct dpu_set_t dpu_set)
+{
+    return make_set(EMU_SET_DPU, dpu_set.begin, dpu_set.begin + 1, dpu_set.end);
+}
+
+struct dpu_set_t emu_first_rank(struct dpu_set_t dpu_set)
+{
+    return make_set(EMU_SET_RANK, dpu_set.begin, rank_end(dpu_set.begin, dpu_set.end), dpu_set.end);
+}
+
+struct dpu_set_t emu_next(struct dpu_set_t dpu_set)
+{
+    if (dpu_set.kind == EMU_SET_DPU)
+        return make_set(EMU_SET_DPU, dpu_set.begin + 1, dpu_set.begin + 2, dpu_set.limit);
+    return make_set(EMU_SET_RANK, dpu_set.end, rank_end(dpu_set.end, dpu_set.limit), dpu_set.limit);
+}
+
+dpu_id_t dpu_get_rank_id(struct dpu_rank_t *rank)
+{
+    return rank->rank_id;
+}
+
+bool emu_valid(struct dpu_set_t dpu_set)
+{
+    return dpu_set.begin < dpu_set.limit;
+}
+
+/* Host API */
+
+const char *dpu_error_to_string(dpu_error_t status)
+{
+    switch (status)
+    {
+    case DPU_OK:
+        return "success";
+    case DPU_ERR_ALLOCATION:
+        return "allocation failed";
+    case DPU_ERR_INVALID_SYMBOL_ACCESS:
+        return "access outside of the symbol";
+    case DPU_ERR_ELF_INVALID_FILE:
+        return "cannot load the kernel";
+    case DPU_ERR_NO_SUCH_SYMBOL:
+        return "no such symbol";
+    default:
+        return "system error";
+    }
+}
+
+dpu_error_t dpu_alloc(uint32_t nr_dpus, const char *profile, struct dpu_set_t *dpu_set)
+{
+    (void)profile;
+    if (emu_state.dpus != NULL)
+        return DPU_ERR_ALLOCATION;
+    if (nr_dpus == DPU_ALLOCATE_ALL)
+        nr_dpus = EMU_DPUS_PER_RANK;
+
+    // One host thread per core unless EMU_THREADS says otherwise, never more than DPUs
+    long nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *threads = getenv("EMU_THREADS");
+    if (threads != NULL && atoi(threads) > 0)
+        nr_workers = atoi(threads);
+    if (nr_workers > (long)nr_dpus)
+        nr_workers = nr_dpus;
+    if (nr_workers < 1)
+        nr_workers = 1;
+
+    uint32_t nr_ranks = (nr_dpus + EMU_DPUS_PER_RANK - 1) / EMU_DPUS_PER_RANK;
+    emu_state.dpus = (EmuDpu *)calloc(nr_dpus > 0 ? nr_dpus : 1, sizeof(EmuDpu));
+    emu_state.ranks = (struct dpu_rank_t *)calloc(nr_ranks > 0 ? nr_ranks : 1, sizeof(struct dpu_rank_t));
+    emu_state.rank_list = (struct dpu_rank_t **)calloc(nr_ranks > 0 ? nr_ranks : 1, sizeof(struct dpu_rank_t *));
+    emu_state.workers = (EmuWorker *)calloc(nr_workers, sizeof(EmuWorker));
+    if (emu_state.dpus == NULL || emu_state.ranks == NULL || emu_state.rank_list == NULL || emu_state.workers == NULL)
+        return DPU_ERR_ALLOCATION;
+    for (uint32_t r = 0; r < nr_ranks; r++)
+    {
+        emu_state.ranks[r].rank_id = r;
+        emu_state.rank_list[r] = &emu_state.ranks[r];
+    }
+    emu_state.nr_ranks = nr_ranks;
+    emu_state.nr_dpus = nr_dpus;
+    emu_state.nr_workers = (uint32_t)nr_workers;
+    emu_state.stop = false;
+    for (uint32_t w = 0; w < emu_state.nr_workers; w++)
+    {
+        EmuWorker *worker = &emu_state.workers[w];
+        worker->stacks = (uint8_t *)mmap(NULL, (size_t)NR_TASKLETS * EMU_TASKLET_STACK, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (worker->stacks == MAP_FAILED || pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+            return DPU_ERR_ALLOCATION;
+    }
+
+    *dpu_set = make_set(EMU_SET_ALL, 0, nr_dpus, nr_dpus);
+    return DPU_OK;
+}
+
+// Function to print what the virtual DPUs did, and every DPU's counters to EMU_REPORT if set
+static void report(void)
+{
+    uint64_t launches = 0, bytes_to = 0, bytes_from = 0, cycles = 0, max_cycles = 0;
+    uint32_t busiest = 0;
+    for (uint32_t d = 0; d < emu_state.nr_dpus; d++)
+    {
+        EmuDpu *dpu = &emu_state.dpus[d];
+        launches += dpu->launches;
+        bytes_to += dpu->bytes_to;
+        bytes_from += dpu->bytes_from;
+        cycles += dpu->cycles;
+        if (dpu->cycles > max_cycles)
+        {
+            max_cycles = dpu->cycles;
+            busiest = d;
+        }
+    }
+    double mean_cycles = emu_state.nr_dpus > 0 ? (double)cycles / emu_state.nr_dpus : 0.0;
+    printf(ANSI_COLOR_LIGHT_BLUE "\nEmulated %u DPU(s) on %u host thread(s)" ANSI_COLOR_RESET "\n", emu_state.nr_dpus,
+           emu_state.nr_workers);
+    printf("%lu DPU launches in %.3f s, %.2f MB to and %.2f MB from the DPUs\n", (unsigned long)launches,
+           emu_state.launch_time, bytes_to / 1e6, bytes_from / 1e6);
+    printf("Cycles at %d MHz per DPU: mean %.0f, busiest DPU %u %lu (max/mean %.2f)\n", EMU_DPU_MHZ, mean_cycles, busiest,
+           (unsigned long)max_cycles, mean_cycles > 0 ? max_cycles / mean_cycles : 0.0);
+
+    const char *path = getenv("EMU_REPORT");
+    if (path == NULL)
+        return;
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror("Failed to open the emulation report");
+        return;
+    }
+    fprintf(file, "dpu,launches,bytes_to,bytes_from,cycles,tasklet_cycles\n");
+    for (uint32_t d = 0; d < emu_state.nr_dpus; d++)
+    {
+        EmuDpu *dpu = &emu_state.dpus[d];
+        fprintf(file, "%u,%lu,%lu,%lu,%lu,%lu\n", d, (unsigned long)dpu->launches, (unsigned long)dpu->bytes_to,
+                (unsigned long)dpu->bytes_from, (unsigned long)dpu->cycles, (unsigned long)dpu->tasklet_cycles);
+    }
+    fclose(file);
+}
+
+dpu_error_t dpu_free(struct dpu_set_t dpu_set)
+{
+    (void)dpu_set;
+    if (emu_state.dpus == NULL)
+        return DPU_ERR_ALLOCATION;
+    report();
+
+    pthread_mutex_lock(&emu_state.lock);
+    emu_state.stop = true;
+    pthread_cond_broadcast(&emu_state.work);
+    pthread_mutex_unlock(&emu_state.lock);
+    for (uint32_t w = 0; w < emu_state.nr_workers; w++)
+    {
+        pthread_join(emu_state.workers[w].thread, NULL);
+        munmap(emu_state.workers[w].stacks, (size_t)NR_TASKLETS * EMU_TASKLET_STACK);
+    }
+    for (uint32_t d = 0; d < emu_state.nr_dpus; d++)
+    {
+        if (emu_state.dpus[d].program != NULL)
+            dlclose(emu_state.dpus[d].program);
+    }
+    free(emu_state.workers);
+    free(emu_state.rank_list);
+    free(emu_state.ranks);
+    free(emu_state.dpus);
+    emu_state.workers = NULL;
+    emu_state.rank_list = NULL;
+    emu_state.ranks = NULL;
+    emu_state.dpus = NULL;
+    emu_state.nr_ranks = 0;
+    emu_state.nr_dpus = 0;
+    emu_state.next = emu_state.end = 0;
+    return DPU_OK;
+}
+
+// Function to load a private copy of the kernel. dlopen hands back the loaded object for a path
+// it has seen, so every DPU gets the image under its own file name. Reloading starts from zeroed MRAM.
+static dpu_error_t load_program(EmuDpu *dpu, const char *directory, uint32_t dpu_index, const void *image, size_t size)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/dpu_%u.so", directory, dpu_index);
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return DPU_ERR_SYSTEM;
+    bool written = fwrite(image, 1, size, file) == size;
+    if (fclose(file) != 0 || !written)
+    {
+        unlink(path);
+        return DPU_ERR_SYSTEM;
+    }
+
+    if (dpu->program != NULL)
+        dlclose(dpu->program);
+    dpu->program = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    unlink(path);
+    if (dpu->program == NULL)
+    {
+        fprintf(stderr, "%s\n", dlerror());
+        return DPU_ERR_ELF_INVALID_FILE;
+    }
+    *(void **)&dpu->kernel = dlsym(dpu->program, EMU_KERNEL_ENTRY);
+    return dpu->kernel != NULL ? DPU_OK : DPU_ERR_ELF_INVALID_FILE;
+}
+
+dpu_error_t dpu_load(struct dpu_set_t dpu_set, const char *binary_path, void *program)
+{
+    (void)program;
+    FILE *file = fopen(binary_path, "rb");
+    if (file == NULL)
+    {
+        perror(binary_path);
+        return DPU_ERR_ELF_INVALID_FILE;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *image = malloc(size > 0 ? (size_t)size : 1);
+    if (image == NULL || size <= 0 || fread(image, 1, (size_t)size, file) != (size_t)size)
+    {
+        free(image);
+        fclose(file);
+        return DPU_ERR_ELF_INVALID_FILE;
+    }
+    fclose(file);
+
+    const char *tmp = getenv("TMPDIR");
+    char directory[256];
+    snprintf(directory, sizeof(directory), "%s/dpu_emu_XXXXXX", tmp != NULL ? tmp : "/tmp");
+    if (mkdtemp(directory) == NULL)
+    {
+        free(image);
+        return DPU_ERR_SYSTEM;
+    }
+    dpu_error_t status = DPU_OK;
+    for (uint32_t d = dpu_set.begin; d < dpu_set.end && status == DPU_OK; d++)
+        status = load_program(&emu_state.dpus[d], directory, d, image, (size_t)size);
+    rmdir(directory);
+    free(image);
+    return status;
+}
+
+dpu_error_t dpu_get_nr_dpus(struct dpu_set_t dpu_set, uint32_t *nr_dpus)
+{
+    *nr_dpus = dpu_set.end - dpu_set.begin;
+    return DPU_OK;
+}
+
+dpu_error_t dpu_get_nr_ranks(struct dpu_set_t dpu_set, uint32_t *nr_ranks)
+{
+    struct dpu_set_t rank;
+    *nr_ranks = 0;
+    DPU_RANK_FOREACH(dpu_set, rank)
+    {
+        (*nr_ranks)++;
+    }
+    return DPU_OK;
+}
+
+// Function to find where a transfer lands in a DPU, checked against the size of the symbol
+static dpu_error_t resolve(EmuDpu *dpu, const char *symbol_name, uint32_t symbol_offset, size_t length, uint8_t **address)
+{
+    if (dpu->program == NULL)
+        return DPU_ERR_ELF_INVALID_FILE;
+    void *symbol = dlsym(dpu->program, symbol_name);
+    if (symbol == NULL)
+        return DPU_ERR_NO_SUCH_SYMBOL;
+
+    Dl_info info;
+    const ElfW(Sym) *entry = NULL;
+    if (dladdr1(symbol, &info, (void **)&entry, RTLD_DL_SYMENT) != 0 && entry != NULL &&
+        (uint64_t)symbol_offset + length > entry->st_size)
+    {
+        return DPU_ERR_INVALID_SYMBOL_ACCESS;
+    }
+    *address = (uint8_t *)symbol + symbol_offset;
+    return DPU_OK;
+}
+
+dpu_error_t dpu_copy_to(struct dpu_set_t dpu_set, const char *symbol_name, uint32_t symbol_offset, const void *src, size_t length)
+{
+    for (uint32_t d = dpu_set.begin; d < dpu_set.end; d++)
+    {
+        uint8_t *address;
+        dpu_error_t status = resolve(&emu_state.dpus[d], symbol_name, symbol_offset, length, &address);
+        if (status != DPU_OK)
+            return status;
+        memcpy(address, src, length);
+        emu_state.dpus[d].bytes_to += length;
+    }
+    return DPU_OK;
+}
+
+dpu_error_t dpu_copy_from(struct dpu_set_t dpu_set, const char *symbol_name, uint32_t symbol_offset, void *dst, size_t length)
+{
+    if (dpu_set.end - dpu_set.begin != 1)
+        return DPU_ERR_INVALID_SYMBOL_ACCESS;
+    uint8_t *address;
+    dpu_error_t status = resolve(&emu_state.dpus[dpu_set.begin], symbol_name, symbol_offset, length, &address);
+    if (status != DPU_OK)
+        return status;
+    memcpy(dst, address, length);
+    emu_state.dpus[dpu_set.begin].bytes_from += length;
+    return DPU_OK;
+}
+
+dpu_error_t dpu_broadcast_to(struct dpu_set_t dpu_set, const char *symbol_name, uint32_t symbol_offset, const void *src,
+                             size_t length, dpu_xfer_flags_t flags)
+{
+    (void)flags;
+    return dpu_copy_to(dpu_set, symbol_name, symbol_offset, src, length);
+}
+
+dpu_error_t dpu_prepare_xfer(struct dpu_set_t dpu_set, void *buffer)
+{
+    for (uint32_t d = dpu_set.begin; d < dpu_set.end; d++)
+        emu_state.dpus[d].xfer_buffer = buffer;
+    return DPU_OK;
+}
+
+// Asynchronous transfers, launches and callbacks complete before returning, in the order queued
+dpu_error_t dpu_push_xfer(struct dpu_set_t dpu_set, dpu_xfer_t xfer, const char *symbol_name, uint32_t symbol_offset,
+                          size_t length, dpu_xfer_flags_t flags)
+{
+    for (uint32_t d = dpu_set.begin; d < dpu_set.end; d++)
+    {
+        EmuDpu *dpu = &emu_state.dpus[d];
+        if (dpu->xfer_buffer == NULL)
+            continue;
+        uint8_t *address;
+        dpu_error_t status = resolve(dpu, symbol_name, symbol_offset, length, &address);
+        if (status != DPU_OK)
+            return status;
+        if (xfer == DPU_XFER_TO_DPU)
+        {
+            memcpy(address, dpu->xfer_buffer, length);
+            dpu->bytes_to += length;
+        }
+        else
+        {
+            memcpy(dpu->xfer_buffer, address, length);
+            dpu->bytes_from += length;
+        }
+        if (!(flags & DPU_XFER_NO_RESET))
+            dpu->xfer_buffer = NULL;
+    }
+    return DPU_OK;
+}
+
+dpu_error_t dpu_launch(struct dpu_set_t dpu_set, dpu_launch_policy_t policy)
+{
+    (void)policy;
+    if (dpu_set.begin >= dpu_set.end)
+        return DPU_OK;
+    for (uint32_t d = dpu_set.begin; d < dpu_set.end; d++)
+    {
+        if (emu_state.dpus[d].kernel == NULL)
+            return DPU_ERR_ELF_INVALID_FILE;
+    }
+
+    pthread_mutex_lock(&emu_state.launch_lock);
+    double start = wall_seconds();
+    pthread_mutex_lock(&emu_state.lock);
+    emu_state.next = dpu_set.begin;
+    emu_state.end = dpu_set.end;
+    emu_state.finished = 0;
+    emu_state.total = dpu_set.end - dpu_set.begin;
+    pthread_cond_broadcast(&emu_state.work);
+    while (emu_state.finished < emu_state.total)
+        pthread_cond_wait(&emu_state.done, &emu_state.lock);
+    pthread_mutex_unlock(&emu_state.lock);
+    emu_state.launch_time += wall_seconds() - start;
+    pthread_mutex_unlock(&emu_state.launch_lock);
+    return DPU_OK;
+}
+
+dpu_error_t dpu_sync(struct dpu_set_t dpu_set)
+{
+    (void)dpu_set;
+    return DPU_OK;
+}
+
+dpu_error_t dpu_callback(struct dpu_set_t dpu_set, dpu_error_t (*callback)(struct dpu_set_t, uint32_t, void *), void *args,
+                         dpu_callback_flags_t flags)
+{
+    if (flags & DPU_CALLBACK_SINGLE_CALL)
+        return callback(dpu_set, 0, args);
+
+    struct dpu_set_t rank;
+    DPU_RANK_FOREACH(dpu_set, rank)
+    {
+        dpu_error_t status = callback(rank, rank.begin / EMU_DPUS_PER_RANK, args);
+        if (status != DPU_OK)
+            return status;
+    }
+    return DPU_OK;
+}
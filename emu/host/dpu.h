@@ -0,0 +1,116 @@
+#ifndef __EMU_DPU_H__
+#define __EMU_DPU_H__
+
+/* Emulated host API: the subset of the UPMEM <dpu.h> the host uses, served by virtual DPUs
+ * (emu/emu.c). The kernel runs natively, one copy per virtual DPU, so this measures layouts and
+ * batching without hardware; times and cycles are host figures, not DPU ones. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define EMU_DPUS_PER_RANK 64 // Virtual DPUs grouped per rank, as on the hardware
+#define EMU_DPU_MHZ 350      // Clock the tasklet CPU time is converted to cycles with
+
+#define DPU_ALLOCATE_ALL 0xFFFFFFFFu
+
+typedef enum dpu_error_t
+{
+    DPU_OK,
+    DPU_ERR_ALLOCATION,
+    DPU_ERR_INVALID_SYMBOL_ACCESS,
+    DPU_ERR_ELF_INVALID_FILE,
+    DPU_ERR_NO_SUCH_SYMBOL,
+    DPU_ERR_SYSTEM
+} dpu_error_t;
+
+typedef enum dpu_launch_policy_t
+{
+    DPU_ASYNCHRONOUS,
+    DPU_SYNCHRONOUS
+} dpu_launch_policy_t;
+
+typedef enum dpu_xfer_t
+{
+    DPU_XFER_TO_DPU,
+    DPU_XFER_FROM_DPU
+} dpu_xfer_t;
+
+typedef enum dpu_xfer_flags_t
+{
+    DPU_XFER_DEFAULT = 0,
+    DPU_XFER_NO_RESET = 1,
+    DPU_XFER_ASYNC = 2
+} dpu_xfer_flags_t;
+
+typedef enum dpu_callback_flags_t
+{
+    DPU_CALLBACK_DEFAULT = 0,
+    DPU_CALLBACK_ASYNC = 1,
+    DPU_CALLBACK_NONBLOCKING = 2,
+    DPU_CALLBACK_SINGLE_CALL = 4
+} dpu_callback_flags_t;
+
+typedef uint32_t dpu_id_t;
+struct dpu_rank_t; // Opaque, as in the SDK
+
+/* A run of consecutive virtual DPUs: the whole allocation, one rank or one DPU. limit is the end
+ * of the set being iterated, so DPU_FOREACH and DPU_RANK_FOREACH can step past it. */
+struct dpu_set_t
+{
+    uint32_t kind;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t limit;
+    struct
+    {
+        uint32_t nr_ranks;
+        struct dpu_rank_t **ranks;
+    } list; // Ranks of an allocation or rank set, laid out as in the SDK's set
+};
+
+dpu_error_t dpu_alloc(uint32_t nr_dpus, const char *profile, struct dpu_set_t *dpu_set);
+dpu_error_t dpu_free(struct dpu_set_t dpu_set);
+dpu_error_t dpu_load(struct dpu_set_t dpu_set, const char *binary_path, void *program);
+dpu_error_t dpu_get_nr_dpus(struct dpu_set_t dpu_set, uint32_t *nr_dpus);
+dpu_error_t dpu_get_nr_ranks(struct dpu_set_t dpu_set, uint32_t *nr_ranks);
+dpu_error_t dpu_copy_to(struct dpu_set_t dpu_set, const char *symbol_name, uint32_t symbol_offset, const void *src, size_t length);
+dpu_error_t dpu_copy_from(struct dpu_set_t dpu_set, const char *symbol_name, uint32_t symbol_offset, void *dst, size_t length);
+dpu_error_t dpu_broadcast_to(struct dpu_set_t dpu_set, const char *symbol_name, uint32_t symbol_offset, const void *src,
+                             size_t length, dpu_xfer_flags_t flags);
+dpu_error_t dpu_prepare_xfer(struct dpu_set_t dpu_set, void *buffer);
+dpu_error_t dpu_push_xfer(struct dpu_set_t dpu_set, dpu_xfer_t xfer, const char *symbol_name, uint32_t symbol_offset,
+                          size_t length, dpu_xfer_flags_t flags);
+dpu_error_t dpu_launch(struct dpu_set_t dpu_set, dpu_launch_policy_t policy);
+dpu_error_t dpu_sync(struct dpu_set_t dpu_set);
+dpu_error_t dpu_callback(struct dpu_set_t dpu_set, dpu_error_t (*callback)(struct dpu_set_t, uint32_t, void *), void *args,
+                         dpu_callback_flags_t flags);
+const char *dpu_error_to_string(dpu_error_t status);
+
+// Iteration helpers behind DPU_FOREACH and DPU_RANK_FOREACH
+struct dpu_set_t emu_first_dpu(struct dpu_set_t dpu_set);
+struct dpu_set_t emu_first_rank(struct dpu_set_t dpu_set);
+struct dpu_set_t emu_next(struct dpu_set_t dpu_set);
+bool emu_valid(struct dpu_set_t dpu_set);
+
+#define DPU_FOREACH(set, dpu, ...) \
+    for (dpu = emu_first_dpu(set) __VA_OPT__(, __VA_ARGS__ = 0); emu_valid(dpu); dpu = emu_next(dpu) __VA_OPT__(, __VA_ARGS__++))
+
+#define DPU_RANK_FOREACH(set, rank, ...) \
+    for (rank = emu_first_rank(set) __VA_OPT__(, __VA_ARGS__ = 0); emu_valid(rank); rank = emu_next(rank) __VA_OPT__(, __VA_ARGS__++))
+
+#define DPU_ASSERT(statement)                                                                        \
+    do                                                                                               \
+    {                                                                                                \
+        dpu_error_t __error = (statement);                                                           \
+        if (__error != DPU_OK)                                                                       \
+        {                                                                                            \
+            fprintf(stderr, "%s:%d: %s failed: %s\n", __FILE__, __LINE__, #statement,                \
+                    dpu_error_to_string(__error));                                                   \
+            exit(1);                                                                                 \
+        }                                                                                            \
+    } while (0)
+
+#endif /* __EMU_DPU_H__ */
@@ -0,0 +1,11 @@
+#ifndef __EMU_DPU_MANAGEMENT_H__
+#define __EMU_DPU_MANAGEMENT_H__
+
+/* Emulated subset of the UPMEM <dpu_management.h> */
+
+#include "dpu.h"
+
+// Identifier of a rank; virtual ranks are numbered from 0 in allocation order
+dpu_id_t dpu_get_rank_id(struct dpu_rank_t *rank);
+
+#endif /* __EMU_DPU_MANAGEMENT_H__ */
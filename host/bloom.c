@@ -0,0 +1,119 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+// Function to compute the two base hashes of a point, as the DPU kernel does
+static void point_hashes(Point p, uint32_t *h1, uint32_t *h2)
+{
+    uint32_t x, y;
+    memcpy(&x, &p.x, sizeof(uint32_t));
+    memcpy(&y, &p.y, sizeof(uint32_t));
+    bloom_hashes(x, y, h1, h2);
+}
+
+static void add_point(BloomFilter *filter, Point p)
+{
+    uint32_t h1, h2;
+    point_hashes(p, &h1, &h2);
+    for (uint32_t i = 0; i < filter->num_hashes; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & (filter->num_bits - 1);
+        filter->bits[bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+// Function to add the points below a node
+static void add_subtree(BloomFilter *filter, Node *node)
+{
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->count; i++)
+            add_point(filter, node->points[i]);
+        return;
+    }
+    for (int i = 0; i < node->count; i++)
+        add_subtree(filter, node->children[i]);
+}
+
+void bloom_build(BloomFilter *filter, Node *partition, uint32_t bits_per_point, uint32_t max_bits)
+{
+    uint32_t num_points = (uint32_t)countPointsInSubtree(partition);
+    uint64_t wanted = (uint64_t)num_points * bits_per_point;
+
+    filter->num_bits = 64;
+    while (filter->num_bits < wanted && filter->num_bits <= max_bits / 2)
+        filter->num_bits *= 2;
+
+    // k = ln 2 * m / n minimizes the false-positive rate for the size the filter ended up with
+    uint32_t hashes = num_points > 0 ? (uint32_t)lround(0.693 * filter->num_bits / num_points) : 1;
+    filter->num_hashes = hashes < 1 ? 1 : (hashes > 8 ? 8 : hashes);
+
+    filter->bits = (uint64_t *)calloc(filter->num_bits / 64, sizeof(uint64_t));
+    if (filter->bits == NULL)
+    {
+        perror("Failed to allocate Bloom filter");
+        exit(1);
+    }
+    if (partition != NULL)
+        add_subtree(filter, partition);
+}
+
+void bloom_free(BloomFilter *filter)
+{
+    free(filter->bits);
+    filter->bits = NULL;
+}
+
+bool bloom_may_contain(const BloomFilter *filter, Point p)
+{
+    uint32_t h1, h2;
+    point_hashes(p, &h1, &h2);
+    for (uint32_t i = 0; i < filter->num_hashes; i++)
+    {
+        uint32_t bit = (h1 + i * h2) & (filter->num_bits - 1);
+        if (!(filter->bits[bit / 64] >> (bit % 64) & 1))
+            return false;
+    }
+    return true;
+}
+
+int bloom_filter_queries(const BloomFilter *filters, int num_filters, const Point *queries, int num_queries, int *kept)
+{
+    int num_kept = 0;
+    for (int q = 0; q < num_queries; q++)
+    {
+        for (int f = 0; f < num_filters; f++)
+        {
+            if (bloom_may_contain(&filters[f], queries[q]))
+            {
+                kept[num_kept++] = q;
+                break;
+            }
+        }
+    }
+    return num_kept;
+}
+
+BloomStats bloom_measure(const BloomFilter *filters, int num_filters, Node *const *partitions, const Point *queries, int num_queries)
+{
+    BloomStats stats = {0, 0, 0, 0};
+    for (int q = 0; q < num_queries; q++)
+    {
+        bool any = false;
+        for (int f = 0; f < num_filters; f++)
+        {
+            stats.checks++;
+            if (!bloom_may_contain(&filters[f], queries[q]))
+                continue;
+            any = true;
+            stats.passed++;
+            if (partitions[f] == NULL || !searchRTree(partitions[f], queries[q]))
+                stats.false_positives++;
+        }
+        if (!any)
+            stats.rejected++;
+    }
+    return stats;
+}
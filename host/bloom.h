@@ -0,0 +1,41 @@
+#ifndef __BLOOM_H__
+#define __BLOOM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "rtree.h"
+
+/* Bloom filter over the points of one partition. A negative answer is definite, so a query no
+ * partition's filter accepts is answered on the host without any DPU traversal. */
+typedef struct BloomFilter
+{
+    uint64_t *bits;
+    uint32_t num_bits; // Power of two, at least 64
+    uint32_t num_hashes;
+} BloomFilter;
+
+/* False-positive measurement of a set of filters against a query set */
+typedef struct BloomStats
+{
+    uint64_t checks;          // Filter probes, one per query and partition
+    uint64_t passed;          // Probes the filter accepted
+    uint64_t false_positives; // Accepted although the partition does not hold the point
+    uint64_t rejected;        // Queries every filter rejected
+} BloomStats;
+
+// Build the filter of a partition (NULL for an empty one) with about bits_per_point bits per point,
+// rounded to a power of two and capped at max_bits
+void bloom_build(BloomFilter *filter, Node *partition, uint32_t bits_per_point, uint32_t max_bits);
+void bloom_free(BloomFilter *filter);
+
+bool bloom_may_contain(const BloomFilter *filter, Point p);
+
+// Keep the queries some filter accepts: their indices go to kept[], their number is returned
+int bloom_filter_queries(const BloomFilter *filters, int num_filters, const Point *queries, int num_queries, int *kept);
+
+// Probe every filter with every query and check each accepted probe against the partition of that filter
+BloomStats bloom_measure(const BloomFilter *filters, int num_filters, Node *const *partitions, const Point *queries, int num_queries);
+
+#endif /* __BLOOM_H__ */
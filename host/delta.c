@@ -0,0 +1,331 @@
+#include <dpu.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "delta.h"
+#include "rtree.h"
+#include "timing.h"
+#include "update.h"
+
+// Function to check whether p is visible in one partition: the newest buffered entry wins,
+// otherwise the pointer tree decides
+static bool visible_in_partition(DeltaStore *store, int partition, Point p)
+{
+    DeltaBuffer *buffer = &store->buffers[partition];
+    for (uint32_t i = buffer->count; i-- > 0;)
+    {
+        if (buffer->entries[i].point.x == p.x && buffer->entries[i].point.y == p.y)
+            return buffer->entries[i].op == DELTA_INSERT;
+    }
+    Node *subtree = getPartition(store->root, partition);
+    return subtree != NULL && searchRTree(subtree, p);
+}
+
+// Function to write the used part of a host buffer and its counter to the DPU
+static void write_buffer(DeltaStore *store, int partition, uint32_t first)
+{
+    DeltaBuffer *buffer = &store->buffers[partition];
+    uint64_t count = buffer->count;
+    if (count > first)
+    {
+        size_t size = (count - first) * sizeof(DeltaEntry);
+        DPU_ASSERT(dpu_copy_to(store->dpus[partition], "DPU_DELTA", first * sizeof(DeltaEntry), &buffer->entries[first], size));
+        store->stats.bytes += size;
+    }
+    // The counter goes last so the kernel never reads an entry that is not written yet
+    DPU_ASSERT(dpu_copy_to(store->dpus[partition], "DPU_DELTA_COUNT", 0, &count, sizeof(uint64_t)));
+    store->stats.bytes += sizeof(uint64_t);
+}
+
+// Fold a snapshot of buffered entries into a copy of the partition's subtree and serialize it.
+// Called without the lock: the live subtree only changes when an image is published or merged
+// inline, and neither happens while store->merging is set.
+static Node *merge_entries(Node *subtree, const DeltaEntry *entries, uint32_t count, int partition, SerializedNode **image,
+                           int *num_nodes)
+{
+    Node *merged = copySubtree(subtree);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (entries[i].op == DELTA_INSERT)
+        {
+            insertIntoSubtree(&merged, entries[i].point);
+        }
+        else
+        {
+            // A tombstone hides every copy of the point in this partition
+            while (deleteFromSubtree(&merged, entries[i].point))
+                ;
+        }
+    }
+
+    *num_nodes = serialize_partition(merged, image);
+    if (*num_nodes < 0)
+    {
+        printf("Delta merge of partition %d failed\n", partition);
+        exit(1);
+    }
+    return merged;
+}
+
+// Function to record a merged partition as the image waiting for publication. Called with the lock held.
+static void set_ready_locked(DeltaStore *store, int partition, Node *subtree, SerializedNode *image, int num_nodes,
+                             uint32_t merged, double start)
+{
+    store->ready_partition = partition;
+    store->ready_subtree = subtree;
+    store->ready_image = image;
+    store->ready_nodes = num_nodes;
+    store->ready_merged = merged;
+    store->stats.merges++;
+    store->stats.merge_time += timing_now() - start;
+}
+
+// Merge a full buffer on the writer's thread. Called with the lock held and no background merge running.
+static void merge_partition_locked(DeltaStore *store, int partition)
+{
+    DeltaBuffer *buffer = &store->buffers[partition];
+    double start = timing_now();
+    SerializedNode *image;
+    int num_nodes;
+    Node *merged = merge_entries(getPartition(store->root, partition), buffer->entries, buffer->count, partition, &image, &num_nodes);
+    set_ready_locked(store, partition, merged, image, num_nodes, buffer->count, start);
+}
+
+// Background merger: rebuild the fullest partition once its buffer crosses the threshold. Only the
+// snapshot of the entries is taken under the lock, so writes and searches go on during the rebuild.
+static void *merger_main(void *arg)
+{
+    DeltaStore *store = (DeltaStore *)arg;
+
+    pthread_mutex_lock(&store->lock);
+    while (!store->stop)
+    {
+        int fullest = -1;
+        if (store->ready_partition == -1)
+        {
+            for (int d = 0; d < store->num_partitions; d++)
+            {
+                if (store->buffers[d].count >= DELTA_MERGE_THRESHOLD &&
+                    (fullest == -1 || store->buffers[d].count > store->buffers[fullest].count))
+                    fullest = d;
+            }
+        }
+
+        if (fullest == -1)
+        {
+            pthread_cond_wait(&store->work, &store->lock);
+            continue;
+        }
+
+        DeltaBuffer *buffer = &store->buffers[fullest];
+        uint32_t merged = buffer->count;
+        DeltaEntry *entries = (DeltaEntry *)malloc(merged * sizeof(DeltaEntry));
+        if (entries == NULL)
+        {
+            perror("Failed to allocate the delta merge snapshot");
+            exit(1);
+        }
+        memcpy(entries, buffer->entries, merged * sizeof(DeltaEntry));
+        Node *subtree = getPartition(store->root, fullest);
+        store->merging = fullest;
+        pthread_mutex_unlock(&store->lock);
+
+        double start = timing_now();
+        SerializedNode *image;
+        int num_nodes;
+        Node *copy = merge_entries(subtree, entries, merged, fullest, &image, &num_nodes);
+        free(entries);
+
+        pthread_mutex_lock(&store->lock);
+        set_ready_locked(store, fullest, copy, image, num_nodes, merged, start);
+        store->merging = -1;
+        pthread_cond_broadcast(&store->merged);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return NULL;
+}
+
+// Push the pending image and compact its buffer. Called with the lock held.
+static void publish_locked(DeltaStore *store, DeltaStats *stats)
+{
+    int partition = store->ready_partition;
+    if (partition == -1)
+        return;
+
+    push_image_delta(store->dpus[partition], store->ready_image, store->ready_nodes, &store->partitions[partition], stats);
+    replacePartition(store->root, partition, store->ready_subtree);
+
+    // Entries written after the merge started stay buffered, moved to the front
+    DeltaBuffer *buffer = &store->buffers[partition];
+    uint32_t kept = buffer->count - store->ready_merged;
+    memmove(buffer->entries, &buffer->entries[store->ready_merged], kept * sizeof(DeltaEntry));
+    buffer->count = kept;
+    write_buffer(store, partition, 0);
+
+    store->ready_partition = -1;
+    store->ready_subtree = NULL;
+    store->ready_image = NULL;
+    pthread_cond_signal(&store->work);
+}
+
+void delta_store_init(DeltaStore *store, Node *root, struct dpu_set_t *dpus, Partition *partitions, int num_partitions,
+                      QueryCache *cache)
+{
+    memset(store, 0, sizeof(DeltaStore));
+    store->root = root;
+    store->cache = cache;
+    store->dpus = dpus;
+    store->partitions = partitions;
+    store->num_partitions = num_partitions;
+    store->merging = -1;
+    store->ready_partition = -1;
+    store->buffers = (DeltaBuffer *)calloc(num_partitions, sizeof(DeltaBuffer));
+    if (store->buffers == NULL)
+    {
+        perror("Failed to allocate delta buffers");
+        exit(1);
+    }
+
+    // DPU_DELTA_COUNT is not initialized by the loader
+    for (int d = 0; d < num_partitions; d++)
+        write_buffer(store, d, 0);
+    store->stats.bytes = 0;
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->work, NULL);
+    pthread_cond_init(&store->merged, NULL);
+    pthread_create(&store->merger, NULL, merger_main, store);
+}
+
+void delta_store_destroy(DeltaStore *store)
+{
+    pthread_mutex_lock(&store->lock);
+    store->stop = true;
+    pthread_cond_signal(&store->work);
+    pthread_mutex_unlock(&store->lock);
+    pthread_join(store->merger, NULL);
+
+    freeRTree(store->ready_subtree);
+    free(store->ready_image);
+    free(store->buffers);
+    pthread_cond_destroy(&store->work);
+    pthread_cond_destroy(&store->merged);
+    pthread_mutex_destroy(&store->lock);
+}
+
+// Function to append one entry to a partition's buffer, merging inline when it is full.
+// Called with the lock held.
+static void append_locked(DeltaStore *store, int partition, Point p, uint32_t op)
+{
+    DeltaBuffer *buffer = &store->buffers[partition];
+    if (buffer->count == DELTA_BUFFER_SIZE)
+    {
+        // A background merge may be about to free room, and an inline one must not race it
+        while (store->merging != -1)
+            pthread_cond_wait(&store->merged, &store->lock);
+        DeltaStats stats = {0, 0, 0};
+        publish_locked(store, &stats);
+        if (buffer->count == DELTA_BUFFER_SIZE)
+        {
+            merge_partition_locked(store, partition);
+            publish_locked(store, &stats);
+            store->stats.forced_merges++;
+        }
+        if (buffer->count == DELTA_BUFFER_SIZE)
+        {
+            printf("Delta buffer of partition %d is full\n", partition);
+            exit(1);
+        }
+    }
+
+    DeltaEntry *entry = &buffer->entries[buffer->count++];
+    entry->point = p;
+    entry->op = op;
+    entry->reserved = 0;
+    write_buffer(store, partition, buffer->count - 1);
+    store->stats.writes++;
+
+    if (buffer->count >= DELTA_MERGE_THRESHOLD)
+        pthread_cond_signal(&store->work);
+}
+
+bool delta_insert(DeltaStore *store, Point p)
+{
+    if (store->cache != NULL)
+        query_cache_invalidate(store->cache, p);
+    pthread_mutex_lock(&store->lock);
+    int partition = choosePartition(store->root, store->num_partitions, p);
+    if (partition >= 0)
+        append_locked(store, partition, p, DELTA_INSERT);
+    pthread_mutex_unlock(&store->lock);
+    return partition >= 0;
+}
+
+bool delta_delete(DeltaStore *store, Point p)
+{
+    bool deleted = false;
+    if (store->cache != NULL)
+        query_cache_invalidate(store->cache, p);
+    pthread_mutex_lock(&store->lock);
+    for (int d = 0; d < store->num_partitions; d++)
+    {
+        if (visible_in_partition(store, d, p))
+        {
+            append_locked(store, d, p, DELTA_DELETE);
+            deleted = true;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return deleted;
+}
+
+int delta_apply_file(DeltaStore *store, const char *filename, int *inserted, int *deleted)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror("Unable to open update file");
+        return -1;
+    }
+
+    char op;
+    Point p;
+    int applied = 0;
+    *inserted = 0;
+    *deleted = 0;
+    while (fscanf(file, " %c %f, %f", &op, &p.x, &p.y) == 3)
+    {
+        if (op == 'i' && delta_insert(store, p))
+        {
+            (*inserted)++;
+            applied++;
+        }
+        else if (op == 'd' && delta_delete(store, p))
+        {
+            (*deleted)++;
+            applied++;
+        }
+    }
+    fclose(file);
+    return applied;
+}
+
+void delta_publish(DeltaStore *store, DeltaStats *stats)
+{
+    pthread_mutex_lock(&store->lock);
+    publish_locked(store, stats);
+    pthread_mutex_unlock(&store->lock);
+}
+
+bool delta_search(DeltaStore *store, Point p)
+{
+    bool found = false;
+    pthread_mutex_lock(&store->lock);
+    for (int d = 0; d < store->num_partitions && !found; d++)
+        found = visible_in_partition(store, d, p);
+    pthread_mutex_unlock(&store->lock);
+    return found;
+}
@@ -0,0 +1,81 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <dpu.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include "rtree.h"
+#include "update.h"
+
+#define DELTA_MERGE_THRESHOLD (DELTA_BUFFER_SIZE / 2) // Buffered entries that wake the background merger
+
+/* Host mirror of one DPU's MRAM delta buffer */
+typedef struct DeltaBuffer
+{
+    DeltaEntry entries[DELTA_BUFFER_SIZE];
+    uint32_t count;
+} DeltaBuffer;
+
+/* Counters of the buffered write path */
+typedef struct DeltaStoreStats
+{
+    int writes;         // Entries appended to a DPU buffer
+    size_t bytes;       // Bytes written to MRAM by appends
+    int merges;         // Buffers folded into a rebuilt partition
+    int forced_merges;  // Merges done inline because a buffer was full
+    double merge_time;  // Seconds spent merging, background and inline
+} DeltaStoreStats;
+
+/* Write-optimized front of the partitioned tree: writes land in per-DPU MRAM buffers that the
+ * kernel consults next to DPU_TREE, and a background thread folds full buffers into the tree */
+typedef struct DeltaStore
+{
+    Node *root;
+    struct dpu_set_t *dpus;
+    Partition *partitions;
+    DeltaBuffer *buffers;
+    int num_partitions;
+
+    pthread_mutex_t lock; // Guards the pointer tree, the buffers and the pending image, not the merge itself
+    pthread_cond_t work;
+    pthread_cond_t merged; // Signaled when the merger leaves a partition
+    pthread_t merger;
+    bool stop;
+
+    int merging;                 // Partition the merger is rebuilding without the lock, -1 if none
+    int ready_partition;         // Partition whose merged image waits for publication, -1 if none
+    Node *ready_subtree;         // Copy of its subtree with the first ready_merged entries applied
+    SerializedNode *ready_image; // ready_subtree serialized
+    int ready_nodes;
+    uint32_t ready_merged;
+
+    QueryCache *cache; // Results to invalidate on every write, NULL when there is no cache
+
+    DeltaStoreStats stats;
+} DeltaStore;
+
+// Clear every DPU buffer and start the background merger
+void delta_store_init(DeltaStore *store, Node *root, struct dpu_set_t *dpus, Partition *partitions, int num_partitions,
+                      QueryCache *cache);
+
+// Stop the merger and release the buffers
+void delta_store_destroy(DeltaStore *store);
+
+// Buffer an insert on the partition that would receive it. Costs one entry and one counter transfer.
+bool delta_insert(DeltaStore *store, Point p);
+
+// Buffer a tombstone on every partition where p is currently visible. Returns false if p is absent.
+bool delta_delete(DeltaStore *store, Point p);
+
+// Apply the "i x,y" / "d x,y" lines of a file through the buffers. Returns -1 if the file cannot be read.
+int delta_apply_file(DeltaStore *store, const char *filename, int *inserted, int *deleted);
+
+// Push a partition image the merger finished, install its subtree in the pointer tree and drop the
+// merged entries from its buffer. Until then searches use the old subtree and the buffer.
+// Must be called while no kernel is running, e.g. between query batches.
+void delta_publish(DeltaStore *store, DeltaStats *stats);
+
+// Whether p is visible in any partition, combining the pointer tree with the buffers as the kernel does
+bool delta_search(DeltaStore *store, Point p);
+
+#endif /* __DELTA_H__ */
@@ -4,187 +4,1368 @@
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
-#include <time.h>
+#include <string.h>
 #include "common.h"
+#include "kernelstats.h"
+#include "pipeline.h"
+#include "querycache.h"
+#include "quantize.h"
+#include "rtree.h"
+#include "timing.h"
+#include "update.h"
+#include "delta.h"
+#include "hybrid.h"
+#include "bloom.h"
+#include "replicate.h"
+#include "repartition.h"
+#include "ranks.h"
+#include "numa.h"
+#include "interleave.h"
+#include "verify.h"
+#include "treestats.h"
 
 #ifndef DPU_BINARY
 #define DPU_BINARY "build/dpu"
 #endif
 
-// Structure to define a point
-typedef struct Point
+#define MAX_QUERIES 100000
+
+/* Command line of one host invocation */
+typedef struct HostOptions
 {
-    float x, y;
-} Point;
+    bool persist_tree;                // Reuse a tree already resident in MRAM when its header matches
+    const char *data_file;
+    int max_points;                   // Points read from data_file at most
+    const char *query_file;
+    const char *update_file;          // Inserts/deletes applied after the initial tree push
+    const char *buffered_update_file; // Inserts/deletes applied through the per-DPU delta buffers
+    int runs;                         // Sessions to time, each one rebuilding and pushing the tree
+    const char *timing_file;          // Per-run phase spans as CSV or JSON
+    const char *bench_file;           // CSV the run appends its summary row to
+    uint32_t encoding;                // TREE_ENCODING_* requested for the DPU trees
+    bool hybrid;                      // Host keeps the upper levels, DPUs only hold leaves
+    int cache_capacity;               // Entries of the query result cache, 0 to send every query to the DPUs
+    int bloom_bits;                   // Bits per point of the partition Bloom filters, 0 for none
+    bool bloom_dpu;                   // Also hand each DPU its filter to skip searches in WRAM
+    bool sort_queries;                // Search and dispatch queries in Z-order, answers still in arrival order
+    bool group_traversal;             // DPUs descend once per block of queries (float and u32 trees)
+    int interleave_width;             // Also time the interleaved host search up to this many queries in flight, 0 for no
+    bool route;                       // Send each query only to the DPUs whose partition MBR holds it
+    int replica_sample;               // Queries sampled to spread spare DPUs over the hottest partitions, 0 for none
+    int repartition_epochs;           // Dispatch the queries in this many slices, rebalancing partitions between them; 0 for one dispatch
+    double repartition_threshold;     // Max/mean partition cycles that starts a rebalance
+    bool rank_threads;                // Serialize and push the trees of each rank on its own host thread
+    int verify_generated;             // Stored points and probes each added for the differential check, -1 without --verify
+    int tree_stats_sample;            // Queries sampled for the expected visits of the tree report, -1 for no report
+} HostOptions;
 
-// Structure to define a bounding box (MBR)
-typedef struct MBR
+/* Per-run figures that are not phases of the session */
+typedef struct SessionResult
 {
-    float xmin, ymin;
-    float xmax, ymax;
-} MBR;
+    int num_points;
+    uint32_t encoding;       // Encoding the trees were pushed in, float when quantizing was not lossless
+    size_t image_bytes;      // Tree images of all DPUs together
+    bool sorted_queries;     // Queries were searched in Z-order
+    bool group_traversal;    // The kernel descended once per block of queries
+    double mram_bytes_per_query;
+    double host_search_time; // Searching every query in the host pointer tree, sorting included
+    double pipeline_time;    // First DPU batch queued to last batch merged
+    double cycles_per_query; // Kernel cycles of the slowest DPU per query
+} SessionResult;
 
-// Structure for a node
-typedef struct Node
+// Function to parse the command line, returns false on a usage error
+static bool parse_options(int argc, char **argv, HostOptions *options)
 {
-    int isLeaf; // 1 if it's a leaf node, 0 if it's an internal node
-    int count;  // Number of entries in the node
-    MBR mbr;    // Bounding box for the node
-    union
-    {
-        struct Node **children; // Child nodes (internal node)
-        Point *points;          // Points (leaf node)
-    };
-} Node;
-
-// Structure for a serialized node
-typedef struct SerializedNode
+    options->persist_tree = false;
+    options->data_file = "gaussian_data_points_1M.csv";
+    options->max_points = MAX_POINTS;
+    options->query_file = "Query/Query_gaussian_points_1k.csv";
+    options->update_file = NULL;
+    options->buffered_update_file = NULL;
+    options->runs = 1;
+    options->timing_file = NULL;
+    options->bench_file = NULL;
+    options->encoding = TREE_ENCODING_FLOAT;
+    options->hybrid = false;
+    options->cache_capacity = 0;
+    options->bloom_bits = 0;
+    options->bloom_dpu = false;
+    options->sort_queries = false;
+    options->group_traversal = false;
+    options->interleave_width = 0;
+    options->route = false;
+    options->replica_sample = 0;
+    options->repartition_epochs = 0;
+    options->repartition_threshold = 1.5;
+    options->rank_threads = true;
+    options->verify_generated = -1;
+    options->tree_stats_sample = -1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--persist") == 0)
+        {
+            options->persist_tree = true;
+        }
+        else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc)
+        {
+            options->data_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-points") == 0 && i + 1 < argc)
+        {
+            options->max_points = atoi(argv[++i]);
+            if (options->max_points < 1)
+                return false;
+        }
+        else if (strcmp(argv[i], "--fanout") == 0 && i + 1 < argc)
+        {
+            if (!setTreeParams((uint32_t)atoi(argv[++i]), tree_params.bundlefactor))
+                return false;
+        }
+        else if (strcmp(argv[i], "--bundlefactor") == 0 && i + 1 < argc)
+        {
+            if (!setTreeParams(tree_params.fanout, (uint32_t)atoi(argv[++i])))
+                return false;
+        }
+        else if (strcmp(argv[i], "--fill") == 0 && i + 1 < argc)
+        {
+            tree_fill_percent = atoi(argv[++i]);
+            if (tree_fill_percent < 1 || tree_fill_percent > 100)
+                return false;
+        }
+        else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc)
+        {
+            options->query_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--updates") == 0 && i + 1 < argc)
+        {
+            options->update_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--buffered-updates") == 0 && i + 1 < argc)
+        {
+            options->buffered_update_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            options->runs = atoi(argv[++i]);
+            if (options->runs < 1 || options->runs > MAX_RUNS)
+                return false;
+        }
+        else if (strcmp(argv[i], "--timing-out") == 0 && i + 1 < argc)
+        {
+            options->timing_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--encoding") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "u32") == 0)
+                options->encoding = TREE_ENCODING_U32;
+            else if (strcmp(argv[i], "rel16") == 0)
+                options->encoding = TREE_ENCODING_REL16;
+            else if (strcmp(argv[i], "float") == 0)
+                options->encoding = TREE_ENCODING_FLOAT;
+            else
+                return false;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            options->cache_capacity = atoi(argv[++i]);
+            if (options->cache_capacity < 0)
+                return false;
+        }
+        else if (strcmp(argv[i], "--hybrid") == 0)
+        {
+            options->hybrid = true;
+        }
+        else if (strcmp(argv[i], "--bloom") == 0 && i + 1 < argc)
+        {
+            options->bloom_bits = atoi(argv[++i]);
+            if (options->bloom_bits < 1 || options->bloom_bits > 64)
+                return false;
+        }
+        else if (strcmp(argv[i], "--bloom-dpu") == 0)
+        {
+            options->bloom_dpu = true;
+        }
+        else if (strcmp(argv[i], "--sort-queries") == 0)
+        {
+            options->sort_queries = true;
+        }
+        else if (strcmp(argv[i], "--group") == 0)
+        {
+            options->group_traversal = true;
+        }
+        else if (strcmp(argv[i], "--interleave") == 0 && i + 1 < argc)
+        {
+            options->interleave_width = atoi(argv[++i]);
+            if (options->interleave_width < 1 || options->interleave_width > INTERLEAVE_MAX_WIDTH)
+                return false;
+        }
+        else if (strcmp(argv[i], "--route") == 0)
+        {
+            options->route = true;
+        }
+        else if (strcmp(argv[i], "--replicate") == 0 && i + 1 < argc)
+        {
+            options->replica_sample = atoi(argv[++i]);
+            options->route = true;
+            if (options->replica_sample < 1)
+                return false;
+        }
+        else if (strcmp(argv[i], "--repartition") == 0 && i + 1 < argc)
+        {
+            options->repartition_epochs = atoi(argv[++i]);
+            if (options->repartition_epochs < 2)
+                return false;
+        }
+        else if (strcmp(argv[i], "--repartition-threshold") == 0 && i + 1 < argc)
+        {
+            options->repartition_threshold = atof(argv[++i]);
+            if (options->repartition_threshold <= 1.0)
+                return false;
+        }
+        else if (strcmp(argv[i], "--numa") == 0)
+        {
+            numa_placement = true;
+        }
+        else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "transparent") == 0)
+                numa_huge_pages = HUGE_PAGES_TRANSPARENT;
+            else if (strcmp(argv[i], "explicit") == 0)
+                numa_huge_pages = HUGE_PAGES_EXPLICIT;
+            else
+                return false;
+        }
+        else if (strcmp(argv[i], "--single-host-thread") == 0)
+        {
+            options->rank_threads = false;
+        }
+        else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc)
+        {
+            options->verify_generated = atoi(argv[++i]);
+            if (options->verify_generated < 0)
+                return false;
+        }
+        else if (strcmp(argv[i], "--tree-stats") == 0 && i + 1 < argc)
+        {
+            options->tree_stats_sample = atoi(argv[++i]);
+            if (options->tree_stats_sample < 0)
+                return false;
+        }
+        else if (strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc)
+        {
+            options->bench_file = argv[++i];
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Inserts and delta entries are float points; the update paths do not re-encode them
+    if (options->encoding != TREE_ENCODING_FLOAT && (options->update_file != NULL || options->buffered_update_file != NULL))
+    {
+        printf("--encoding %s cannot be combined with updates\n", encoding_name(options->encoding));
+        return false;
+    }
+    // Leaf images hold float points and are rebuilt from scratch, not patched
+    if (options->hybrid && (options->encoding != TREE_ENCODING_FLOAT || options->update_file != NULL || options->buffered_update_file != NULL))
+    {
+        printf("--hybrid cannot be combined with --encoding or updates\n");
+        return false;
+    }
+    // Filters are built once per session, so points inserted later would be missing from them
+    if (options->bloom_bits > 0 && (options->update_file != NULL || options->buffered_update_file != NULL))
+    {
+        printf("--bloom cannot be combined with updates\n");
+        return false;
+    }
+    if (options->bloom_dpu && options->bloom_bits == 0)
+    {
+        printf("--bloom-dpu needs --bloom\n");
+        return false;
+    }
+    // Updates patch partition d on DPU d, and leaf images already go to a single DPU each
+    if (options->route && (options->hybrid || options->update_file != NULL || options->buffered_update_file != NULL))
+    {
+        printf("--route and --replicate cannot be combined with --hybrid or updates\n");
+        return false;
+    }
+    // A new layout moves points between partitions, which filters, replicas and update mirrors do not follow
+    if (options->repartition_epochs > 0 && (options->hybrid || options->route || options->bloom_bits > 0 ||
+                                            options->update_file != NULL || options->buffered_update_file != NULL))
+    {
+        printf("--repartition cannot be combined with --hybrid, --route, --bloom or updates\n");
+        return false;
+    }
+    return true;
+}
+
+// Function to run a query set on the DPUs, answering on the host what the partition filters and the
+// result cache can: queries every filter rejects are not found, cache hits and repeats are not sent.
+// With a replica map each query goes to one replica of the partitions holding it instead of every DPU.
+// Returns the number of queries that reached the DPUs.
+static int dispatch_queries(struct dpu_set_t dpu_set, uint32_t nr_of_dpus, uint32_t encoding, uint32_t batch_flags,
+                            const HybridIndex *hybrid_index, ReplicaMap *replicas, Point *queries, EncodedPoint *encoded_queries,
+                            int numQueries, const BloomFilter *filters, QueryCache *cache, uint8_t *found, PipelineStats *pipeline_stats, KernelStats *kernel_stats)
 {
-    int isLeaf;       // 1 if it's a leaf node, 0 if it's an internal node
-    int count;        // Number of entries in the node
-    MBR mbr;          // Bounding box for the node
-    int children[16]; // Indices of child nodes (internal node), max FANOUT assumed to be
-    Point points[16]; // Points (leaf node), max BUNDLEFACTOR assumed to be
-} SerializedNode;
-
-// Forward declarations for helper functions
-int readPointsFromFile(const char *filename, Point points[], int max_points);
-void printPoints(Point points[], int num_points);
-Node *createRTree(Point *ptArr, int low, int high);
-void printRTree(Node *node, int level);
-bool searchRTree(Node *node, Point queryPoint);
-void Zsorting(Point points[], int num_points);
-int serialize_rtree_wrapper(Node *root, SerializedNode **output, int max_nodes);
-void print_serialisedtree(int node_index, int depth, SerializedNode *serialized_tree);
-Node *getSubtree(Node *root, int targetIndex);
-// int countNodesInSubtree(Node *root);
-SerializedNode *serialized_tree;
-
-int main()
+    // Queries some filter accepts, in the original order
+    int num_kept = numQueries;
+    Point *kept = queries;
+    EncodedPoint *kept_encoded = encoded_queries;
+    uint8_t *found_kept = found;
+    int *kept_index = NULL;
+    if (filters != NULL)
+    {
+        kept_index = (int *)malloc(numQueries * sizeof(int));
+        num_kept = bloom_filter_queries(filters, nr_of_dpus, queries, numQueries, kept_index);
+        kept = (Point *)malloc(num_kept * sizeof(Point));
+        kept_encoded = (EncodedPoint *)malloc(num_kept * sizeof(EncodedPoint));
+        found_kept = (uint8_t *)malloc(num_kept);
+        for (int k = 0; k < num_kept; k++)
+        {
+            kept[k] = queries[kept_index[k]];
+            kept_encoded[k] = encoded_queries[kept_index[k]];
+        }
+    }
+
+    // Of those, the cache misses
+    int num_dispatched = num_kept;
+    Point *dispatched = kept;
+    EncodedPoint *dispatched_encoded = kept_encoded;
+    uint8_t *found_dispatched = found_kept;
+    int *cache_link = NULL, *cache_misses = NULL;
+    if (cache != NULL)
+    {
+        cache_link = (int *)malloc(num_kept * sizeof(int));
+        cache_misses = (int *)malloc(num_kept * sizeof(int));
+        num_dispatched = query_cache_prepare(cache, kept, num_kept, found_kept, cache_link, cache_misses);
+        dispatched = (Point *)malloc(num_dispatched * sizeof(Point));
+        dispatched_encoded = (EncodedPoint *)malloc(num_dispatched * sizeof(EncodedPoint));
+        found_dispatched = (uint8_t *)malloc(num_dispatched);
+        for (int m = 0; m < num_dispatched; m++)
+        {
+            dispatched[m] = kept[cache_misses[m]];
+            dispatched_encoded[m] = kept_encoded[cache_misses[m]];
+        }
+    }
+
+    if (encoding == TREE_ENCODING_LEAVES)
+    {
+        run_hybrid_queries(dpu_set, nr_of_dpus, hybrid_index, dispatched, num_dispatched, found_dispatched, pipeline_stats, kernel_stats);
+    }
+    else if (replicas != NULL)
+    {
+        run_routed_queries(dpu_set, replicas, dispatched, dispatched_encoded, num_dispatched, batch_flags, found_dispatched,
+                           pipeline_stats, kernel_stats);
+    }
+    else
+    {
+        run_query_pipeline(dpu_set, nr_of_dpus, dispatched_encoded, num_dispatched, batch_flags, found_dispatched, pipeline_stats, kernel_stats);
+    }
+
+    if (cache != NULL)
+    {
+        for (int m = 0; m < num_dispatched; m++)
+        {
+            found_kept[cache_misses[m]] = found_dispatched[m];
+        }
+        query_cache_complete(cache, kept, num_kept, found_kept, cache_link, cache_misses, num_dispatched);
+        free(found_dispatched);
+        free(dispatched_encoded);
+        free(dispatched);
+        free(cache_misses);
+        free(cache_link);
+    }
+    if (filters != NULL)
+    {
+        memset(found, 0, numQueries);
+        for (int k = 0; k < num_kept; k++)
+        {
+            found[kept_index[k]] = found_kept[k];
+        }
+        free(found_kept);
+        free(kept_encoded);
+        free(kept);
+        free(kept_index);
+    }
+    return num_dispatched;
+}
+
+// Function to turn a serialized partition into the image its DPU receives: the nodes themselves with
+// float or quantized coordinates, or their REL16 packing. Returns the leaves too wide for REL16.
+static int make_partition_image(uint32_t encoding, const Quantizer *quantizer, Partition *partition, const void **image,
+                                size_t *image_size, TreeHeader *header)
 {
-    struct dpu_set_t dpu_set, dpu;
-    uint32_t nr_of_dpus;
-    bool status = true;
-    bool result_host = false;
-    // uint64_t dpu_index = 0;
+    int wide = 0;
+    *image = partition->serialized;
+    *image_size = partition->num_nodes * sizeof(SerializedNode);
+    if (encoding == TREE_ENCODING_U32)
+    {
+        quantize_tree(quantizer, partition->serialized, partition->num_nodes);
+    }
+    else if (encoding == TREE_ENCODING_REL16)
+    {
+        uint64_t *packed;
+        *image_size = pack_relative_tree(quantizer, partition->serialized, partition->num_nodes, &packed, &wide);
+        if (packed == NULL)
+        {
+            perror("Failed to allocate relative tree image");
+            exit(1);
+        }
+        *image = packed;
+    }
+    make_image_header(header, *image, *image_size, partition->num_nodes);
+    return wide;
+}
+
+/* Per-DPU state of a session the rank workers fill in. Each worker only touches the entries of its
+ * own DPUs, so they need no locking. */
+typedef struct SessionImages
+{
+    HostOptions *options;
+    struct dpu_set_t *dpus;
+    uint32_t encoding;
+    const Quantizer *quantizer;
+    Node **subtrees;
+    int *subtree_nodes;
+    Partition *partitions;
+    const void **images;
+    size_t *image_sizes;
+    TreeHeader *headers;
+    int *wide_leaves;     // REL16 leaves too wide for 16-bit offsets
+    BloomFilter *filters; // NULL without --bloom
+    bool bloom_on_dpu;
+    uint8_t *reused;      // The DPU already held this exact tree
+    uint8_t *failed;      // The image did not fit DPU_TREE
+} SessionImages;
+
+// Rank worker: serialize and encode the partitions of the rank's DPUs and build their filters.
+// Leaf images of the hybrid layout are cut from one host index and built before the workers run.
+static void serialize_rank(void *arg, const RankRange *rank)
+{
+    SessionImages *session = (SessionImages *)arg;
+    for (uint32_t d = rank->first_dpu; d < rank->first_dpu + rank->nr_dpus; d++)
+    {
+        if (session->encoding != TREE_ENCODING_LEAVES)
+        {
+            // printf("\n\n Subtree in %u\n", d);
+            // printRTree(subtrees[d], 0);
+            Partition *partition = &session->partitions[d];
+            partition->num_nodes = serialize_rtree_wrapper(session->subtrees[d], &partition->serialized, session->subtree_nodes[d]);
+            session->wide_leaves[d] = make_partition_image(session->encoding, session->quantizer, partition, &session->images[d],
+                                                           &session->image_sizes[d], &session->headers[d]);
+            // print_serialisedtree(0, 0, partitions[d].serialized);
+        }
+        if (session->filters != NULL)
+        {
+            bloom_build(&session->filters[d], session->subtrees[d], session->options->bloom_bits,
+                        session->bloom_on_dpu ? BLOOM_WRAM_BYTES * 8 : 1u << 31);
+        }
+    }
+}
+
+// Function to zero a DPU's tree header, which the kernel and persist mode both read as no tree
+static void invalidate_tree_header(struct dpu_set_t dpu)
+{
+    TreeHeader invalid;
+    memset(&invalid, 0, sizeof(TreeHeader));
+    DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE_HEADER", 0, &invalid, sizeof(TreeHeader)));
+}
+
+// Rank worker: push the images of the rank's DPUs, skipping trees MRAM already holds in persist mode
+static void push_rank(void *arg, const RankRange *rank)
+{
+    SessionImages *session = (SessionImages *)arg;
+    for (uint64_t dpu_id = rank->first_dpu; dpu_id < rank->first_dpu + rank->nr_dpus; dpu_id++)
+    {
+        struct dpu_set_t dpu = session->dpus[dpu_id];
+        size_t image_size = session->image_sizes[dpu_id];
+
+        //printf("\n %d nodes send to DPU id =%lu\n", num_nodes, dpu_id);
+        DPU_ASSERT(dpu_copy_to(dpu, "DPU_INDEX", 0, &dpu_id, sizeof(uint64_t)));
+
+        // In persist mode only push the tree when MRAM does not already hold this exact tree
+        bool resident = false;
+        if (session->options->persist_tree)
+        {
+            TreeHeader resident_header;
+            DPU_ASSERT(dpu_copy_from(dpu, "DPU_TREE_HEADER", 0, &resident_header, sizeof(TreeHeader)));
+            resident = memcmp(&session->headers[dpu_id], &resident_header, sizeof(TreeHeader)) == 0;
+        }
+
+        if (resident)
+        {
+            session->reused[dpu_id] = 1;
+        }
+        else if (image_size > MAX_NODES * sizeof(SerializedNode))
+        {
+            printf(ANSI_COLOR_RED "\nTree image of DPU %lu needs %zu bytes, DPU_TREE holds %zu" ANSI_COLOR_RESET,
+                   dpu_id, image_size, MAX_NODES * sizeof(SerializedNode));
+            session->failed[dpu_id] = 1;
+            // Make sure the kernel does not search whatever tree a previous session left
+            invalidate_tree_header(dpu);
+        }
+        else
+        {
+            // Invalidate the old header before the tree is overwritten and write the new one last,
+            // so an interrupted push never leaves a valid header over a partly written tree
+            invalidate_tree_header(dpu);
+            if (image_size > 0)
+            {
+                DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE", 0, session->images[dpu_id], image_size));
+            }
+            DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE_HEADER", 0, &session->headers[dpu_id], sizeof(TreeHeader)));
+        }
+        // DPU_DELTA_COUNT is not initialized by the loader and a previous session may have left entries
+        uint64_t empty_delta = 0;
+        DPU_ASSERT(dpu_copy_to(dpu, "DPU_DELTA_COUNT", 0, &empty_delta, sizeof(uint64_t)));
+        // Likewise DPU_BLOOM_ARGS, the kernel only uses the filter when it is set
+        BloomArgs bloom_args = {0, 0};
+        if (session->bloom_on_dpu)
+        {
+            bloom_args.num_bits = session->filters[dpu_id].num_bits;
+            bloom_args.num_hashes = session->filters[dpu_id].num_hashes;
+            DPU_ASSERT(dpu_copy_to(dpu, "DPU_BLOOM", 0, session->filters[dpu_id].bits, bloom_args.num_bits / 8));
+        }
+        DPU_ASSERT(dpu_copy_to(dpu, "DPU_BLOOM_ARGS", 0, &bloom_args, sizeof(BloomArgs)));
+    }
+}
+
+// Function to add the breakdown of one dispatch to a running total
+static void add_pipeline_stats(PipelineStats *total, const PipelineStats *stats)
+{
+    total->num_batches += stats->num_batches;
+    total->total_time += stats->total_time;
+    total->queue_time += stats->queue_time;
+    total->wait_time += stats->wait_time;
+    total->transfer_in_time += stats->transfer_in_time;
+    total->launch_time += stats->launch_time;
+    total->transfer_out_time += stats->transfer_out_time;
+    total->merge_time += stats->merge_time;
+}
+
+// Function to dispatch the queries in epochs, watching the cycles each partition costs. When they drift
+// apart a new layout is built in the background while the next epochs keep running on the old one, and
+// swapped in between two epochs by pushing only the partitions whose points changed.
+// Returns the number of queries that reached the DPUs.
+static int dispatch_in_epochs(HostOptions *options, struct dpu_set_t dpu_set, struct dpu_set_t *dpus, uint32_t nr_of_dpus,
+                              uint32_t encoding, const Quantizer *quantizer, uint32_t batch_flags, Point *points, int numPoints,
+                              Node **root, Node **subtrees, int *subtree_nodes, Partition *partitions, const void **images,
+                              size_t *image_sizes, TreeHeader *headers, Point *queries, EncodedPoint *encoded_queries, int numQueries,
+                              QueryCache *cache, uint8_t *found, PipelineStats *pipeline_stats, KernelStats *kernel_stats,
+                              Timing *timing)
+{
+    Repartitioner rp;
+    repartition_init(&rp, *root, nr_of_dpus, points, numPoints, options->repartition_threshold);
+    uint64_t *cycles_before = (uint64_t *)malloc(nr_of_dpus * sizeof(uint64_t));
+    uint64_t *epoch_cycles = (uint64_t *)malloc(nr_of_dpus * sizeof(uint64_t));
+    const void **next_images = (const void **)malloc(nr_of_dpus * sizeof(void *));
+    size_t *next_sizes = (size_t *)malloc(nr_of_dpus * sizeof(size_t));
+    TreeHeader *next_headers = (TreeHeader *)malloc(nr_of_dpus * sizeof(TreeHeader));
+    size_t bytes = 0;
+    double first_imbalance = 0.0, imbalance = 0.0;
+    int num_dispatched = 0;
+    memset(pipeline_stats, 0, sizeof(PipelineStats));
+
+    int epochs = options->repartition_epochs;
+    for (int e = 0; e < epochs; e++)
+    {
+        int first = (int)((long)numQueries * e / epochs);
+        int last = (int)((long)numQueries * (e + 1) / epochs);
+        for (uint32_t d = 0; d < nr_of_dpus; d++)
+        {
+            cycles_before[d] = kernel_stats->dpus[d].cycles;
+        }
+        PipelineStats epoch_stats;
+        num_dispatched += dispatch_queries(dpu_set, nr_of_dpus, encoding, batch_flags, NULL, NULL, &queries[first], &encoded_queries[first],
+                                           last - first, NULL, cache, &found[first], &epoch_stats, kernel_stats);
+        add_pipeline_stats(pipeline_stats, &epoch_stats);
+        for (uint32_t d = 0; d < nr_of_dpus; d++)
+        {
+            epoch_cycles[d] = kernel_stats->dpus[d].cycles - cycles_before[d];
+        }
+
+        imbalance = repartition_observe(&rp, &queries[first], last - first, epoch_cycles);
+        if (e == 0)
+            first_imbalance = imbalance;
+        printf("Epoch %d: %d queries, partition cycles max/mean %.2f\n", e, last - first, imbalance);
+
+        // No kernel runs between two epochs, so this is where a finished layout replaces the old one
+        if (repartition_ready(&rp))
+        {
+            timing_start(timing, PHASE_TRANSFER_IN);
+            // Encode the changed partitions before anything is swapped: the points a partition gives
+            // up are only found on its neighbours, so a layout is adopted whole or not at all
+            bool fits = true;
+            for (int p = 0; p < rp.num_partitions; p++)
+            {
+                if (!rp.changed[p])
+                    continue;
+                make_partition_image(encoding, quantizer, &rp.next_partitions[p], &next_images[p], &next_sizes[p], &next_headers[p]);
+                if (next_sizes[p] > MAX_NODES * sizeof(SerializedNode))
+                {
+                    printf(ANSI_COLOR_RED "Tree image of DPU %d would grow to %zu bytes, DPU_TREE holds %zu\n" ANSI_COLOR_RESET, p,
+                           next_sizes[p], MAX_NODES * sizeof(SerializedNode));
+                    fits = false;
+                }
+            }
+            if (!fits)
+            {
+                for (int p = 0; p < rp.num_partitions; p++)
+                {
+                    if (rp.changed[p] && next_images[p] != rp.next_partitions[p].serialized)
+                        free((void *)next_images[p]);
+                }
+                repartition_discard(&rp);
+                timing_stop(timing, PHASE_TRANSFER_IN);
+                printf("Dropped the new layout, queries stay on the current one\n");
+                continue;
+            }
+
+            for (int p = 0; p < rp.num_partitions; p++)
+            {
+                if (rp.changed[p] && images[p] != partitions[p].serialized)
+                    free((void *)images[p]);
+            }
+            Node *next = repartition_swap(&rp, partitions);
+            int migrated = 0;
+            for (int p = 0; p < rp.num_partitions; p++)
+            {
+                subtrees[p] = getPartition(next, p);
+                if (!rp.changed[p])
+                    continue;
+                subtree_nodes[p] = partitions[p].num_nodes;
+                images[p] = next_images[p];
+                image_sizes[p] = next_sizes[p];
+                headers[p] = next_headers[p];
+                // As on a full push, no valid header may cover a partly written tree
+                invalidate_tree_header(dpus[p]);
+                DPU_ASSERT(dpu_copy_to(dpus[p], "DPU_TREE", 0, images[p], image_sizes[p]));
+                DPU_ASSERT(dpu_copy_to(dpus[p], "DPU_TREE_HEADER", 0, &headers[p], sizeof(TreeHeader)));
+                bytes += image_sizes[p] + 2 * sizeof(TreeHeader);
+                migrated++;
+            }
+            freeRTree(*root);
+            *root = next;
+            double swap_time = timing_stop(timing, PHASE_TRANSFER_IN);
+            rp.stats.swap_time += swap_time;
+            printf("Swapped in a new layout: %d of %d partition(s) migrated in %.3f μs\n", migrated, rp.num_partitions, swap_time * 1000000);
+        }
+        else if (e + 1 < epochs && repartition_start(&rp))
+        {
+            printf("Building a new layout in the background, queries stay on the current one\n");
+        }
+    }
+    printf("Repartitioning: %d layout(s) built in %.3f μs in the background, %d swapped in, %d partition(s) migrated with %zu bytes; "
+           "partition cycles max/mean %.2f in the first epoch, %.2f in the last\n",
+           rp.stats.rebuilds, rp.stats.build_time * 1000000, rp.stats.swaps, rp.stats.migrated, bytes, first_imbalance, imbalance);
 
-    clock_t start_time, end_time;
-    double rtree_construction_time;
+    free(next_headers);
+    free(next_sizes);
+    free(next_images);
+    free(epoch_cycles);
+    free(cycles_before);
+    repartition_destroy(&rp);
+    return num_dispatched;
+}
+
+// Function to build the tree, push it and run the query set once, recording every phase in the current run
+static bool run_session(HostOptions *options, struct dpu_set_t dpu_set, struct dpu_set_t *dpus, uint32_t nr_of_dpus,
+                        Point *queries, int numQueries, QueryCache *cache, Timing *timing, SessionResult *result)
+{
+    bool status = true;
+    QueryCacheStats cache_before = {0, 0, 0, 0, 0};
+    if (cache != NULL)
+    {
+        cache_before = query_cache_stats(cache);
+    }
 
-    Point points[MAX_POINTS];
+    Point *points = (Point *)numa_alloc(options->max_points * sizeof(Point), -1, numa_huge_pages);
+    timing_start(timing, PHASE_READ);
     // int numPoints = readPointsFromFile("/home/tjv7w/PIM/RtreeCPU_SingleQuery/Data/datapoint.txt", points, MAX_POINTS);
     //int numPoints = readPointsFromFile("/home/tjv7w/PIM/RtreeCPU_QueryM/Data/gaussian_data_points_100k.csv", points, MAX_POINTS);
-    int numPoints = readPointsFromFile("gaussian_data_points_1M.csv", points, MAX_POINTS);
+    int numPoints = readPointsFromFile(options->data_file, points, options->max_points);
+    timing_stop(timing, PHASE_READ);
+    result->num_points = numPoints;
+
+    // Quantize only when it is lossless, otherwise point equality on the DPU would change
+    Quantizer quantizer = {0, 0};
+    uint32_t encoding = options->hybrid ? TREE_ENCODING_LEAVES : options->encoding;
+    if ((encoding == TREE_ENCODING_U32 || encoding == TREE_ENCODING_REL16) && !quantizer_init(&quantizer, points, numPoints))
+    {
+        printf("Coordinates are not all integers in uint32 range, keeping float trees\n");
+        encoding = TREE_ENCODING_FLOAT;
+    }
+    tree_encoding = encoding;
+    result->encoding = encoding;
     if (numPoints <= 0)
     {
         printf("Failed to read points from the file.\n");
-        return 1;
+        numa_free(points, options->max_points * sizeof(Point));
+        return false;
+    }
+
+    // The differential check runs the query set plus stored points and probes next to them through
+    // every search path; updates may delete stored points, so only then are hits not asserted
+    Point *verify_queries = NULL;
+    VerifyReport verify;
+    if (options->verify_generated >= 0)
+    {
+        int num_generated = numPoints > 0 ? options->verify_generated : 0;
+        verify_queries = verify_make_queries(queries, &numQueries, points, numPoints, num_generated, VERIFY_SEED);
+        queries = verify_queries;
+        verify_init(&verify, numQueries, num_generated, num_generated,
+                    options->update_file == NULL && options->buffered_update_file == NULL);
     }
-    Zsorting(points, numPoints);
+
+    timing_start(timing, PHASE_SORT);
+    MBR data_extent;
+    Zsorting(points, numPoints, &data_extent);
+    timing_stop(timing, PHASE_SORT);
     // printf("\nSorted Points by Z-value:\n");
     // printPoints(points, numPoints);
 
-    // Build the R-tree on the host
-    start_time = clock();
+    // Build the R-tree on the host. Each child of the root becomes one DPU partition, so the root gets
+    // at most one child per DPU whatever the fanout; replication also needs DPUs beyond the children.
+    tree_root_fanout = options->replica_sample > 0 ? replica_root_fanout(nr_of_dpus) : nr_of_dpus;
+    timing_start(timing, PHASE_BUILD);
     Node *root = createRTree(points, 0, numPoints - 1);
-    end_time = clock();
-    rtree_construction_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
-    printf("R-tree construction time: %.3f μs\n", rtree_construction_time * 1000000);
+    double rtree_construction_time = timing_stop(timing, PHASE_BUILD);
+    if (getPartition(root, (int)nr_of_dpus) != NULL)
+    {
+        // Only a single DPU gets here, as the root keeps at least two children
+        printf(ANSI_COLOR_RED "The root has %d partitions for %u DPU(s), the points of the others could not be found"
+               ANSI_COLOR_RESET "\n", root->count, nr_of_dpus);
+        freeRTree(root);
+        free(verify_queries);
+        numa_free(points, options->max_points * sizeof(Point));
+        return false;
+    }
+    printf("R-tree construction time: %.3f μs (%d nodes, height %d)\n", rtree_construction_time * 1000000,
+           countNodesInSubtree(root), treeHeight(root));
     // printRTree(root, 0);
-    Point query_point = {4792855.00, 6027188.00};
-    // Point query_point = {4992113,5435896};
-    start_time = clock();
 
-    result_host = searchRTree(root, query_point);
-    if (result_host)
+    // DPU i holds child i of the root, the same subtree the pointer tree keeps being updated in.
+    // With replication the DPUs after the last child hold copies of the children most queries hit.
+    Node **subtrees = (Node **)malloc(nr_of_dpus * sizeof(Node *));
+    int *subtree_nodes = (int *)malloc(nr_of_dpus * sizeof(int));
+    ReplicaMap replica_map;
+    ReplicaMap *replicas = NULL;
+    timing_start(timing, PHASE_PARTITION);
+    if (options->route)
     {
-        printf("\nQuery point (%.1f, %.1f) " ANSI_COLOR_GREEN "FOUND" ANSI_COLOR_RESET " in R-tree in HOST", query_point.x, query_point.y);
+        replica_plan(&replica_map, root, nr_of_dpus, queries, numQueries, options->replica_sample);
+        replicas = &replica_map;
     }
-    end_time = clock();
-    double search_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
+    for (uint32_t d = 0; d < nr_of_dpus; d++)
+    {
+        int partition = replicas != NULL ? replicas->partition_of_dpu[d] : (int)d;
+        subtrees[d] = partition >= 0 ? getPartition(root, partition) : NULL;
+        subtree_nodes[d] = countNodesInSubtree(subtrees[d]);
+    }
+    timing_stop(timing, PHASE_PARTITION);
 
-    printf(ANSI_COLOR_LIGHT_BLUE "\nTime taken to search the point in HOST is %.3f μs" ANSI_COLOR_RESET "\n\n", search_time * 1000000);
+    Partition *partitions = (Partition *)calloc(nr_of_dpus, sizeof(Partition));
+    TreeHeader *headers = (TreeHeader *)malloc(nr_of_dpus * sizeof(TreeHeader));
+    // What each DPU receives: the serialized nodes themselves, their REL16 packing or their leaves
+    const void **images = (const void **)malloc(nr_of_dpus * sizeof(void *));
+    size_t *image_sizes = (size_t *)malloc(nr_of_dpus * sizeof(size_t));
+    int *wide_leaves = (int *)calloc(nr_of_dpus, sizeof(int));
+    uint8_t *reused = (uint8_t *)calloc(nr_of_dpus, 1);
+    uint8_t *failed = (uint8_t *)calloc(nr_of_dpus, 1);
+    HybridIndex hybrid_index = {NULL, 0, NULL, 0};
+    // The kernel only keeps a filter in WRAM for float trees, so those are capped at what fits there
+    bool bloom_on_dpu = options->bloom_dpu && encoding == TREE_ENCODING_FLOAT;
+    BloomFilter *filters = options->bloom_bits > 0 ? (BloomFilter *)malloc(nr_of_dpus * sizeof(BloomFilter)) : NULL;
+    RankSet ranks;
+    rank_set_init(&ranks, dpu_set, nr_of_dpus, options->rank_threads);
+    SessionImages session = {options, dpus, encoding, &quantizer, subtrees, subtree_nodes, partitions, images, image_sizes, headers,
+                             wide_leaves, filters, bloom_on_dpu, reused, failed};
+    timing_start(timing, PHASE_SERIALIZE);
+    if (encoding == TREE_ENCODING_LEAVES)
+    {
+        // The host index replaces the upper levels, DPUs get their partition's leaves
+        int *image_leaves = (int *)malloc(nr_of_dpus * sizeof(int));
+        hybrid_build(&hybrid_index, root, nr_of_dpus, (void **)images, image_sizes, image_leaves);
+        for (uint32_t d = 0; d < nr_of_dpus; d++)
+        {
+            make_image_header(&headers[d], images[d], image_sizes[d], image_leaves[d]);
+        }
+        free(image_leaves);
+    }
+    rank_set_run(&ranks, serialize_rank, &session);
+    // Queries travel in the encoding of the trees. The whole set stays unplaced: it is read once per
+    // batch, into the pipeline's query buffers that sit on each rank's node with --numa.
+    EncodedPoint *encoded_queries = (EncodedPoint *)numa_alloc(numQueries * sizeof(EncodedPoint), -1, numa_huge_pages);
+    int unmatchable = encode_queries(encoding, &quantizer, queries, encoded_queries, numQueries);
+    timing_stop(timing, PHASE_SERIALIZE);
 
-    // Preparing to send DPU
+    size_t image_bytes = 0, bloom_bytes = 0;
+    int num_wide_leaves = 0;
+    for (uint32_t d = 0; d < nr_of_dpus; d++)
+    {
+        image_bytes += image_sizes[d];
+        num_wide_leaves += wide_leaves[d];
+        bloom_bytes += filters != NULL ? filters[d].num_bits / 8 : 0;
+    }
+    result->image_bytes = image_bytes;
+    printf("Tree images %zu bytes with %s coordinates", image_bytes, encoding_name(encoding));
+    if (encoding == TREE_ENCODING_REL16)
+    {
+        printf(" (%d leaves too wide for 16-bit offsets)", num_wide_leaves);
+    }
+    if (encoding == TREE_ENCODING_U32 || encoding == TREE_ENCODING_REL16)
+    {
+        printf(", %d of %d queries off the integer grid are not searched", unmatchable, numQueries);
+    }
+    printf("\n");
+    if (encoding == TREE_ENCODING_LEAVES)
+    {
+        printf("Host index %zu bytes: %d node(s) above %d leaves\n", hybrid_index_bytes(&hybrid_index),
+               hybrid_index.num_nodes, hybrid_index.num_leaves);
+    }
+    if (filters != NULL)
+    {
+        printf("Bloom filters %zu bytes at %d bits per point, %s\n", bloom_bytes, options->bloom_bits,
+               bloom_on_dpu ? "also in DPU WRAM" : "host only");
+    }
 
-    // Allocate DPU set and load the DPU program
-    DPU_ASSERT(dpu_alloc(NR_DPUS, NULL, &dpu_set));
-    DPU_ASSERT(dpu_load(dpu_set, DPU_BINARY, NULL));
+    // Shape and footprint before anything is transferred, outside the timed phases
+    if (options->tree_stats_sample >= 0)
+    {
+        TreeStats tree_stats;
+        tree_stats_collect(&tree_stats, root, queries, numQueries, options->tree_stats_sample);
+        tree_stats_print(&tree_stats);
+        partition_stats_print(partitions, subtrees, image_sizes, nr_of_dpus, queries, numQueries, options->tree_stats_sample);
+    }
 
-    DPU_ASSERT(dpu_get_nr_dpus(dpu_set, &nr_of_dpus));
-    printf("\nAllocated %d DPU(s)", nr_of_dpus);
+    printf("\nPassing Tree to DPUs...");
+    timing_start(timing, PHASE_TRANSFER_IN);
+    rank_set_run(&ranks, push_rank, &session);
+    double tree_transfer_time = timing_stop(timing, PHASE_TRANSFER_IN);
+    uint32_t reused_trees = 0;
+    for (uint32_t d = 0; d < nr_of_dpus; d++)
+    {
+        reused_trees += reused[d];
+        if (failed[d])
+            status = false;
+    }
+    printf("\nReused resident tree on %u of %u DPU(s)", reused_trees, nr_of_dpus);
+    printf(ANSI_COLOR_LIGHT_BLUE "\nTree transfer time %.3f μs" ANSI_COLOR_RESET "\n", tree_transfer_time * 1000000);
 
-    printf("\nPassing Tree and Query to DPUs...");
-    uint64_t dpu_id = 0;
-    // int currentIndex=0;
-    int start_index = 1;
-    DPU_FOREACH(dpu_set, dpu)
+    if (options->update_file != NULL)
     {
-        Node *subtree = getSubtree(root, start_index);
-        // printf("\n\n Subtree in %lu\n", dpu_id);
-        // printRTree(subtree, 0);
-        int num_nodes = serialize_rtree_wrapper(subtree, &serialized_tree, MAX_NODES);
-        start_index += num_nodes;
-        // print_serialisedtree(0, 0, serialized_tree);
+        int inserted, deleted;
+        double update_start_time = timing_now();
+        timing_start(timing, PHASE_BUILD);
+        int applied = applyUpdatesFromFile(options->update_file, root, partitions, nr_of_dpus, cache, &inserted, &deleted);
+        timing_stop(timing, PHASE_BUILD);
+        if (applied < 0)
+        {
+            inserted = deleted = 0;
+            status = false;
+        }
 
-        //printf("\n %d nodes send to DPU id =%lu\n", num_nodes, dpu_id);
-        DPU_ASSERT(dpu_copy_to(dpu, "DPU_INDEX", 0, &dpu_id, sizeof(uint64_t)));
-        DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE", 0, serialized_tree, num_nodes * sizeof(SerializedNode)));
-        dpu_id++;
+        // Push only the changed node ranges of the partitions the updates touched
+        DeltaStats delta = {0, 0, 0};
+        size_t full_bytes = 0;
+        timing_start(timing, PHASE_TRANSFER_IN);
+        for (uint32_t d = 0; d < nr_of_dpus && applied >= 0; d++)
+        {
+            if (!partitions[d].dirty)
+                continue;
+            if (!push_partition_delta(dpus[d], getPartition(root, d), &partitions[d], &delta))
+            {
+                status = false;
+            }
+            // The push replaced the serialized image the DPU holds
+            images[d] = partitions[d].serialized;
+            image_sizes[d] = partitions[d].num_nodes * sizeof(SerializedNode);
+            full_bytes += partitions[d].num_nodes * sizeof(SerializedNode) + sizeof(TreeHeader);
+        }
+        timing_stop(timing, PHASE_TRANSFER_IN);
+        double update_time = timing_now() - update_start_time;
+        printf("\nApplied %d inserts and %d deletes: %d node(s) in %d range(s), %zu bytes pushed instead of %zu for the touched partitions",
+               inserted, deleted, delta.nodes, delta.ranges, delta.bytes, full_bytes);
+        printf(ANSI_COLOR_LIGHT_BLUE "\nUpdate time %.3f μs" ANSI_COLOR_RESET "\n", update_time * 1000000);
     }
 
-    printf("\nSend Query value to DPUs...\n");
+    DeltaStore delta_store;
+    bool buffered = options->buffered_update_file != NULL;
+    if (buffered)
+    {
+        int inserted, deleted;
+        delta_store_init(&delta_store, root, dpus, partitions, nr_of_dpus, cache);
+        timing_start(timing, PHASE_TRANSFER_IN);
+        if (delta_apply_file(&delta_store, options->buffered_update_file, &inserted, &deleted) < 0)
+        {
+            inserted = deleted = 0;
+            status = false;
+        }
+
+        // Fold in a partition the background merger has finished before the DPUs run again
+        DeltaStats delta = {0, 0, 0};
+        delta_publish(&delta_store, &delta);
+        double update_time = timing_stop(timing, PHASE_TRANSFER_IN);
+        // Published merges replaced the serialized images the DPUs hold
+        for (uint32_t d = 0; d < nr_of_dpus; d++)
+        {
+            images[d] = partitions[d].serialized;
+            image_sizes[d] = partitions[d].num_nodes * sizeof(SerializedNode);
+        }
+
+        DeltaStoreStats *stats = &delta_store.stats;
+        printf("\nBuffered %d inserts and %d deletes: %d entries, %.1f bytes per write, %d merge(s) (%d forced), %zu bytes published",
+               inserted, deleted, stats->writes, stats->writes ? (double)stats->bytes / stats->writes : 0.0,
+               stats->merges, stats->forced_merges, delta.bytes);
+        printf(ANSI_COLOR_LIGHT_BLUE "\nBuffered update time %.3f μs, merge time %.3f μs" ANSI_COLOR_RESET "\n",
+               update_time * 1000000, stats->merge_time * 1000000);
+    }
 
-    DPU_FOREACH(dpu_set, dpu)
+    uint8_t *found_host = (uint8_t *)malloc(numQueries);
+    int num_found_host = 0;
+    double search_start_time = timing_now();
+    for (int q = 0; q < numQueries; q++)
     {
-        DPU_ASSERT(dpu_copy_to(dpu, "DPU_QUERY_POINT", 0, &query_point, sizeof(Point)));
+        found_host[q] = buffered ? delta_search(&delta_store, queries[q]) : searchRTree(root, queries[q]);
+        num_found_host += found_host[q];
     }
+    double search_time = timing_now() - search_start_time;
+    result->host_search_time = search_time;
+    result->sorted_queries = options->sort_queries;
 
-    printf("\nRunning Query on DPU(s)...\n");
+    printf("\n%d of %d query points " ANSI_COLOR_GREEN "FOUND" ANSI_COLOR_RESET " in R-tree in HOST", num_found_host, numQueries);
+    printf(ANSI_COLOR_LIGHT_BLUE "\nTime taken to search the points in HOST is %.3f μs" ANSI_COLOR_RESET "\n\n", search_time * 1000000);
+    if (verify_queries != NULL)
+    {
+        verify_reference(&verify, buffered ? "pointer tree and delta store" : "pointer tree", search_time, found_host);
+    }
 
-    clock_t dpu_kernel_start_time = clock();
-    DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+    // Throughput of the interleaved search at doubling widths, against the one-query-at-a-time loop above
+    if (options->interleave_width > 0 && !buffered)
+    {
+        uint8_t *found_interleaved = (uint8_t *)malloc(numQueries);
+        double interleave_time = 0.0;
+        int widest = 1;
+        printf(ANSI_COLOR_LIGHT_BLUE "%-8s %14s %14s %10s" ANSI_COLOR_RESET "\n", "width", "time (μs)", "queries/s", "speedup");
+        for (int width = 1; width <= options->interleave_width; width *= 2)
+        {
+            double interleave_start_time = timing_now();
+            search_rtree_interleaved(root, queries, numQueries, found_interleaved, width);
+            interleave_time = timing_now() - interleave_start_time;
+            widest = width;
+            int mismatches = 0;
+            for (int q = 0; q < numQueries; q++)
+            {
+                mismatches += found_interleaved[q] != found_host[q];
+            }
+            if (mismatches > 0)
+            {
+                printf(ANSI_COLOR_RED "%d interleaved answers differ at width %d" ANSI_COLOR_RESET "\n", mismatches, width);
+                status = false;
+            }
+            printf("%-8d %14.3f %14.0f %9.2fx\n", width, interleave_time * 1000000,
+                   interleave_time > 0 ? numQueries / interleave_time : 0.0, interleave_time > 0 ? search_time / interleave_time : 0.0);
+        }
+        printf("\n");
+        if (verify_queries != NULL)
+        {
+            char name[64];
+            snprintf(name, sizeof(name), "interleaved pointer tree, width %d", widest);
+            verify_engine(&verify, name, interleave_time, found_interleaved, found_host, queries);
+        }
+        free(found_interleaved);
+    }
 
-    // Capture time after DPU search is done
-    clock_t dpu_kernel_end_time = clock();
-    double dpu_kernel_time = ((double)(dpu_kernel_end_time - dpu_kernel_start_time)) / CLOCKS_PER_SEC;
+    // Neighbouring queries in Z-order share most of their root-to-leaf path, so the nodes they
+    // touch are still in the host caches and, batched together, on the same DPUs
+    int *query_order = NULL;
+    double sort_time = 0.0;
+    if (options->sort_queries)
+    {
+        query_order = (int *)malloc(numQueries * sizeof(int));
+        double sort_start_time = timing_now();
+        Zorder(queries, numQueries, &data_extent, query_order);
+        sort_time = timing_now() - sort_start_time;
 
-    DPU_FOREACH(dpu_set, dpu)
+        int mismatches = 0;
+        search_start_time = timing_now();
+        for (int i = 0; i < numQueries; i++)
+        {
+            int q = query_order[i];
+            bool found = buffered ? delta_search(&delta_store, queries[q]) : searchRTree(root, queries[q]);
+            mismatches += found != found_host[q];
+        }
+        double sorted_search_time = sort_time + timing_now() - search_start_time;
+        result->host_search_time = sorted_search_time;
+        if (mismatches > 0)
+        {
+            printf(ANSI_COLOR_RED "%d answers changed with the query order" ANSI_COLOR_RESET "\n", mismatches);
+            status = false;
+        }
+        printf(ANSI_COLOR_LIGHT_BLUE "Time taken in Z-order is %.3f μs (%.3f μs of it sorting), %.2fx arrival order" ANSI_COLOR_RESET "\n\n",
+               sorted_search_time * 1000000, sort_time * 1000000, sorted_search_time > 0 ? search_time / sorted_search_time : 0.0);
+    }
+
+    printf("\nRunning %d queries on DPU(s) in batches of %d...\n", numQueries, QUERY_BATCH_SIZE);
+
+    uint8_t *found_dpu = (uint8_t *)malloc(numQueries);
+    PipelineStats pipeline_stats;
+    KernelStats kernel_stats;
+    kernel_stats_init(&kernel_stats, dpu_set, nr_of_dpus);
+
+    double dispatch_start_time = timing_now();
+    Point *ordered = queries;
+    EncodedPoint *ordered_encoded = encoded_queries;
+    uint8_t *found_ordered = found_dpu;
+    if (query_order != NULL)
     {
-        DPU_ASSERT(dpu_log_read(dpu, stdout));
+        ordered = (Point *)malloc(numQueries * sizeof(Point));
+        ordered_encoded = (EncodedPoint *)malloc(numQueries * sizeof(EncodedPoint));
+        found_ordered = (uint8_t *)malloc(numQueries);
+        for (int i = 0; i < numQueries; i++)
+        {
+            ordered[i] = queries[query_order[i]];
+            ordered_encoded[i] = encoded_queries[query_order[i]];
+        }
     }
-    printf(ANSI_COLOR_LIGHT_BLUE "\nDPU Kernel Time %.3f μs" ANSI_COLOR_RESET "\n\n", dpu_kernel_time * 1000000);
+    // Only the node layouts of float and u32 trees have a group kernel
+    bool group = options->group_traversal && (encoding == TREE_ENCODING_FLOAT || encoding == TREE_ENCODING_U32);
+    if (options->group_traversal && !group)
+    {
+        printf("No group traversal for %s trees, searching one query at a time\n", encoding_name(encoding));
+    }
+    result->group_traversal = group;
+    uint32_t batch_flags = group ? BATCH_GROUP_TRAVERSAL : 0;
+    int num_dispatched;
+    if (options->repartition_epochs > 0)
+    {
+        num_dispatched = dispatch_in_epochs(options, dpu_set, dpus, nr_of_dpus, encoding, &quantizer, batch_flags, points, numPoints,
+                                            &root, subtrees, subtree_nodes, partitions, images, image_sizes, headers, ordered,
+                                            ordered_encoded, numQueries, cache, found_ordered, &pipeline_stats, &kernel_stats, timing);
+    }
+    else
+    {
+        num_dispatched = dispatch_queries(dpu_set, nr_of_dpus, encoding, batch_flags, &hybrid_index, replicas, ordered, ordered_encoded,
+                                          numQueries, filters, cache, found_ordered, &pipeline_stats, &kernel_stats);
+    }
+    if (query_order != NULL)
+    {
+        // Answers go back to the arrival order
+        for (int i = 0; i < numQueries; i++)
+        {
+            found_dpu[query_order[i]] = found_ordered[i];
+        }
+        free(found_ordered);
+        free(ordered_encoded);
+        free(ordered);
+    }
+    if (filters != NULL || cache != NULL)
+    {
+        printf("\n%d of %d queries sent to the DPU(s), the rest answered on the host", num_dispatched, numQueries);
+    }
+    // The sort is charged to the dispatch like it is to the host search
+    double dispatch_time = sort_time + timing_now() - dispatch_start_time;
+    timing_add(timing, PHASE_TRANSFER_IN, pipeline_stats.transfer_in_time);
+    timing_add(timing, PHASE_LAUNCH, pipeline_stats.launch_time);
+    timing_add(timing, PHASE_TRANSFER_OUT, pipeline_stats.transfer_out_time);
+    timing_add(timing, PHASE_MERGE, pipeline_stats.merge_time);
 
-    // Retrieve results from DPUs after execution
-    printf("\nRetrieve results from DPUs after execution\n");
-    dpu_id = 0;
-    uint64_t dpu_result;
-    clock_t DPU_CPU_start_time = clock();
-    DPU_FOREACH(dpu_set, dpu)
+    int num_found_dpu = 0;
+    for (int q = 0; q < numQueries; q++)
     {
+        num_found_dpu += found_dpu[q];
+        if (found_dpu[q] != found_host[q])
+        {
+            printf("\nQuery point (%.1f, %.1f) " ANSI_COLOR_RED "MISMATCH" ANSI_COLOR_RESET " between HOST and DPU", queries[q].x, queries[q].y);
+            status = false;
+        }
+    }
+    printf("\n%d of %d query points " ANSI_COLOR_GREEN "FOUND" ANSI_COLOR_RESET " in R-tree in DPU(s)\n", num_found_dpu, numQueries);
 
-        DPU_ASSERT(dpu_copy_from(dpu, "DPU_RESULT", 0, &dpu_result, sizeof(uint64_t)));
-        // printf("\ndpu_id=%lu, dpu_result= %lu",dpu_id,dpu_result);
+    // The images are what the DPUs hold, so this separates serialization faults from kernel ones.
+    // Leaf images have no tree to search and the delta buffers are not part of any image.
+    if (verify_queries != NULL && encoding != TREE_ENCODING_LEAVES && !buffered)
+    {
+        uint8_t *found_images = (uint8_t *)malloc(numQueries);
+        double images_start_time = timing_now();
+        for (int q = 0; q < numQueries; q++)
+        {
+            found_images[q] = 0;
+            for (uint32_t d = 0; d < nr_of_dpus && !found_images[q]; d++)
+            {
+                found_images[q] = verify_search_image(encoding, images[d], image_sizes[d], encoded_queries[q]);
+            }
+        }
+        double images_time = timing_now() - images_start_time;
+        char name[64];
+        snprintf(name, sizeof(name), "serialized %s images on the host", encoding_name(encoding));
+        if (!verify_engine(&verify, name, images_time, found_images, found_host, queries))
+        {
+            status = false;
+        }
+        free(found_images);
+    }
+
+    if (filters != NULL)
+    {
+        // Measured outside the timed dispatch: every probe the filters accepted is checked on the host
+        BloomStats bloom = bloom_measure(filters, nr_of_dpus, subtrees, queries, numQueries);
+        timing_count(timing, COUNTER_BLOOM_CHECKS, bloom.checks);
+        timing_count(timing, COUNTER_BLOOM_PASSED, bloom.passed);
+        timing_count(timing, COUNTER_BLOOM_FALSE_POS, bloom.false_positives);
+        timing_count(timing, COUNTER_BLOOM_REJECTED, bloom.rejected);
+        uint64_t negatives = bloom.checks - (bloom.passed - bloom.false_positives);
+        printf("Bloom filters rejected %lu of %d queries on the host (%lu DPU searches saved), false-positive rate %.3f%%\n",
+               (unsigned long)bloom.rejected, numQueries, (unsigned long)(bloom.rejected * nr_of_dpus),
+               negatives ? 100.0 * bloom.false_positives / negatives : 0.0);
+    }
 
-        if (dpu_result)
+    double total = filters != NULL || cache != NULL || query_order != NULL || options->repartition_epochs > 0 ? dispatch_time
+                                                                                                          : pipeline_stats.total_time;
+    result->pipeline_time = total;
+    if (verify_queries != NULL)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "DPU kernel, %s%s%s%s%s%s%s", encoding == TREE_ENCODING_LEAVES ? "hybrid" : encoding_name(encoding),
+                 group ? ", group" : "", query_order != NULL ? ", z-order" : "", replicas != NULL ? ", routed" : "",
+                 options->repartition_epochs > 0 ? ", repartitioned" : "", filters != NULL ? ", bloom" : "", cache != NULL ? ", cache" : "");
+        verify_engine(&verify, name, total, found_dpu, found_host, queries);
+        if (!verify_print(&verify))
         {
-            printf("\nQuery point (%.1f, %.1f) " ANSI_COLOR_GREEN "FOUND" ANSI_COLOR_RESET " in R-tree in DPU: %lu.\n", query_point.x, query_point.y, dpu_id);
+            status = false;
         }
-        else
+    }
+    printf(ANSI_COLOR_LIGHT_BLUE "\nDPU pipeline time %.3f μs for %d batches, %.0f queries/s" ANSI_COLOR_RESET "\n",
+           total * 1000000, pipeline_stats.num_batches, total > 0 ? numQueries / total : 0.0);
+    printf("Host queueing %.1f%%, host waiting on buffers %.1f%%, result merging %.1f%% of pipeline time\n\n",
+           total > 0 ? 100.0 * pipeline_stats.queue_time / total : 0.0,
+           total > 0 ? 100.0 * pipeline_stats.wait_time / total : 0.0,
+           total > 0 ? 100.0 * pipeline_stats.merge_time / total : 0.0);
+    if (replicas != NULL)
+    {
+        replica_report(replicas);
+    }
+    result->cycles_per_query = kernel_stats.queries ? (double)kernel_stats.critical_cycles / kernel_stats.queries : 0.0;
+    result->mram_bytes_per_query = kernel_stats_mram_bytes_per_query(&kernel_stats);
+    kernel_stats_report(&kernel_stats);
+    kernel_stats_free(&kernel_stats);
+
+    if (buffered)
+    {
+        delta_store_destroy(&delta_store);
+    }
+    if (cache != NULL)
+    {
+        QueryCacheStats cache_after = query_cache_stats(cache);
+        timing_count(timing, COUNTER_CACHE_LOOKUPS, cache_after.lookups - cache_before.lookups);
+        timing_count(timing, COUNTER_CACHE_HITS, cache_after.hits - cache_before.hits);
+        timing_count(timing, COUNTER_CACHE_COALESCED, cache_after.coalesced - cache_before.coalesced);
+        timing_count(timing, COUNTER_CACHE_EVICTIONS, cache_after.evictions - cache_before.evictions);
+        timing_count(timing, COUNTER_CACHE_INVALIDATIONS, cache_after.invalidations - cache_before.invalidations);
+    }
+    free(query_order);
+    free(verify_queries);
+    free(found_dpu);
+    free(found_host);
+    numa_free(encoded_queries, numQueries * sizeof(EncodedPoint));
+    for (uint32_t d = 0; d < nr_of_dpus; d++)
+    {
+        if (images[d] != partitions[d].serialized)
         {
-            //  end_time = clock();
-            // search_time = ((double)(end_time - start_time)) / CLOCKS_PER_SEC;
+            free((void *)images[d]);
+        }
+        free(partitions[d].serialized);
+    }
+    free(image_sizes);
+    free(images);
+    if (encoding == TREE_ENCODING_LEAVES)
+    {
+        hybrid_free(&hybrid_index);
+    }
+    if (filters != NULL)
+    {
+        for (uint32_t d = 0; d < nr_of_dpus; d++)
+        {
+            bloom_free(&filters[d]);
+        }
+        free(filters);
+    }
+    rank_set_free(&ranks);
+    free(failed);
+    free(reused);
+    free(wide_leaves);
+    free(headers);
+    free(partitions);
+    if (replicas != NULL)
+    {
+        replica_free(replicas);
+    }
+    free(subtree_nodes);
+    free(subtrees);
+    freeRTree(root);
+    numa_free(points, options->max_points * sizeof(Point));
+    return status;
+}
 
-            //  printf("\n Time taken to search the point in DPU is %.3f μs\n", search_time * 1000000);
+// Function to append the median figures of all runs as one row of the benchmark table
+static void write_bench_row(HostOptions *options, uint32_t nr_of_dpus, int numQueries, Timing *timing,
+                            SessionResult *results)
+{
+    FILE *file = fopen(options->bench_file, "a");
+    if (file == NULL)
+    {
+        perror("Unable to open benchmark output");
+        return;
+    }
+    // A new table gets its header first
+    if (ftell(file) == 0)
+    {
+        fprintf(file, "dataset,points,queries,dpus,tasklets,fanout,bundlefactor,encoding,image_bytes,query_order,traversal,runs,"
+                      "build_us,serialize_us,transfer_us,kernel_us,cycles_per_query,mram_bytes_per_query,cpu_search_us,dpu_pipeline_us,cpu_qps,dpu_qps\n");
+    }
 
-            // printf("\nQuery point (%.1f, %.1f) " ANSI_COLOR_RED "NOT FOUND" ANSI_COLOR_RESET " in R-tree in DPU: %lu.\n", query_point.x, query_point.y, dpu_id);
+    double host_search[MAX_RUNS], pipeline[MAX_RUNS], cycles[MAX_RUNS], mram_bytes[MAX_RUNS];
+    for (int r = 0; r < timing->num_runs; r++)
+    {
+        host_search[r] = results[r].host_search_time;
+        pipeline[r] = results[r].pipeline_time;
+        cycles[r] = results[r].cycles_per_query;
+        mram_bytes[r] = results[r].mram_bytes_per_query;
+    }
+    double cpu_time = timing_median(host_search, timing->num_runs);
+    double dpu_time = timing_median(pipeline, timing->num_runs);
+
+    double min, build, serialize, transfer_in, launch, transfer_out, p99;
+    timing_summary(timing, PHASE_BUILD, &min, &build, &p99);
+    timing_summary(timing, PHASE_SERIALIZE, &min, &serialize, &p99);
+    timing_summary(timing, PHASE_TRANSFER_IN, &min, &transfer_in, &p99);
+    timing_summary(timing, PHASE_LAUNCH, &min, &launch, &p99);
+    timing_summary(timing, PHASE_TRANSFER_OUT, &min, &transfer_out, &p99);
+
+    const char *dataset = strrchr(options->data_file, '/');
+    dataset = dataset != NULL ? dataset + 1 : options->data_file;
+    fprintf(file, "%s,%d,%d,%u,%d,%u,%u,%s,%zu,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.0f,%.0f,%.3f,%.3f,%.0f,%.0f\n",
+            dataset, results[0].num_points, numQueries, nr_of_dpus, NR_TASKLETS, tree_params.fanout, tree_params.bundlefactor,
+            encoding_name(results[0].encoding), results[0].image_bytes,
+            results[0].sorted_queries ? "zorder" : "arrival", results[0].group_traversal ? "group" : "query", timing->num_runs,
+            build, serialize, transfer_in + transfer_out, launch, timing_median(cycles, timing->num_runs),
+            timing_median(mram_bytes, timing->num_runs), cpu_time * 1000000, dpu_time * 1000000,
+            cpu_time > 0 ? numQueries / cpu_time : 0.0, dpu_time > 0 ? numQueries / dpu_time : 0.0);
+    fclose(file);
+}
+
+int main(int argc, char **argv)
+{
+    struct dpu_set_t dpu_set, dpu;
+    uint32_t nr_of_dpus;
+    bool status = true;
+    HostOptions options;
+
+    if (!parse_options(argc, argv, &options))
+    {
+        printf("Usage: %s [--persist] [--data FILE] [--max-points N] [--fanout N] [--bundlefactor N] [--fill PERCENT]\n"
+               "          [--encoding float|u32|rel16] [--hybrid] [--queries FILE] [--updates FILE] [--buffered-updates FILE]\n"
+               "          [--cache ENTRIES] [--bloom BITS_PER_POINT [--bloom-dpu]] [--sort-queries] [--group]\n"
+               "          [--interleave MAX_WIDTH] [--route] [--replicate SAMPLE_QUERIES]\n"
+               "          [--repartition EPOCHS [--repartition-threshold MAX_OVER_MEAN]]\n"
+               "          [--single-host-thread] [--numa] [--huge-pages transparent|explicit]\n"
+               "          [--verify GENERATED_QUERIES] [--tree-stats SAMPLE_QUERIES] [--runs N] [--timing-out FILE] [--bench-out FILE]\n", argv[0]);
+        printf("Tree shape: fanout 2..%d, bundlefactor 1..%d (rebuild with make FANOUT=.. BUNDLEFACTOR=.. for more)\n",
+               FANOUT, BUNDLEFACTOR);
+        return 1;
+    }
+
+    Point *queries = (Point *)numa_alloc(MAX_QUERIES * sizeof(Point), -1, numa_huge_pages);
+    int numQueries = readPointsFromFile(options.query_file, queries, MAX_QUERIES);
+    if (numQueries <= 0)
+    {
+        printf("Failed to read queries from the file.\n");
+        return 1;
+    }
+
+    // Allocate DPU set and load the DPU program
+    DPU_ASSERT(dpu_alloc(NR_DPUS, NULL, &dpu_set));
+    DPU_ASSERT(dpu_load(dpu_set, DPU_BINARY, NULL));
+
+    DPU_ASSERT(dpu_get_nr_dpus(dpu_set, &nr_of_dpus));
+    printf("\nAllocated %d DPU(s), tree fanout %u, bundlefactor %u\n", nr_of_dpus, tree_params.fanout, tree_params.bundlefactor);
+
+    if (numa_placement)
+    {
+        // Where the ranks sit decides which node their workers and result buffers are kept on
+        RankSet ranks;
+        rank_set_init(&ranks, dpu_set, nr_of_dpus, true);
+        uint32_t placed = 0;
+        printf("Ranks per NUMA node of %d:", numa_nodes());
+        for (int node = 0; node < numa_nodes(); node++)
+        {
+            uint32_t on_node = 0;
+            for (uint32_t r = 0; r < ranks.nr_ranks; r++)
+                on_node += ranks.ranks[r].numa_node == node;
+            printf(" %u", on_node);
+            placed += on_node;
         }
-        dpu_id++;
+        printf(", %u of unknown node left unpinned\n", ranks.nr_ranks - placed);
+        rank_set_free(&ranks);
+    }
+
+    struct dpu_set_t *dpus = (struct dpu_set_t *)malloc(nr_of_dpus * sizeof(struct dpu_set_t));
+    uint32_t dpu_id;
+    DPU_FOREACH(dpu_set, dpu, dpu_id)
+    {
+        dpus[dpu_id] = dpu;
     }
-    clock_t DPU_CPU_end_time = clock();
-    double DPU_CPU_search_time = ((double)(DPU_CPU_end_time - DPU_CPU_start_time)) / CLOCKS_PER_SEC;
 
-    printf(ANSI_COLOR_LIGHT_BLUE "\nDPU-CPU Time %.3f μs " ANSI_COLOR_RESET "\n\n", DPU_CPU_search_time * 1000000);
+    // The cache outlives sessions: every session rebuilds the same data set, and the updates it
+    // applies invalidate the results of the points they touch
+    QueryCache cache;
+    if (options.cache_capacity > 0)
+    {
+        query_cache_init(&cache, (uint32_t)options.cache_capacity);
+    }
+
+    Timing *timing = (Timing *)malloc(sizeof(Timing));
+    SessionResult *results = (SessionResult *)calloc(options.runs, sizeof(SessionResult));
+    timing_init(timing);
+    for (int run = 0; run < options.runs; run++)
+    {
+        if (options.runs > 1)
+            printf(ANSI_COLOR_LIGHT_BLUE "\n=== Run %d of %d ===" ANSI_COLOR_RESET "\n", run + 1, options.runs);
+        if (!run_session(&options, dpu_set, dpus, nr_of_dpus, queries, numQueries, options.cache_capacity > 0 ? &cache : NULL,
+                         timing, &results[run]))
+        {
+            status = false;
+        }
+        timing_end_run(timing);
+    }
+
+    timing_report(timing);
+    if (options.timing_file != NULL && timing_write(timing, options.timing_file) == 0)
+    {
+        printf("\nPhase timings written to %s\n", options.timing_file);
+    }
+    // Throughput of runs with wrong answers would only skew the table
+    if (options.bench_file != NULL && status)
+    {
+        write_bench_row(&options, nr_of_dpus, numQueries, timing, results);
+    }
+    else if (options.bench_file != NULL)
+    {
+        printf(ANSI_COLOR_RED "A run failed, no row written to %s" ANSI_COLOR_RESET "\n", options.bench_file);
+    }
+
+    if (options.cache_capacity > 0)
+    {
+        query_cache_destroy(&cache);
+    }
+    free(results);
+    free(timing);
+    free(dpus);
+    numa_free(queries, MAX_QUERIES * sizeof(Point));
 
     // Free the DPU set
     DPU_ASSERT(dpu_free(dpu_set));
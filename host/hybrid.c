@@ -0,0 +1,332 @@
+#include <dpu.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "hybrid.h"
+#include "timing.h"
+
+/* Host side of the per-DPU leaf images while they are being filled */
+typedef struct HybridBuilder
+{
+    HybridIndex *index;
+    uint8_t **images;
+    int *num_leaves;     // Leaves of each image
+    uint32_t *next_leaf; // Next leaf of each image to fill
+    uint32_t *next_point;
+} HybridBuilder;
+
+/* Requests of one launch, QUERY_BATCH_SIZE per DPU */
+typedef struct HybridBatch
+{
+    LeafRequest *requests; // nr_dpus * QUERY_BATCH_SIZE
+    int *owners;           // Query of each request
+    uint32_t *counts;      // Requests per DPU
+    BatchArgs *args;
+    uint64_t *results;
+    TaskletStats *counters;
+    int num_queries; // Queries resolved into the batch
+} HybridBatch;
+
+// Function to grow an MBR so it covers another one
+static void extend_mbr(MBR *mbr, const MBR *other)
+{
+    if (other->xmin < mbr->xmin)
+        mbr->xmin = other->xmin;
+    if (other->ymin < mbr->ymin)
+        mbr->ymin = other->ymin;
+    if (other->xmax > mbr->xmax)
+        mbr->xmax = other->xmax;
+    if (other->ymax > mbr->ymax)
+        mbr->ymax = other->ymax;
+}
+
+// Function to count the nodes above the leaves, the leaves and the points of a subtree
+static void count_subtree(Node *node, int *internal, int *leaves, int *points)
+{
+    if (node->isLeaf)
+    {
+        (*leaves)++;
+        *points += node->count;
+        return;
+    }
+    (*internal)++;
+    for (int i = 0; i < node->count; i++)
+        count_subtree(node->children[i], internal, leaves, points);
+}
+
+// Function to append a leaf to the host index and its points to its partition's image
+static void add_leaf(HybridBuilder *builder, Node *leaf, uint32_t dpu)
+{
+    HybridIndex *index = builder->index;
+    uint32_t *leaf_start = (uint32_t *)builder->images[dpu];
+    Point *points = (Point *)(builder->images[dpu] + LEAF_POINTS_OFFSET(builder->num_leaves[dpu]));
+
+    HybridLeaf *entry = &index->leaves[index->num_leaves++];
+    entry->mbr = leaf->mbr;
+    entry->dpu = dpu;
+    entry->leaf = builder->next_leaf[dpu];
+
+    leaf_start[builder->next_leaf[dpu]++] = builder->next_point[dpu];
+    memcpy(&points[builder->next_point[dpu]], leaf->points, leaf->count * sizeof(Point));
+    builder->next_point[dpu] += leaf->count;
+}
+
+// Recursive function to fill index node slot from the children of a pointer node. At the top
+// (dpu == -1) child i is the root of partition i; below, everything belongs to dpu.
+static void build_slot(HybridBuilder *builder, int slot, Node **children, int count, int dpu)
+{
+    HybridIndex *index = builder->index;
+    HybridNode *node = &index->nodes[slot];
+    initMBR(&node->mbr);
+    node->count = (uint16_t)count;
+    node->leaf_parent = count > 0 && children[0]->isLeaf;
+    for (int i = 0; i < count; i++)
+        extend_mbr(&node->mbr, &children[i]->mbr);
+
+    if (node->leaf_parent)
+    {
+        node->first = (uint32_t)index->num_leaves;
+        for (int i = 0; i < count; i++)
+            add_leaf(builder, children[i], dpu < 0 ? (uint32_t)i : (uint32_t)dpu);
+        return;
+    }
+
+    // Reserve the slots of all children first so they stay contiguous
+    node->first = (uint32_t)index->num_nodes;
+    index->num_nodes += count;
+    for (int i = 0; i < count; i++)
+        build_slot(builder, (int)node->first + i, children[i]->children, children[i]->count, dpu < 0 ? i : dpu);
+}
+
+void hybrid_build(HybridIndex *index, Node *root, uint32_t nr_dpus, void **images, size_t *image_sizes, int *image_leaves)
+{
+    HybridBuilder builder;
+    builder.index = index;
+    builder.images = (uint8_t **)images;
+    builder.num_leaves = image_leaves;
+    builder.next_leaf = (uint32_t *)calloc(nr_dpus, sizeof(uint32_t));
+    builder.next_point = (uint32_t *)calloc(nr_dpus, sizeof(uint32_t));
+
+    // Partitions are the root's children, or the root itself when it is a single leaf
+    Node **partitions = root->isLeaf ? &root : root->children;
+    int num_partitions = root->isLeaf ? 1 : root->count;
+    if (num_partitions > (int)nr_dpus)
+        num_partitions = (int)nr_dpus;
+
+    int internal = 1, leaves = 0;
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        int points = 0;
+        image_leaves[d] = 0;
+        if ((int)d < num_partitions)
+            count_subtree(partitions[d], &internal, &image_leaves[d], &points);
+        leaves += image_leaves[d];
+        image_sizes[d] = LEAF_POINTS_OFFSET(image_leaves[d]) + points * sizeof(Point);
+        images[d] = calloc(1, image_sizes[d]);
+        if (images[d] == NULL)
+        {
+            perror("Failed to allocate leaf image");
+            exit(1);
+        }
+    }
+
+    index->nodes = (HybridNode *)malloc(internal * sizeof(HybridNode));
+    index->leaves = (HybridLeaf *)malloc((leaves > 0 ? leaves : 1) * sizeof(HybridLeaf));
+    if (builder.next_leaf == NULL || builder.next_point == NULL || index->nodes == NULL || index->leaves == NULL)
+    {
+        perror("Failed to allocate hybrid index");
+        exit(1);
+    }
+    index->num_nodes = 1;
+    index->num_leaves = 0;
+    build_slot(&builder, 0, partitions, num_partitions, -1);
+
+    // Close every image's directory with the end of its last leaf
+    for (uint32_t d = 0; d < nr_dpus; d++)
+        ((uint32_t *)images[d])[image_leaves[d]] = builder.next_point[d];
+
+    free(builder.next_leaf);
+    free(builder.next_point);
+}
+
+void hybrid_free(HybridIndex *index)
+{
+    free(index->nodes);
+    free(index->leaves);
+    index->nodes = NULL;
+    index->leaves = NULL;
+}
+
+size_t hybrid_index_bytes(const HybridIndex *index)
+{
+    return index->num_nodes * sizeof(HybridNode) + index->num_leaves * sizeof(HybridLeaf);
+}
+
+// Recursive function to collect the leaves whose MBR holds a query, in index order
+static void collect_leaves(const HybridIndex *index, int slot, Point query, int *matches, int *num_matches)
+{
+    const HybridNode *node = &index->nodes[slot];
+    for (uint32_t i = node->first; i < node->first + node->count; i++)
+    {
+        if (node->leaf_parent)
+        {
+            if (isPointInMBR((MBR *)&index->leaves[i].mbr, query))
+                matches[(*num_matches)++] = (int)i;
+        }
+        else if (isPointInMBR((MBR *)&index->nodes[i].mbr, query))
+        {
+            collect_leaves(index, (int)i, query, matches, num_matches);
+        }
+    }
+}
+
+// Function to push the requests of a batch, run it and fold the answers into found
+static void launch_batch(struct dpu_set_t dpu_set, uint32_t nr_dpus, HybridBatch *batch, uint8_t *found,
+                         PipelineStats *stats, KernelStats *kernel_stats)
+{
+    struct dpu_set_t dpu;
+    uint32_t dpu_index;
+    uint32_t max_count = 0;
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        batch->args[d].buffer = 0;
+        batch->args[d].count = batch->counts[d];
+        if (batch->counts[d] > max_count)
+            max_count = batch->counts[d];
+    }
+    if (max_count == 0)
+    {
+        batch->num_queries = 0;
+        return;
+    }
+
+    // Request lists differ per DPU; each transfer moves the longest one
+    double start = timing_now();
+    DPU_FOREACH(dpu_set, dpu, dpu_index)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->requests[dpu_index * QUERY_BATCH_SIZE]));
+    }
+    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_LEAF_REQUESTS", 0, max_count * sizeof(LeafRequest), DPU_XFER_DEFAULT));
+    DPU_FOREACH(dpu_set, dpu, dpu_index)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->args[dpu_index]));
+    }
+    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_BATCH_ARGS", 0, sizeof(BatchArgs), DPU_XFER_DEFAULT));
+    double pushed = timing_now();
+
+    DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+    double executed = timing_now();
+
+    DPU_FOREACH(dpu_set, dpu, dpu_index)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->results[dpu_index * QUERY_BATCH_SIZE]));
+    }
+    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, "DPU_RESULTS", 0, max_count * sizeof(uint64_t), DPU_XFER_DEFAULT));
+    if (kernel_stats != NULL)
+    {
+        DPU_FOREACH(dpu_set, dpu, dpu_index)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->counters[dpu_index * NR_TASKLETS]));
+        }
+        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, "DPU_STATS", 0, NR_TASKLETS * sizeof(TaskletStats), DPU_XFER_DEFAULT));
+    }
+    double pulled = timing_now();
+
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        for (uint32_t r = 0; r < batch->counts[d]; r++)
+        {
+            if (batch->results[d * QUERY_BATCH_SIZE + r])
+                found[batch->owners[d * QUERY_BATCH_SIZE + r]] = 1;
+        }
+        batch->counts[d] = 0;
+    }
+    if (kernel_stats != NULL)
+        kernel_stats_add_launch(kernel_stats, batch->counters, (uint32_t)batch->num_queries);
+    double merged = timing_now();
+
+    stats->transfer_in_time += pushed - start;
+    stats->launch_time += executed - pushed;
+    stats->transfer_out_time += pulled - executed;
+    stats->merge_time += merged - pulled;
+    stats->num_batches++;
+    batch->num_queries = 0;
+}
+
+void run_hybrid_queries(struct dpu_set_t dpu_set, uint32_t nr_dpus, const HybridIndex *index, const Point *queries,
+                        int num_queries, uint8_t *found, PipelineStats *stats, KernelStats *kernel_stats)
+{
+    HybridBatch batch;
+    batch.requests = (LeafRequest *)calloc((size_t)nr_dpus * QUERY_BATCH_SIZE, sizeof(LeafRequest));
+    batch.owners = (int *)calloc((size_t)nr_dpus * QUERY_BATCH_SIZE, sizeof(int));
+    batch.counts = (uint32_t *)calloc(nr_dpus, sizeof(uint32_t));
+    batch.args = (BatchArgs *)calloc(nr_dpus, sizeof(BatchArgs));
+    batch.results = (uint64_t *)calloc((size_t)nr_dpus * QUERY_BATCH_SIZE, sizeof(uint64_t));
+    batch.counters = (TaskletStats *)calloc((size_t)nr_dpus * NR_TASKLETS, sizeof(TaskletStats));
+    batch.num_queries = 0;
+    int *matches = (int *)malloc((index->num_leaves > 0 ? index->num_leaves : 1) * sizeof(int));
+    if (batch.requests == NULL || batch.owners == NULL || batch.counts == NULL || batch.args == NULL ||
+        batch.results == NULL || batch.counters == NULL || matches == NULL)
+    {
+        perror("Failed to allocate hybrid batch");
+        exit(1);
+    }
+    memset(found, 0, (size_t)num_queries);
+    memset(stats, 0, sizeof(PipelineStats));
+
+    double start = timing_now();
+    for (int q = 0; q < num_queries; q++)
+    {
+        double resolve_start = timing_now();
+        int num_matches = 0;
+        if (index->nodes[0].count > 0 && isPointInMBR((MBR *)&index->nodes[0].mbr, queries[q]))
+            collect_leaves(index, 0, queries[q], matches, &num_matches);
+        if (num_matches > QUERY_BATCH_SIZE)
+        {
+            printf("Query (%.1f, %.1f) falls in %d leaves, more than one launch holds\n", queries[q].x, queries[q].y, num_matches);
+            exit(1);
+        }
+
+        // Launch what is queued when this query might not fit any more
+        bool full = false;
+        for (int m = 0; m < num_matches && !full; m++)
+            full = batch.counts[index->leaves[matches[m]].dpu] + num_matches > QUERY_BATCH_SIZE;
+        stats->queue_time += timing_now() - resolve_start;
+        if (full)
+            launch_batch(dpu_set, nr_dpus, &batch, found, stats, kernel_stats);
+
+        // Adjacent leaves of the same DPU become one run
+        resolve_start = timing_now();
+        for (int m = 0; m < num_matches; m++)
+        {
+            const HybridLeaf *leaf = &index->leaves[matches[m]];
+            uint32_t base = leaf->dpu * QUERY_BATCH_SIZE;
+            uint32_t r = batch.counts[leaf->dpu];
+            LeafRequest *last = r > 0 ? &batch.requests[base + r - 1] : NULL;
+            if (last != NULL && batch.owners[base + r - 1] == q && last->first_leaf + last->num_leaves == leaf->leaf)
+            {
+                last->num_leaves++;
+                continue;
+            }
+            batch.requests[base + r].query = queries[q];
+            batch.requests[base + r].first_leaf = leaf->leaf;
+            batch.requests[base + r].num_leaves = 1;
+            batch.owners[base + r] = q;
+            batch.counts[leaf->dpu]++;
+        }
+        batch.num_queries++;
+        stats->queue_time += timing_now() - resolve_start;
+    }
+    launch_batch(dpu_set, nr_dpus, &batch, found, stats, kernel_stats);
+    stats->total_time = timing_now() - start;
+
+    free(matches);
+    free(batch.counters);
+    free(batch.results);
+    free(batch.args);
+    free(batch.counts);
+    free(batch.owners);
+    free(batch.requests);
+}
@@ -0,0 +1,52 @@
+#ifndef __HYBRID_H__
+#define __HYBRID_H__
+
+#include <dpu.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "kernelstats.h"
+#include "pipeline.h"
+#include "rtree.h"
+
+/* Upper levels of the tree as the host keeps them in hybrid mode. Children of a node are
+ * contiguous: nodes[first .. first + count) or, for a node just above the leaves, leaves[...]. */
+typedef struct HybridNode
+{
+    MBR mbr;
+    uint32_t first;
+    uint16_t count;
+    uint16_t leaf_parent; // 1 when the children are leaves
+} HybridNode;
+
+/* A leaf the host only knows the MBR of, and where it lives */
+typedef struct HybridLeaf
+{
+    MBR mbr;
+    uint32_t dpu;  // Partition holding the leaf
+    uint32_t leaf; // Index of the leaf in that DPU's image
+} HybridLeaf;
+
+typedef struct HybridIndex
+{
+    HybridNode *nodes; // nodes[0] covers every partition
+    int num_nodes;
+    HybridLeaf *leaves;
+    int num_leaves;
+} HybridIndex;
+
+// Build the host index of a pointer tree and the leaves-only image of each of nr_dpus partitions
+// (DPU i gets child i of the root, as in the other modes). images[i] is allocated by the function
+// and image_sizes[i] set to its size in bytes; a DPU without a partition gets an empty image.
+void hybrid_build(HybridIndex *index, Node *root, uint32_t nr_dpus, void **images, size_t *image_sizes, int *image_leaves);
+void hybrid_free(HybridIndex *index);
+
+// Bytes of the host index
+size_t hybrid_index_bytes(const HybridIndex *index);
+
+// Resolve num_queries queries on the host, have the DPUs scan the leaves they were resolved to,
+// and set found[q] when any leaf holds query q. Stats and kernel_stats are filled as by run_query_pipeline.
+void run_hybrid_queries(struct dpu_set_t dpu_set, uint32_t nr_dpus, const HybridIndex *index, const Point *queries,
+                        int num_queries, uint8_t *found, PipelineStats *stats, KernelStats *kernel_stats);
+
+#endif /* __HYBRID_H__ */
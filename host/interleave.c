@@ -0,0 +1,169 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "interleave.h"
+
+#define INTERLEAVE_MAX_DEPTH 32 // Internal levels a lane tracks itself, deeper subtrees are searched recursively
+
+// Where a lane is in its search
+enum
+{
+    STAGE_IDLE,     // No query, or the last one is answered
+    STAGE_VISIT,    // node was prefetched and its MBR holds the point
+    STAGE_CHILDREN, // The children array of the node on top of the stack was prefetched
+    STAGE_TEST,     // Its children were prefetched: descend into the next one whose MBR holds the point
+    STAGE_SCAN      // node is a leaf whose points were prefetched
+};
+
+/* One query in flight */
+typedef struct Lane
+{
+    int stage;
+    int query;
+    Point point;
+    Node *node;
+    int depth;                            // Entries used in the stack
+    Node *parents[INTERLEAVE_MAX_DEPTH];  // Internal nodes on the path to node
+    int next_child[INTERLEAVE_MAX_DEPTH]; // Child of each parent to test next
+} Lane;
+
+// Function to answer the lane's query and hand it the next one, starting at the root
+static void next_query_of(Lane *lane, bool answer, Node *root, const Point *queries, int *next_query, int num_queries, uint8_t *found)
+{
+    if (lane->stage != STAGE_IDLE)
+    {
+        found[lane->query] = answer;
+    }
+    if (*next_query >= num_queries)
+    {
+        lane->stage = STAGE_IDLE;
+        return;
+    }
+    lane->query = (*next_query)++;
+    lane->point = queries[lane->query];
+    lane->depth = 0;
+    if (!isPointInMBR(&root->mbr, lane->point))
+    {
+        // The root is shared by every query and stays cached
+        found[lane->query] = 0;
+        next_query_of(lane, false, root, queries, next_query, num_queries, found);
+        return;
+    }
+    lane->node = root;
+    lane->stage = STAGE_VISIT;
+}
+
+// Function to advance a lane until it has to wait for memory; returns false when it went idle
+static bool step(Lane *lane, Node *root, const Point *queries, int *next_query, int num_queries, uint8_t *found)
+{
+    for (;;)
+    {
+        switch (lane->stage)
+        {
+        case STAGE_VISIT:
+        {
+            Node *node = lane->node;
+            if (node->isLeaf)
+            {
+                __builtin_prefetch(node->points);
+                lane->stage = STAGE_SCAN;
+                return true;
+            }
+            if (lane->depth == INTERLEAVE_MAX_DEPTH)
+            {
+                // Too deep to track, finish this subtree in place
+                if (searchRTree(node, lane->point))
+                {
+                    next_query_of(lane, true, root, queries, next_query, num_queries, found);
+                    return lane->stage != STAGE_IDLE;
+                }
+                lane->stage = STAGE_TEST;
+                break;
+            }
+            lane->parents[lane->depth] = node;
+            lane->next_child[lane->depth] = 0;
+            lane->depth++;
+            __builtin_prefetch(node->children);
+            lane->stage = STAGE_CHILDREN;
+            return true;
+        }
+        case STAGE_CHILDREN:
+        {
+            // Fetch all children at once, their MBRs are tested together on the next step
+            Node *parent = lane->parents[lane->depth - 1];
+            for (int i = 0; i < parent->count; i++)
+            {
+                __builtin_prefetch(parent->children[i]);
+            }
+            lane->stage = STAGE_TEST;
+            return true;
+        }
+        case STAGE_TEST:
+        {
+            if (lane->depth == 0)
+            {
+                // Every path is exhausted
+                next_query_of(lane, false, root, queries, next_query, num_queries, found);
+                return lane->stage != STAGE_IDLE;
+            }
+            Node *parent = lane->parents[lane->depth - 1];
+            int i = lane->next_child[lane->depth - 1];
+            while (i < parent->count && !isPointInMBR(&parent->children[i]->mbr, lane->point))
+            {
+                i++;
+            }
+            if (i == parent->count)
+            {
+                lane->depth--;
+                break;
+            }
+            lane->next_child[lane->depth - 1] = i + 1;
+            lane->node = parent->children[i];
+            lane->stage = STAGE_VISIT;
+            break;
+        }
+        case STAGE_SCAN:
+        {
+            Node *leaf = lane->node;
+            for (int i = 0; i < leaf->count; i++)
+            {
+                if (leaf->points[i].x == lane->point.x && leaf->points[i].y == lane->point.y)
+                {
+                    next_query_of(lane, true, root, queries, next_query, num_queries, found);
+                    return lane->stage != STAGE_IDLE;
+                }
+            }
+            lane->stage = STAGE_TEST;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+void search_rtree_interleaved(Node *root, const Point *queries, int num_queries, uint8_t *found, int width)
+{
+    Lane lanes[INTERLEAVE_MAX_WIDTH];
+    width = width < 1 ? 1 : (width > INTERLEAVE_MAX_WIDTH ? INTERLEAVE_MAX_WIDTH : width);
+
+    int next_query = 0;
+    for (int l = 0; l < width; l++)
+    {
+        lanes[l].stage = STAGE_IDLE;
+        next_query_of(&lanes[l], false, root, queries, &next_query, num_queries, found);
+    }
+
+    // Round-robin over the lanes until all of them ran out of queries
+    int active = width;
+    while (active > 0)
+    {
+        active = 0;
+        for (int l = 0; l < width; l++)
+        {
+            if (lanes[l].stage != STAGE_IDLE && step(&lanes[l], root, queries, &next_query, num_queries, found))
+            {
+                active++;
+            }
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef __INTERLEAVE_H__
+#define __INTERLEAVE_H__
+
+#include <stdint.h>
+#include "common.h"
+#include "rtree.h"
+
+#define INTERLEAVE_MAX_WIDTH 64 // Queries a search can keep in flight
+
+// Search num_queries queries in the pointer tree with width of them in flight: each query is a
+// small state machine that prefetches the next node it needs and yields to the next query, so the
+// misses of different queries overlap instead of being waited for one after the other.
+// found[q] is set as searchRTree would answer query q.
+void search_rtree_interleaved(Node *root, const Point *queries, int num_queries, uint8_t *found, int width);
+
+#endif /* __INTERLEAVE_H__ */
@@ -0,0 +1,178 @@
+#include <dpu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "kernelstats.h"
+
+void kernel_stats_init(KernelStats *stats, struct dpu_set_t dpu_set, uint32_t nr_dpus)
+{
+    struct dpu_set_t rank, dpu;
+    uint32_t each_rank;
+    uint32_t dpu_index = 0;
+
+    memset(stats, 0, sizeof(KernelStats));
+    stats->nr_dpus = nr_dpus;
+    stats->rank_of_dpu = (uint32_t *)calloc(nr_dpus, sizeof(uint32_t));
+    stats->tasklets = (TaskletStats *)calloc((size_t)nr_dpus * NR_TASKLETS, sizeof(TaskletStats));
+    stats->dpus = (TaskletStats *)calloc(nr_dpus, sizeof(TaskletStats));
+    if (stats->rank_of_dpu == NULL || stats->tasklets == NULL || stats->dpus == NULL)
+    {
+        perror("Failed to allocate kernel statistics");
+        exit(1);
+    }
+
+    // DPU_FOREACH walks the set rank by rank, so the flat DPU index follows the same order
+    DPU_RANK_FOREACH(dpu_set, rank, each_rank)
+    {
+        DPU_FOREACH(rank, dpu)
+        {
+            if (dpu_index < nr_dpus)
+                stats->rank_of_dpu[dpu_index++] = each_rank;
+        }
+        stats->nr_ranks++;
+    }
+}
+
+void kernel_stats_free(KernelStats *stats)
+{
+    free(stats->rank_of_dpu);
+    free(stats->tasklets);
+    free(stats->dpus);
+}
+
+// Function to add the counters of b to a
+static void add_counters(TaskletStats *a, const TaskletStats *b)
+{
+    a->cycles += b->cycles;
+    a->nodes_visited += b->nodes_visited;
+    a->mbr_tests += b->mbr_tests;
+    a->points_compared += b->points_compared;
+    a->mram_bytes += b->mram_bytes;
+    a->bloom_skips += b->bloom_skips;
+    a->early_exits += b->early_exits;
+}
+
+void kernel_stats_add_launch(KernelStats *stats, TaskletStats *launch, uint32_t num_queries)
+{
+    uint64_t critical = 0;
+    for (uint32_t d = 0; d < stats->nr_dpus; d++)
+    {
+        // A DPU finishes when its slowest tasklet does
+        uint64_t slowest = 0;
+        for (uint32_t t = 0; t < NR_TASKLETS; t++)
+        {
+            TaskletStats *tasklet = &launch[d * NR_TASKLETS + t];
+            add_counters(&stats->tasklets[d * NR_TASKLETS + t], tasklet);
+            stats->dpus[d].nodes_visited += tasklet->nodes_visited;
+            stats->dpus[d].mbr_tests += tasklet->mbr_tests;
+            stats->dpus[d].points_compared += tasklet->points_compared;
+            stats->dpus[d].mram_bytes += tasklet->mram_bytes;
+            stats->dpus[d].bloom_skips += tasklet->bloom_skips;
+            stats->dpus[d].early_exits += tasklet->early_exits;
+            if (tasklet->cycles > slowest)
+                slowest = tasklet->cycles;
+        }
+        stats->dpus[d].cycles += slowest;
+        if (slowest > critical)
+            critical = slowest;
+    }
+    stats->critical_cycles += critical;
+    stats->queries += num_queries;
+    stats->launches++;
+}
+
+// Function to compute the ratio of the largest to the mean of n values (1.0 means perfectly balanced)
+static double imbalance(const uint64_t *values, uint32_t n)
+{
+    uint64_t max = 0, sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        sum += values[i];
+        if (values[i] > max)
+            max = values[i];
+    }
+    return sum ? (double)max * n / sum : 1.0;
+}
+
+double kernel_stats_mram_bytes_per_query(KernelStats *stats)
+{
+    uint64_t bytes = 0;
+    for (uint32_t d = 0; d < stats->nr_dpus; d++)
+        bytes += stats->dpus[d].mram_bytes;
+    return stats->queries ? (double)bytes / stats->queries : 0.0;
+}
+
+void kernel_stats_report(KernelStats *stats)
+{
+    if (stats->launches == 0)
+        return;
+
+    printf(ANSI_COLOR_LIGHT_BLUE "\nKernel counters over %d launch(es), %.0f cycles per query on the slowest DPU" ANSI_COLOR_RESET "\n",
+           stats->launches, stats->queries ? (double)stats->critical_cycles / stats->queries : 0.0);
+    printf("%-6s %6s %16s %16s %14s %14s %16s %12s\n",
+           "rank", "dpus", "max cycles", "mean cycles", "nodes", "mbr tests", "points", "bytes/cycle");
+
+    for (uint32_t r = 0; r < stats->nr_ranks; r++)
+    {
+        TaskletStats total = {0, 0, 0, 0, 0, 0, 0};
+        uint64_t max_cycles = 0;
+        uint32_t dpus = 0;
+        for (uint32_t d = 0; d < stats->nr_dpus; d++)
+        {
+            if (stats->rank_of_dpu[d] != r)
+                continue;
+            add_counters(&total, &stats->dpus[d]);
+            if (stats->dpus[d].cycles > max_cycles)
+                max_cycles = stats->dpus[d].cycles;
+            dpus++;
+        }
+        if (dpus == 0)
+            continue;
+        printf("%-6u %6u %16lu %16.0f %14lu %14lu %16lu %12.3f\n", r, dpus, (unsigned long)max_cycles,
+               (double)total.cycles / dpus, (unsigned long)total.nodes_visited, (unsigned long)total.mbr_tests,
+               (unsigned long)total.points_compared, total.cycles ? (double)total.mram_bytes / total.cycles : 0.0);
+    }
+
+    // Imbalance across DPUs, and the worst imbalance between the tasklets of one DPU
+    uint64_t *values = (uint64_t *)malloc((stats->nr_dpus > NR_TASKLETS ? stats->nr_dpus : NR_TASKLETS) * sizeof(uint64_t));
+    uint32_t busiest = 0;
+    for (uint32_t d = 0; d < stats->nr_dpus; d++)
+    {
+        values[d] = stats->dpus[d].cycles;
+        if (values[d] > values[busiest])
+            busiest = d;
+    }
+    double dpu_imbalance = imbalance(values, stats->nr_dpus);
+
+    double worst_tasklet_imbalance = 1.0;
+    uint32_t worst_dpu = 0;
+    for (uint32_t d = 0; d < stats->nr_dpus; d++)
+    {
+        for (uint32_t t = 0; t < NR_TASKLETS; t++)
+            values[t] = stats->tasklets[d * NR_TASKLETS + t].cycles;
+        double tasklet_imbalance = imbalance(values, NR_TASKLETS);
+        if (tasklet_imbalance > worst_tasklet_imbalance)
+        {
+            worst_tasklet_imbalance = tasklet_imbalance;
+            worst_dpu = d;
+        }
+    }
+    free(values);
+
+    uint64_t bloom_skips = 0, early_exits = 0;
+    for (uint32_t d = 0; d < stats->nr_dpus; d++)
+    {
+        bloom_skips += stats->dpus[d].bloom_skips;
+        early_exits += stats->dpus[d].early_exits;
+    }
+    if (bloom_skips > 0)
+        printf("WRAM Bloom filters skipped %lu partition searches\n", (unsigned long)bloom_skips);
+    printf("Searches cut short by a match on another tasklet: %lu\n", (unsigned long)early_exits);
+
+    TaskletStats *hot = &stats->dpus[busiest];
+    printf("DPU cycle imbalance (max/mean) %.2f, busiest DPU %u: %lu cycles, %lu nodes, %lu MRAM bytes\n",
+           dpu_imbalance, busiest, (unsigned long)hot->cycles, (unsigned long)hot->nodes_visited, (unsigned long)hot->mram_bytes);
+    printf("Worst tasklet cycle imbalance (max/mean) %.2f on DPU %u\n", worst_tasklet_imbalance, worst_dpu);
+    printf("MRAM bytes per query over all DPUs: %.0f\n", kernel_stats_mram_bytes_per_query(stats));
+}
@@ -0,0 +1,33 @@
+#ifndef __KERNELSTATS_H__
+#define __KERNELSTATS_H__
+
+#include <dpu.h>
+#include <stdint.h>
+#include "common.h"
+
+/* Kernel counters of a run, accumulated over every launch */
+typedef struct KernelStats
+{
+    uint32_t nr_dpus;
+    uint32_t nr_ranks;
+    uint32_t *rank_of_dpu; // Rank index of each DPU, in DPU_FOREACH order
+    int launches;
+    uint64_t queries;         // Queries over all launches
+    uint64_t critical_cycles; // Sum over launches of the slowest DPU's cycles
+    TaskletStats *tasklets; // nr_dpus * NR_TASKLETS, summed over launches
+    TaskletStats *dpus;     // Per DPU; cycles add up the slowest tasklet of each launch
+} KernelStats;
+
+void kernel_stats_init(KernelStats *stats, struct dpu_set_t dpu_set, uint32_t nr_dpus);
+void kernel_stats_free(KernelStats *stats);
+
+// Fold the DPU_STATS of one launch over num_queries queries (nr_dpus * NR_TASKLETS entries) into the totals
+void kernel_stats_add_launch(KernelStats *stats, TaskletStats *launch, uint32_t num_queries);
+
+// Print per-rank totals and the tasklet and DPU load imbalance
+void kernel_stats_report(KernelStats *stats);
+
+// MRAM bytes all DPUs together read per query
+double kernel_stats_mram_bytes_per_query(KernelStats *stats);
+
+#endif /* __KERNELSTATS_H__ */
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "numa.h"
+
+// mbind policies and flags of <numaif.h>, which is part of libnuma and not always installed
+#define NUMA_MPOL_BIND 2
+#define NUMA_MPOL_MF_MOVE (1 << 1)
+#define NUMA_MAX_NODES 64
+
+bool numa_placement = false;
+int numa_huge_pages = HUGE_PAGES_NONE;
+
+// Function to read the first integer of a sysfs file, fallback when it cannot be read
+static int read_sysfs_int(const char *path, int fallback)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return fallback;
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+        value = fallback;
+    fclose(file);
+    return value;
+}
+
+int numa_nodes(void)
+{
+    char path[64];
+    int nodes = 0;
+    while (nodes < NUMA_MAX_NODES)
+    {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nodes);
+        if (access(path, F_OK) != 0)
+            break;
+        nodes++;
+    }
+    return nodes > 0 ? nodes : 1;
+}
+
+// Function to read the node of one dpu_rank device; older drivers only expose it on the parent device
+static int device_node(const char *device)
+{
+    char path[320];
+    snprintf(path, sizeof(path), "/sys/class/dpu_rank/%s/numa_node", device);
+    int node = read_sysfs_int(path, -1);
+    if (node < 0)
+    {
+        snprintf(path, sizeof(path), "/sys/class/dpu_rank/%s/device/numa_node", device);
+        node = read_sysfs_int(path, -1);
+    }
+    return node;
+}
+
+int numa_rank_node(unsigned rank_id)
+{
+    // Find the device whose rank_id attribute is this rank's: device numbers need not follow rank ids
+    DIR *ranks = opendir("/sys/class/dpu_rank");
+    if (ranks == NULL)
+        return -1;
+    char device[256];
+    bool found = false;
+    bool has_ids = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(ranks)) != NULL)
+    {
+        if (strncmp(entry->d_name, "dpu_rank", 8) != 0)
+            continue;
+        char path[320];
+        snprintf(path, sizeof(path), "/sys/class/dpu_rank/%s/rank_id", entry->d_name);
+        int id = read_sysfs_int(path, -1);
+        has_ids = has_ids || id >= 0;
+        if (id >= 0 && (unsigned)id == rank_id)
+        {
+            snprintf(device, sizeof(device), "%s", entry->d_name);
+            found = true;
+        }
+    }
+    closedir(ranks);
+
+    // Drivers without the attribute number their devices by rank id
+    if (!found && !has_ids)
+    {
+        snprintf(device, sizeof(device), "dpu_rank%u", rank_id);
+        found = true;
+    }
+    return found ? device_node(device) : -1;
+}
+
+bool numa_pin_thread(int node)
+{
+    if (node < 0)
+        return false;
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    // cpulist reads like "0-15,32-47"
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    int first, last;
+    int count = 0;
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        last = first;
+        int separator = fgetc(file);
+        if (separator == '-')
+        {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            separator = fgetc(file);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &cpus);
+            count++;
+        }
+        if (separator != ',')
+            break;
+    }
+    fclose(file);
+    return count > 0 && sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == 0;
+}
+
+bool numa_bind(void *memory, size_t size, int node)
+{
+    if (node < 0 || node >= NUMA_MAX_NODES)
+        return false;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)memory + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)memory + size) & ~(page - 1);
+    if (end <= start)
+        return false;
+    unsigned long mask = 1ul << node;
+    return syscall(SYS_mbind, start, end - start, NUMA_MPOL_BIND, &mask, NUMA_MAX_NODES + 1, NUMA_MPOL_MF_MOVE) == 0;
+}
+
+// Function to get the length numa_alloc maps for size bytes
+static size_t mapping_length(size_t size)
+{
+    if (size >= NUMA_HUGE_PAGE_BYTES)
+        return (size + NUMA_HUGE_PAGE_BYTES - 1) / NUMA_HUGE_PAGE_BYTES * NUMA_HUGE_PAGE_BYTES;
+    return size > 0 ? size : 1;
+}
+
+void *numa_alloc(size_t size, int node, int huge_pages)
+{
+    // Large arrays are mapped in whole huge pages whatever the backing, so numa_free can recompute the length
+    void *memory = MAP_FAILED;
+    size_t length = mapping_length(size);
+    if (huge_pages == HUGE_PAGES_EXPLICIT && size >= NUMA_HUGE_PAGE_BYTES)
+    {
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (memory == MAP_FAILED)
+    {
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            perror("Failed to map host memory");
+            exit(1);
+        }
+        if (huge_pages != HUGE_PAGES_NONE && size >= NUMA_HUGE_PAGE_BYTES)
+            madvise(memory, length, MADV_HUGEPAGE);
+    }
+    // Nothing is faulted in yet, so binding now places every page on first touch
+    if (node >= 0)
+        numa_bind(memory, length, node);
+    return memory;
+}
+
+void numa_free(void *memory, size_t size)
+{
+    if (memory == NULL)
+        return;
+    munmap(memory, mapping_length(size));
+}
@@ -0,0 +1,39 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NUMA_HUGE_PAGE_BYTES (2u << 20) // Arrays at least this large are worth backing with huge pages
+
+/* Huge page backing of the large host arrays */
+enum
+{
+    HUGE_PAGES_NONE,
+    HUGE_PAGES_TRANSPARENT, // madvise(MADV_HUGEPAGE), the kernel promotes what it can
+    HUGE_PAGES_EXPLICIT     // MAP_HUGETLB from the reserved pool, transparent when the pool is empty
+};
+
+// Placement asked for on the command line, read by the modules that allocate per-rank buffers
+extern bool numa_placement;  // Pin rank workers and bind per-rank buffers to the node of their rank
+extern int numa_huge_pages; // HUGE_PAGES_* backing of the large arrays
+
+// Number of NUMA nodes the host reports, 1 when it has no NUMA topology
+int numa_nodes(void);
+
+// NUMA node of a rank as the UPMEM driver reports it in sysfs, found by the rank's id
+// (dpu_get_rank_id), -1 when unknown
+int numa_rank_node(unsigned rank_id);
+
+// Restrict the calling thread to the CPUs of a node. Memory it touches first then lands on that node.
+bool numa_pin_thread(int node);
+
+// Allocate zeroed memory with the given huge page backing, bound to node (-1 for the default
+// policy). Release it with numa_free and the same size.
+void *numa_alloc(size_t size, int node, int huge_pages);
+void numa_free(void *memory, size_t size);
+
+// Move the whole pages inside [memory, memory + size) to node, false when the kernel refuses
+bool numa_bind(void *memory, size_t size, int node);
+
+#endif /* __NUMA_H__ */
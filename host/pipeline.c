@@ -0,0 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dpu.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "numa.h"
+#include "pipeline.h"
+#include "ranks.h"
+#include "timing.h"
+
+// Points in a batch's queue where a callback records the time
+enum
+{
+    STAGE_PUSHED,   // Queries and launch arguments are in MRAM
+    STAGE_EXECUTED, // Kernel finished
+    STAGE_PULLED,   // Results are back on the host
+    NR_STAGES
+};
+
+typedef struct StageMark
+{
+    struct QuerySlot *slot;
+    int stage;
+} StageMark;
+
+// Host side of one MRAM query/result region
+typedef struct QuerySlot
+{
+    uint32_t buffer;                 // MRAM region (index into DPU_QUERIES/DPU_RESULTS)
+    BatchArgs args;                  // Launch arguments, must stay valid until the batch is merged
+    EncodedPoint **queries;          // Source of the query transfer: with numa placement one copy per rank on its node, else one broadcast
+    uint64_t *results;               // nr_dpus * QUERY_BATCH_SIZE, target of the result transfer
+    uint8_t *rank_found;             // nr_ranks * QUERY_BATCH_SIZE, the answers each rank's DPUs gave
+    uint32_t ranks_pending;          // Ranks whose results are not merged yet
+    TaskletStats *counters;          // nr_dpus * NR_TASKLETS, target of the DPU_STATS transfer
+    int first_query;                 // Index of the first query of the batch in the query set
+    bool in_flight;                  // Set when queued, cleared by the merge callback
+    double queued_at;                // When the host queued the batch
+    double stamps[NR_STAGES];        // When the rank queues reached each stage
+    StageMark marks[NR_STAGES];
+    struct QueryPipeline *pipeline;
+} QuerySlot;
+
+typedef struct QueryPipeline
+{
+    QuerySlot slots[NR_QUERY_BUFFERS];
+    uint32_t nr_dpus;
+    RankSet ranks;
+    uint32_t *rank_of_dpu; // Index into ranks, to pick a DPU's query copy
+    uint32_t nr_query_copies;
+    uint8_t *found;
+    KernelStats *kernel_stats;
+    double transfer_in_time;
+    double launch_time;
+    double transfer_out_time;
+    double merge_time;
+    double last_merged_at; // The next batch cannot start transferring before this
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free;
+} QueryPipeline;
+
+// Callback queued between the operations of a batch, once per rank: keep when the last queue got there.
+// A single-call callback would make every rank wait for the slowest one at each stage.
+static dpu_error_t stamp_stage(struct dpu_set_t dpu_set, uint32_t rank_id, void *arg)
+{
+    (void)dpu_set;
+    (void)rank_id;
+    StageMark *mark = (StageMark *)arg;
+    QueryPipeline *pipeline = mark->slot->pipeline;
+    double now = timing_now();
+    pthread_mutex_lock(&pipeline->lock);
+    if (now > mark->slot->stamps[mark->stage])
+        mark->slot->stamps[mark->stage] = now;
+    pthread_mutex_unlock(&pipeline->lock);
+    return DPU_OK;
+}
+
+// Callback run by the SDK on each rank's thread once that rank has returned the results of a batch:
+// reduce the answers of its DPUs to one per query. The last rank folds those into the query set and
+// hands the slot back to the producer.
+static dpu_error_t merge_batch_results(struct dpu_set_t dpu_set, uint32_t rank_id, void *arg)
+{
+    (void)dpu_set;
+    QuerySlot *slot = (QuerySlot *)arg;
+    QueryPipeline *pipeline = slot->pipeline;
+    const RankRange *rank = &pipeline->ranks.ranks[rank_id];
+
+    double start = timing_now();
+    uint8_t *rank_found = &slot->rank_found[rank_id * QUERY_BATCH_SIZE];
+    for (uint32_t q = 0; q < slot->args.count; q++)
+    {
+        rank_found[q] = 0;
+        for (uint32_t d = rank->first_dpu; d < rank->first_dpu + rank->nr_dpus; d++)
+        {
+            if (slot->results[d * QUERY_BATCH_SIZE + q])
+            {
+                rank_found[q] = 1;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    if (--slot->ranks_pending > 0)
+    {
+        pipeline->merge_time += timing_now() - start;
+        pthread_mutex_unlock(&pipeline->lock);
+        return DPU_OK;
+    }
+    for (uint32_t q = 0; q < slot->args.count; q++)
+    {
+        for (uint32_t r = 0; r < pipeline->ranks.nr_ranks; r++)
+        {
+            if (slot->rank_found[r * QUERY_BATCH_SIZE + q])
+            {
+                pipeline->found[slot->first_query + q] = 1;
+                break;
+            }
+        }
+    }
+    double end = timing_now();
+
+    // The transfer-in span starts when both the host has queued the batch and the previous batch left the queue
+    double ready = slot->queued_at > pipeline->last_merged_at ? slot->queued_at : pipeline->last_merged_at;
+    pipeline->transfer_in_time += slot->stamps[STAGE_PUSHED] - ready;
+    pipeline->launch_time += slot->stamps[STAGE_EXECUTED] - slot->stamps[STAGE_PUSHED];
+    pipeline->transfer_out_time += slot->stamps[STAGE_PULLED] - slot->stamps[STAGE_EXECUTED];
+    pipeline->merge_time += end - start;
+    pipeline->last_merged_at = end;
+    if (pipeline->kernel_stats != NULL)
+    {
+        kernel_stats_add_launch(pipeline->kernel_stats, slot->counters, slot->args.count);
+    }
+    slot->in_flight = false;
+    pthread_cond_signal(&pipeline->slot_free);
+    pthread_mutex_unlock(&pipeline->lock);
+    return DPU_OK;
+}
+
+void run_query_pipeline(struct dpu_set_t dpu_set, uint32_t nr_dpus, EncodedPoint *queries, int num_queries, uint32_t batch_flags,
+                        uint8_t *found, PipelineStats *stats, KernelStats *kernel_stats)
+{
+    struct dpu_set_t dpu;
+    uint32_t dpu_index;
+    QueryPipeline *pipeline = (QueryPipeline *)calloc(1, sizeof(QueryPipeline));
+    if (pipeline == NULL)
+    {
+        perror("Failed to allocate query pipeline");
+        exit(1);
+    }
+
+    pipeline->nr_dpus = nr_dpus;
+    rank_set_init(&pipeline->ranks, dpu_set, nr_dpus, false);
+    pipeline->rank_of_dpu = (uint32_t *)calloc(nr_dpus > 0 ? nr_dpus : 1, sizeof(uint32_t));
+    if (pipeline->rank_of_dpu == NULL)
+    {
+        perror("Failed to allocate query pipeline");
+        exit(1);
+    }
+    for (uint32_t r = 0; r < pipeline->ranks.nr_ranks; r++)
+    {
+        const RankRange *rank = &pipeline->ranks.ranks[r];
+        for (uint32_t d = rank->first_dpu; d < rank->first_dpu + rank->nr_dpus; d++)
+            pipeline->rank_of_dpu[d] = r;
+    }
+    pipeline->nr_query_copies = numa_placement && pipeline->ranks.nr_ranks > 0 ? pipeline->ranks.nr_ranks : 1;
+    pipeline->found = found;
+    pipeline->kernel_stats = kernel_stats;
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->slot_free, NULL);
+    for (uint32_t b = 0; b < NR_QUERY_BUFFERS; b++)
+    {
+        pipeline->slots[b].buffer = b;
+        pipeline->slots[b].pipeline = pipeline;
+        for (int stage = 0; stage < NR_STAGES; stage++)
+        {
+            pipeline->slots[b].marks[stage].slot = &pipeline->slots[b];
+            pipeline->slots[b].marks[stage].stage = stage;
+        }
+        // Results of each rank's DPUs land in pages of that rank's node
+        size_t results_size = (size_t)nr_dpus * QUERY_BATCH_SIZE * sizeof(uint64_t);
+        pipeline->slots[b].results = (uint64_t *)numa_alloc(results_size, -1, numa_huge_pages);
+        for (uint32_t r = 0; r < pipeline->ranks.nr_ranks; r++)
+        {
+            const RankRange *rank = &pipeline->ranks.ranks[r];
+            numa_bind(&pipeline->slots[b].results[rank->first_dpu * QUERY_BATCH_SIZE],
+                      rank->nr_dpus * QUERY_BATCH_SIZE * sizeof(uint64_t), rank->numa_node);
+        }
+        pipeline->slots[b].rank_found = (uint8_t *)calloc((size_t)pipeline->ranks.nr_ranks * QUERY_BATCH_SIZE, 1);
+        pipeline->slots[b].counters = (TaskletStats *)calloc((size_t)nr_dpus * NR_TASKLETS, sizeof(TaskletStats));
+        pipeline->slots[b].queries = (EncodedPoint **)calloc(pipeline->nr_query_copies, sizeof(EncodedPoint *));
+        if (pipeline->slots[b].results == NULL || pipeline->slots[b].rank_found == NULL || pipeline->slots[b].counters == NULL ||
+            pipeline->slots[b].queries == NULL)
+        {
+            perror("Failed to allocate result buffer");
+            exit(1);
+        }
+        // Likewise the queries each rank receives are read from a copy on its node
+        for (uint32_t c = 0; c < pipeline->nr_query_copies; c++)
+        {
+            int node = numa_placement ? pipeline->ranks.ranks[c].numa_node : -1;
+            pipeline->slots[b].queries[c] = (EncodedPoint *)numa_alloc(QUERY_BATCH_SIZE * sizeof(EncodedPoint), node, HUGE_PAGES_NONE);
+        }
+    }
+    memset(found, 0, (size_t)num_queries);
+    memset(stats, 0, sizeof(PipelineStats));
+
+    double start = timing_now();
+    pipeline->last_merged_at = start;
+    for (int first = 0; first < num_queries; first += QUERY_BATCH_SIZE)
+    {
+        QuerySlot *slot = &pipeline->slots[stats->num_batches % NR_QUERY_BUFFERS];
+
+        // Batch k reuses the region of batch k - NR_QUERY_BUFFERS, wait until that one is merged
+        double wait_start = timing_now();
+        pthread_mutex_lock(&pipeline->lock);
+        while (slot->in_flight)
+        {
+            pthread_cond_wait(&pipeline->slot_free, &pipeline->lock);
+        }
+        slot->in_flight = true;
+        slot->ranks_pending = pipeline->ranks.nr_ranks;
+        memset(slot->stamps, 0, sizeof(slot->stamps));
+        pthread_mutex_unlock(&pipeline->lock);
+        double queue_start = timing_now();
+        stats->wait_time += queue_start - wait_start;
+
+        uint32_t count = (uint32_t)(num_queries - first < QUERY_BATCH_SIZE ? num_queries - first : QUERY_BATCH_SIZE);
+        slot->first_query = first;
+        slot->args.buffer = slot->buffer;
+        slot->args.count = count;
+        slot->args.flags = batch_flags;
+        for (uint32_t c = 0; c < pipeline->nr_query_copies; c++)
+        {
+            memcpy(slot->queries[c], &queries[first], count * sizeof(EncodedPoint));
+        }
+        slot->queued_at = timing_now();
+
+        // Queue push, launch, pull and merge; each rank runs its queue on its own, so a rank
+        // can already execute this batch while others are still receiving or returning earlier ones
+        if (pipeline->nr_query_copies > 1)
+        {
+            DPU_FOREACH(dpu_set, dpu, dpu_index)
+            {
+                DPU_ASSERT(dpu_prepare_xfer(dpu, slot->queries[pipeline->rank_of_dpu[dpu_index]]));
+            }
+            DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_QUERIES", slot->buffer * QUERY_BATCH_SIZE * sizeof(EncodedPoint),
+                                     count * sizeof(EncodedPoint), DPU_XFER_ASYNC));
+        }
+        else
+        {
+            DPU_ASSERT(dpu_broadcast_to(dpu_set, "DPU_QUERIES", slot->buffer * QUERY_BATCH_SIZE * sizeof(EncodedPoint),
+                                        slot->queries[0], count * sizeof(EncodedPoint), DPU_XFER_ASYNC));
+        }
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, "DPU_BATCH_ARGS", 0, &slot->args, sizeof(BatchArgs), DPU_XFER_ASYNC));
+        DPU_ASSERT(dpu_callback(dpu_set, stamp_stage, &slot->marks[STAGE_PUSHED], DPU_CALLBACK_ASYNC));
+        DPU_ASSERT(dpu_launch(dpu_set, DPU_ASYNCHRONOUS));
+        DPU_ASSERT(dpu_callback(dpu_set, stamp_stage, &slot->marks[STAGE_EXECUTED], DPU_CALLBACK_ASYNC));
+        DPU_FOREACH(dpu_set, dpu, dpu_index)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &slot->results[dpu_index * QUERY_BATCH_SIZE]));
+        }
+        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, "DPU_RESULTS", slot->buffer * QUERY_BATCH_SIZE * sizeof(uint64_t),
+                                 count * sizeof(uint64_t), DPU_XFER_ASYNC));
+        if (kernel_stats != NULL)
+        {
+            DPU_FOREACH(dpu_set, dpu, dpu_index)
+            {
+                DPU_ASSERT(dpu_prepare_xfer(dpu, &slot->counters[dpu_index * NR_TASKLETS]));
+            }
+            DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, "DPU_STATS", 0, NR_TASKLETS * sizeof(TaskletStats), DPU_XFER_ASYNC));
+        }
+        DPU_ASSERT(dpu_callback(dpu_set, stamp_stage, &slot->marks[STAGE_PULLED], DPU_CALLBACK_ASYNC));
+        // Once per rank, each on its own thread, as soon as that rank's results are back
+        DPU_ASSERT(dpu_callback(dpu_set, merge_batch_results, slot, DPU_CALLBACK_ASYNC));
+
+        stats->queue_time += timing_now() - queue_start;
+        stats->num_batches++;
+    }
+    DPU_ASSERT(dpu_sync(dpu_set));
+    stats->total_time = timing_now() - start;
+    stats->transfer_in_time = pipeline->transfer_in_time;
+    stats->launch_time = pipeline->launch_time;
+    stats->transfer_out_time = pipeline->transfer_out_time;
+    stats->merge_time = pipeline->merge_time;
+
+    for (uint32_t b = 0; b < NR_QUERY_BUFFERS; b++)
+    {
+        numa_free(pipeline->slots[b].results, (size_t)nr_dpus * QUERY_BATCH_SIZE * sizeof(uint64_t));
+        free(pipeline->slots[b].rank_found);
+        free(pipeline->slots[b].counters);
+        for (uint32_t c = 0; c < pipeline->nr_query_copies; c++)
+            numa_free(pipeline->slots[b].queries[c], QUERY_BATCH_SIZE * sizeof(EncodedPoint));
+        free(pipeline->slots[b].queries);
+    }
+    free(pipeline->rank_of_dpu);
+    rank_set_free(&pipeline->ranks);
+    pthread_cond_destroy(&pipeline->slot_free);
+    pthread_mutex_destroy(&pipeline->lock);
+    free(pipeline);
+}
@@ -0,0 +1,30 @@
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include <dpu.h>
+#include <stdint.h>
+#include "common.h"
+#include "kernelstats.h"
+
+/* Wall-clock breakdown of one pipelined run over a query set */
+typedef struct PipelineStats
+{
+    int num_batches;
+    double total_time;        // First batch queued to last batch merged
+    double queue_time;        // Host filling query buffers and queuing transfers/launches
+    double wait_time;         // Host blocked on a query/result buffer that was still in flight
+    double transfer_in_time;  // Rank queues pushing queries and launch arguments
+    double launch_time;       // Rank queues running the kernel
+    double transfer_out_time; // Rank queues pulling results
+    double merge_time;        // Host merging per-DPU results (runs in the SDK callback thread)
+} PipelineStats;
+
+// Run num_queries queries over every DPU of the set in QUERY_BATCH_SIZE batches,
+// overlapping host transfers of one batch with the execution of the others.
+// Queries are in the encoding of the resident trees, batch_flags are BATCH_* kernel options.
+// found[q] is set to 1 when any DPU reports query q. When kernel_stats is not NULL the
+// tasklet counters of every launch are pulled with the results and added to it.
+void run_query_pipeline(struct dpu_set_t dpu_set, uint32_t nr_dpus, EncodedPoint *queries, int num_queries, uint32_t batch_flags,
+                        uint8_t *found, PipelineStats *stats, KernelStats *kernel_stats);
+
+#endif /* __PIPELINE_H__ */
@@ -0,0 +1,212 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "quantize.h"
+
+_Static_assert(sizeof(QuantizedNode) == sizeof(SerializedNode), "quantized nodes must keep the MRAM node stride");
+_Static_assert(sizeof(RelNode) % sizeof(uint64_t) == 0, "relative node entries must start 8-byte aligned");
+
+// Function to map one coordinate, false when the offset is not an exact uint32 below QCOORD_NONE
+static bool quantize_coordinate(float value, float origin, uint32_t *q)
+{
+    double offset = (double)value - (double)origin;
+    if (value != floorf(value) || offset < 0 || offset >= (double)QCOORD_NONE)
+        return false;
+    *q = (uint32_t)offset;
+    return true;
+}
+
+// Function to map a node MBR. Node MBRs are unions of stored points, so they quantize exactly;
+// an empty one becomes {QCOORD_NONE, QCOORD_NONE, 0, 0}, which no query falls in.
+static void quantize_mbr(const Quantizer *quantizer, const MBR *mbr, QMBR *q)
+{
+    if (mbr->xmin > mbr->xmax ||
+        !quantize_coordinate(mbr->xmin, quantizer->origin_x, &q->xmin) ||
+        !quantize_coordinate(mbr->ymin, quantizer->origin_y, &q->ymin) ||
+        !quantize_coordinate(mbr->xmax, quantizer->origin_x, &q->xmax) ||
+        !quantize_coordinate(mbr->ymax, quantizer->origin_y, &q->ymax))
+    {
+        q->xmin = q->ymin = QCOORD_NONE;
+        q->xmax = q->ymax = 0;
+    }
+}
+
+bool quantizer_init(Quantizer *quantizer, Point *points, int num_points)
+{
+    quantizer->origin_x = 0;
+    quantizer->origin_y = 0;
+    if (num_points <= 0)
+        return false;
+
+    quantizer->origin_x = points[0].x;
+    quantizer->origin_y = points[0].y;
+    for (int i = 1; i < num_points; i++)
+    {
+        if (points[i].x < quantizer->origin_x)
+            quantizer->origin_x = points[i].x;
+        if (points[i].y < quantizer->origin_y)
+            quantizer->origin_y = points[i].y;
+    }
+
+    uint32_t q;
+    for (int i = 0; i < num_points; i++)
+    {
+        if (!quantize_coordinate(points[i].x, quantizer->origin_x, &q) || !quantize_coordinate(points[i].y, quantizer->origin_y, &q))
+            return false;
+    }
+    return true;
+}
+
+void quantize_tree(const Quantizer *quantizer, SerializedNode *tree, int num_nodes)
+{
+    for (int n = 0; n < num_nodes; n++)
+    {
+        SerializedNode *node = &tree[n];
+        QuantizedNode quantized;
+        memset(&quantized, 0, sizeof(QuantizedNode));
+        quantized.isLeaf = node->isLeaf;
+        quantized.count = node->count;
+        quantize_mbr(quantizer, &node->mbr, &quantized.mbr);
+
+        if (node->isLeaf)
+        {
+            for (int i = 0; i < node->count; i++)
+            {
+                quantize_coordinate(node->points[i].x, quantizer->origin_x, &quantized.points[i].x);
+                quantize_coordinate(node->points[i].y, quantizer->origin_y, &quantized.points[i].y);
+            }
+        }
+        else
+        {
+            memcpy(quantized.children, node->children, sizeof(quantized.children));
+        }
+        memcpy(node, &quantized, sizeof(QuantizedNode));
+    }
+}
+
+// Function to tell whether a quantized leaf needs full-width points
+static bool is_wide_leaf(const QMBR *mbr)
+{
+    return mbr->xmin <= mbr->xmax && (mbr->xmax - mbr->xmin > REL_MAX_OFFSET || mbr->ymax - mbr->ymin > REL_MAX_OFFSET);
+}
+
+// Function to compute the size of one RelNode and its entries, in 8-byte words
+static uint32_t relative_node_words(const SerializedNode *node, const QMBR *mbr)
+{
+    size_t entry_size = node->isLeaf && is_wide_leaf(mbr) ? sizeof(QPoint) : sizeof(uint32_t);
+    size_t bytes = sizeof(RelNode) + (size_t)node->count * entry_size;
+    return (uint32_t)((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+}
+
+size_t pack_relative_tree(const Quantizer *quantizer, const SerializedNode *tree, int num_nodes, uint64_t **image, int *wide_leaves)
+{
+    *image = NULL;
+    *wide_leaves = 0;
+    QMBR *mbrs = (QMBR *)malloc((num_nodes > 0 ? num_nodes : 1) * sizeof(QMBR));
+    uint32_t *offsets = (uint32_t *)malloc((num_nodes > 0 ? num_nodes : 1) * sizeof(uint32_t));
+    if (mbrs == NULL || offsets == NULL)
+    {
+        free(mbrs);
+        free(offsets);
+        return 0;
+    }
+
+    // First pass: place every node so children can be referenced by offset
+    uint32_t words = 0;
+    for (int n = 0; n < num_nodes; n++)
+    {
+        quantize_mbr(quantizer, &tree[n].mbr, &mbrs[n]);
+        offsets[n] = words;
+        words += relative_node_words(&tree[n], &mbrs[n]);
+    }
+
+    *image = (uint64_t *)calloc(words > 0 ? words : 1, sizeof(uint64_t));
+    if (*image == NULL)
+    {
+        free(mbrs);
+        free(offsets);
+        return 0;
+    }
+
+    for (int n = 0; n < num_nodes; n++)
+    {
+        const SerializedNode *node = &tree[n];
+        RelNode *rel = (RelNode *)(*image + offsets[n]);
+        rel->flags = node->isLeaf ? REL_LEAF : 0;
+        rel->count = (uint32_t)node->count;
+        rel->mbr = mbrs[n];
+
+        if (!node->isLeaf)
+        {
+            uint32_t *children = (uint32_t *)(rel + 1);
+            for (int i = 0; i < node->count; i++)
+                children[i] = offsets[node->children[i]];
+        }
+        else if (is_wide_leaf(&rel->mbr))
+        {
+            rel->flags |= REL_WIDE;
+            (*wide_leaves)++;
+            QPoint *points = (QPoint *)(rel + 1);
+            for (int i = 0; i < node->count; i++)
+            {
+                quantize_coordinate(node->points[i].x, quantizer->origin_x, &points[i].x);
+                quantize_coordinate(node->points[i].y, quantizer->origin_y, &points[i].y);
+            }
+        }
+        else
+        {
+            uint32_t *points = (uint32_t *)(rel + 1);
+            for (int i = 0; i < node->count; i++)
+            {
+                QPoint p;
+                quantize_coordinate(node->points[i].x, quantizer->origin_x, &p.x);
+                quantize_coordinate(node->points[i].y, quantizer->origin_y, &p.y);
+                points[i] = REL_PACK(p.x - rel->mbr.xmin, p.y - rel->mbr.ymin);
+            }
+        }
+    }
+
+    free(mbrs);
+    free(offsets);
+    return (size_t)words * sizeof(uint64_t);
+}
+
+int encode_queries(uint32_t encoding, const Quantizer *quantizer, const Point *queries, EncodedPoint *encoded, int num_queries)
+{
+    int unmatchable = 0;
+    for (int q = 0; q < num_queries; q++)
+    {
+        if (encoding != TREE_ENCODING_U32 && encoding != TREE_ENCODING_REL16)
+        {
+            encoded[q].f = queries[q];
+            continue;
+        }
+        // A query off the integer grid or outside the data set cannot equal a stored point
+        if (!quantize_coordinate(queries[q].x, quantizer->origin_x, &encoded[q].q.x) ||
+            !quantize_coordinate(queries[q].y, quantizer->origin_y, &encoded[q].q.y))
+        {
+            encoded[q].q.x = QCOORD_NONE;
+            encoded[q].q.y = QCOORD_NONE;
+            unmatchable++;
+        }
+    }
+    return unmatchable;
+}
+
+const char *encoding_name(uint32_t encoding)
+{
+    switch (encoding)
+    {
+    case TREE_ENCODING_U32:
+        return "u32";
+    case TREE_ENCODING_REL16:
+        return "rel16";
+    case TREE_ENCODING_LEAVES:
+        return "leaves";
+    default:
+        return "float";
+    }
+}
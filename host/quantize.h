@@ -0,0 +1,33 @@
+#ifndef __QUANTIZE_H__
+#define __QUANTIZE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+/* Mapping between float coordinates and the uint32 offsets of TREE_ENCODING_U32 and TREE_ENCODING_REL16 */
+typedef struct Quantizer
+{
+    float origin_x, origin_y; // Lower-left corner of the data set, offset 0
+} Quantizer;
+
+// Set up a lossless mapping for a data set. False unless every coordinate is integral and
+// its offset from the origin fits below QCOORD_NONE, in which case the tree must stay float.
+bool quantizer_init(Quantizer *quantizer, Point *points, int num_points);
+
+// Rewrite a serialized tree in place as QuantizedNode entries
+void quantize_tree(const Quantizer *quantizer, SerializedNode *tree, int num_nodes);
+
+// Pack a float serialized tree into a TREE_ENCODING_REL16 stream, nodes in the same preorder.
+// *image is allocated by the function; returns its size in bytes (a multiple of 8), 0 when out of memory.
+// wide_leaves receives the number of leaves whose extent needed full-width points.
+size_t pack_relative_tree(const Quantizer *quantizer, const SerializedNode *tree, int num_nodes, uint64_t **image, int *wide_leaves);
+
+// Encode queries for a tree of the given encoding (quantizer is only used for TREE_ENCODING_U32 and TREE_ENCODING_REL16).
+// Returns the number of queries that cannot equal any stored point and were sent as QCOORD_NONE.
+int encode_queries(uint32_t encoding, const Quantizer *quantizer, const Point *queries, EncodedPoint *encoded, int num_queries);
+
+const char *encoding_name(uint32_t encoding);
+
+#endif /* __QUANTIZE_H__ */
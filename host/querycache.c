@@ -0,0 +1,259 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "querycache.h"
+
+enum
+{
+    CACHE_EMPTY,
+    CACHE_PENDING, // Reserved by a miss, the DPU answer is not back yet
+    CACHE_VALID
+};
+
+// Outcome of a lookup
+enum
+{
+    CACHE_MISS,
+    CACHE_HIT,
+    CACHE_COALESCED
+};
+
+// Function to build the key of a point from the bits of its coordinates
+static uint64_t point_key(Point p)
+{
+    uint32_t x, y;
+    memcpy(&x, &p.x, sizeof(uint32_t));
+    memcpy(&y, &p.y, sizeof(uint32_t));
+    return ((uint64_t)x << 32) | y;
+}
+
+static uint64_t hash_key(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+static QueryCacheShard *shard_of(QueryCache *cache, uint64_t hash)
+{
+    return &cache->shards[hash % QUERY_CACHE_SHARDS];
+}
+
+static int32_t *bucket_of(QueryCacheShard *shard, uint64_t hash)
+{
+    return &shard->buckets[(hash / QUERY_CACHE_SHARDS) % shard->capacity];
+}
+
+// Function to find the entry of a key, -1 if it is not cached. Called with the shard lock held.
+static int32_t find_locked(QueryCacheShard *shard, uint64_t key, uint64_t hash)
+{
+    for (int32_t e = *bucket_of(shard, hash); e != -1; e = shard->entries[e].next)
+    {
+        if (shard->entries[e].key == key)
+            return e;
+    }
+    return -1;
+}
+
+// Function to take an entry out of its bucket chain. Called with the shard lock held.
+static void unlink_locked(QueryCacheShard *shard, int32_t entry)
+{
+    int32_t *link = bucket_of(shard, hash_key(shard->entries[entry].key));
+    while (*link != entry)
+        link = &shard->entries[*link].next;
+    *link = shard->entries[entry].next;
+    shard->entries[entry].state = CACHE_EMPTY;
+}
+
+// Function to get a free entry: unused ones first, then the next one CLOCK finds unreferenced
+static int32_t allocate_locked(QueryCacheShard *shard)
+{
+    if (shard->used < shard->capacity)
+        return (int32_t)shard->used++;
+
+    while (shard->entries[shard->hand].referenced)
+    {
+        shard->entries[shard->hand].referenced = 0;
+        shard->hand = (shard->hand + 1) % shard->capacity;
+    }
+    int32_t victim = (int32_t)shard->hand;
+    shard->hand = (shard->hand + 1) % shard->capacity;
+    if (shard->entries[victim].state != CACHE_EMPTY)
+    {
+        unlink_locked(shard, victim);
+        shard->stats.evictions++;
+    }
+    return victim;
+}
+
+// Function to add a key at the head of its chain. Called with the shard lock held.
+static int32_t insert_locked(QueryCacheShard *shard, uint64_t key, uint64_t hash)
+{
+    int32_t entry = allocate_locked(shard);
+    int32_t *bucket = bucket_of(shard, hash);
+    shard->entries[entry].key = key;
+    shard->entries[entry].next = *bucket;
+    shard->entries[entry].referenced = 1;
+    *bucket = entry;
+    return entry;
+}
+
+// Function to look up a point, reserving a pending entry for owner on a miss
+static int lookup(QueryCache *cache, Point p, int owner, uint8_t *found, int *pending_owner)
+{
+    uint64_t key = point_key(p);
+    uint64_t hash = hash_key(key);
+    QueryCacheShard *shard = shard_of(cache, hash);
+    int outcome = CACHE_MISS;
+
+    pthread_mutex_lock(&shard->lock);
+    shard->stats.lookups++;
+    int32_t entry = find_locked(shard, key, hash);
+    if (entry != -1)
+    {
+        QueryCacheEntry *e = &shard->entries[entry];
+        e->referenced = 1;
+        if (e->state == CACHE_VALID)
+        {
+            *found = e->found;
+            outcome = CACHE_HIT;
+            shard->stats.hits++;
+        }
+        else
+        {
+            *pending_owner = e->owner;
+            outcome = CACHE_COALESCED;
+            shard->stats.coalesced++;
+        }
+    }
+    else
+    {
+        entry = insert_locked(shard, key, hash);
+        shard->entries[entry].state = CACHE_PENDING;
+        shard->entries[entry].owner = owner;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return outcome;
+}
+
+// Function to store the answer for a point, re-inserting it if its pending entry was evicted meanwhile
+static void fill(QueryCache *cache, Point p, uint8_t found)
+{
+    uint64_t key = point_key(p);
+    uint64_t hash = hash_key(key);
+    QueryCacheShard *shard = shard_of(cache, hash);
+
+    pthread_mutex_lock(&shard->lock);
+    int32_t entry = find_locked(shard, key, hash);
+    if (entry == -1)
+        entry = insert_locked(shard, key, hash);
+    shard->entries[entry].state = CACHE_VALID;
+    shard->entries[entry].found = found;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void query_cache_init(QueryCache *cache, uint32_t capacity)
+{
+    uint32_t per_shard = (capacity + QUERY_CACHE_SHARDS - 1) / QUERY_CACHE_SHARDS;
+    if (per_shard == 0)
+        per_shard = 1;
+    cache->capacity = per_shard * QUERY_CACHE_SHARDS;
+
+    for (int s = 0; s < QUERY_CACHE_SHARDS; s++)
+    {
+        QueryCacheShard *shard = &cache->shards[s];
+        memset(shard, 0, sizeof(QueryCacheShard));
+        shard->capacity = per_shard;
+        shard->entries = (QueryCacheEntry *)calloc(per_shard, sizeof(QueryCacheEntry));
+        shard->buckets = (int32_t *)malloc(per_shard * sizeof(int32_t));
+        if (shard->entries == NULL || shard->buckets == NULL)
+        {
+            perror("Failed to allocate query cache");
+            exit(1);
+        }
+        memset(shard->buckets, 0xff, per_shard * sizeof(int32_t));
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+}
+
+void query_cache_destroy(QueryCache *cache)
+{
+    for (int s = 0; s < QUERY_CACHE_SHARDS; s++)
+    {
+        pthread_mutex_destroy(&cache->shards[s].lock);
+        free(cache->shards[s].entries);
+        free(cache->shards[s].buckets);
+    }
+}
+
+int query_cache_prepare(QueryCache *cache, const Point *queries, int num_queries, uint8_t *found, int *link, int *misses)
+{
+    int num_misses = 0;
+    for (int q = 0; q < num_queries; q++)
+    {
+        int owner = q;
+        switch (lookup(cache, queries[q], q, &found[q], &owner))
+        {
+        case CACHE_HIT:
+            link[q] = -1;
+            break;
+        case CACHE_COALESCED:
+            link[q] = owner;
+            break;
+        default:
+            link[q] = q;
+            misses[num_misses++] = q;
+            break;
+        }
+    }
+    return num_misses;
+}
+
+void query_cache_complete(QueryCache *cache, const Point *queries, int num_queries, uint8_t *found, const int *link,
+                          const int *misses, int num_misses)
+{
+    for (int m = 0; m < num_misses; m++)
+        fill(cache, queries[misses[m]], found[misses[m]]);
+    for (int q = 0; q < num_queries; q++)
+    {
+        if (link[q] != -1 && link[q] != q)
+            found[q] = found[link[q]];
+    }
+}
+
+void query_cache_invalidate(QueryCache *cache, Point p)
+{
+    uint64_t key = point_key(p);
+    uint64_t hash = hash_key(key);
+    QueryCacheShard *shard = shard_of(cache, hash);
+
+    pthread_mutex_lock(&shard->lock);
+    int32_t entry = find_locked(shard, key, hash);
+    if (entry != -1)
+    {
+        unlink_locked(shard, entry);
+        shard->stats.invalidations++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+QueryCacheStats query_cache_stats(QueryCache *cache)
+{
+    QueryCacheStats total;
+    memset(&total, 0, sizeof(QueryCacheStats));
+    for (int s = 0; s < QUERY_CACHE_SHARDS; s++)
+    {
+        QueryCacheShard *shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        total.lookups += shard->stats.lookups;
+        total.hits += shard->stats.hits;
+        total.coalesced += shard->stats.coalesced;
+        total.evictions += shard->stats.evictions;
+        total.invalidations += shard->stats.invalidations;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return total;
+}
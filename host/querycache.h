@@ -0,0 +1,68 @@
+#ifndef __QUERYCACHE_H__
+#define __QUERYCACHE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include "common.h"
+
+#define QUERY_CACHE_SHARDS 16 // Independently locked parts of the cache, picked by key hash
+
+/* Counters of a cache since it was created */
+typedef struct QueryCacheStats
+{
+    uint64_t lookups;       // Queries checked against the cache
+    uint64_t hits;          // Answered from a cached result
+    uint64_t coalesced;     // Repeats of a query whose answer was still on its way from the DPUs
+    uint64_t evictions;     // Entries dropped by CLOCK to make room
+    uint64_t invalidations; // Entries dropped because an update touched their point
+} QueryCacheStats;
+
+typedef struct QueryCacheEntry
+{
+    uint64_t key;       // Bits of x and y
+    int32_t next;       // Next entry of the bucket chain, -1 at the end
+    int32_t owner;      // Pending entries: query the answer will come back for
+    uint8_t state;      // CACHE_EMPTY, CACHE_PENDING or CACHE_VALID
+    uint8_t referenced; // CLOCK bit, set on every access
+    uint8_t found;
+} QueryCacheEntry;
+
+typedef struct QueryCacheShard
+{
+    pthread_mutex_t lock;
+    QueryCacheEntry *entries;
+    int32_t *buckets; // Head of each chain, -1 when empty
+    uint32_t capacity;
+    uint32_t used; // Entries handed out so far; after that CLOCK recycles them
+    uint32_t hand;
+    QueryCacheStats stats;
+} QueryCacheShard;
+
+/* Results of recent point queries, keyed on the exact bits of the coordinates. It sits in front
+ * of the DPU dispatch: hits never leave the host and repeats within one dispatch are sent once. */
+typedef struct QueryCache
+{
+    QueryCacheShard shards[QUERY_CACHE_SHARDS];
+    uint32_t capacity;
+} QueryCache;
+
+// Create a cache of about capacity entries (at least one per shard)
+void query_cache_init(QueryCache *cache, uint32_t capacity);
+void query_cache_destroy(QueryCache *cache);
+
+// Answer what the cache can of a query set. found[q] is set for hits. Every other query is either
+// a miss, listed in misses[] (returns their number), or a repeat of a miss: link[q] is the query
+// whose answer q takes, q itself for a miss and -1 for a hit.
+int query_cache_prepare(QueryCache *cache, const Point *queries, int num_queries, uint8_t *found, int *link, int *misses);
+
+// Store the answers of the misses (found[misses[m]] must be set) and copy them to their repeats
+void query_cache_complete(QueryCache *cache, const Point *queries, int num_queries, uint8_t *found, const int *link,
+                          const int *misses, int num_misses);
+
+// Drop the cached answer for p, called for every insert or delete of p
+void query_cache_invalidate(QueryCache *cache, Point p);
+
+// Sum of the shard counters
+QueryCacheStats query_cache_stats(QueryCache *cache);
+
+#endif /* __QUERYCACHE_H__ */
@@ -0,0 +1,108 @@
+#include <dpu.h>
+#include <dpu_management.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "numa.h"
+#include "ranks.h"
+
+/* Arguments of one rank's host thread */
+typedef struct RankJob
+{
+    RankWork work;
+    void *arg;
+    const RankRange *rank;
+} RankJob;
+
+void rank_set_init(RankSet *set, struct dpu_set_t dpu_set, uint32_t nr_dpus, bool threaded)
+{
+    struct dpu_set_t rank, dpu;
+    uint32_t each_rank;
+    uint32_t nr_ranks = 0;
+    DPU_RANK_FOREACH(dpu_set, rank)
+    {
+        nr_ranks++;
+    }
+
+    set->threaded = threaded;
+    set->nr_ranks = 0;
+    set->ranks = (RankRange *)calloc(nr_ranks > 0 ? nr_ranks : 1, sizeof(RankRange));
+    if (set->ranks == NULL)
+    {
+        perror("Failed to allocate rank table");
+        exit(1);
+    }
+
+    // DPU_FOREACH walks the set rank by rank, so each rank owns the next run of flat indices
+    uint32_t dpu_index = 0;
+    DPU_RANK_FOREACH(dpu_set, rank, each_rank)
+    {
+        RankRange *range = &set->ranks[each_rank];
+        range->rank = rank;
+        range->first_dpu = dpu_index;
+        DPU_FOREACH(rank, dpu)
+        {
+            if (dpu_index < nr_dpus)
+                dpu_index++;
+        }
+        range->nr_dpus = dpu_index - range->first_dpu;
+        // The node follows the rank's own id: the set need not hold the machine's first ranks
+        range->numa_node = -1;
+        if (numa_placement && rank.list.nr_ranks > 0)
+        {
+            range->numa_node = numa_rank_node(dpu_get_rank_id(rank.list.ranks[0]));
+            if (range->numa_node < 0)
+                printf("NUMA node of rank %u unknown, its thread and buffers are not placed\n", each_rank);
+        }
+        set->nr_ranks++;
+    }
+}
+
+void rank_set_free(RankSet *set)
+{
+    free(set->ranks);
+}
+
+static void *rank_main(void *arg)
+{
+    RankJob *job = (RankJob *)arg;
+    numa_pin_thread(job->rank->numa_node);
+    job->work(job->arg, job->rank);
+    return NULL;
+}
+
+void rank_set_run(const RankSet *set, RankWork work, void *arg)
+{
+    if (!set->threaded || set->nr_ranks < 2)
+    {
+        for (uint32_t r = 0; r < set->nr_ranks; r++)
+        {
+            if (set->ranks[r].nr_dpus > 0)
+                work(arg, &set->ranks[r]);
+        }
+        return;
+    }
+
+    pthread_t *threads = (pthread_t *)malloc(set->nr_ranks * sizeof(pthread_t));
+    RankJob *jobs = (RankJob *)malloc(set->nr_ranks * sizeof(RankJob));
+    if (threads == NULL || jobs == NULL)
+    {
+        perror("Failed to allocate rank threads");
+        exit(1);
+    }
+    uint32_t started = 0;
+    for (uint32_t r = 0; r < set->nr_ranks; r++)
+    {
+        if (set->ranks[r].nr_dpus == 0)
+            continue;
+        jobs[started].work = work;
+        jobs[started].arg = arg;
+        jobs[started].rank = &set->ranks[r];
+        pthread_create(&threads[started], NULL, rank_main, &jobs[started]);
+        started++;
+    }
+    for (uint32_t t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    free(jobs);
+    free(threads);
+}
@@ -0,0 +1,38 @@
+#ifndef __RANKS_H__
+#define __RANKS_H__
+
+#include <dpu.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* DPUs of one rank: a contiguous range of the flat DPU_FOREACH index */
+typedef struct RankRange
+{
+    struct dpu_set_t rank;
+    uint32_t first_dpu; // Flat index of the rank's first DPU
+    uint32_t nr_dpus;
+    int numa_node; // Node the rank is attached to with numa_placement on, otherwise -1
+} RankRange;
+
+/* Ranks of a DPU set in DPU_RANK_FOREACH order, so entry i is the rank a callback gets as rank_id i */
+typedef struct RankSet
+{
+    uint32_t nr_ranks;
+    RankRange *ranks;
+    bool threaded; // One host thread per rank, otherwise the work runs rank after rank on the caller
+} RankSet;
+
+// Split the first nr_dpus DPUs of the set by rank. With numa_placement the ranks get the nodes the
+// driver reports for their rank ids.
+void rank_set_init(RankSet *set, struct dpu_set_t dpu_set, uint32_t nr_dpus, bool threaded);
+void rank_set_free(RankSet *set);
+
+// Work on the DPUs of one rank. Runs concurrently with the other ranks, which the SDK allows since
+// every rank has its own queue; anything shared with them needs its own synchronization.
+typedef void (*RankWork)(void *arg, const RankRange *rank);
+
+// Run work once per rank holding any of the DPUs and return when all of them are done. Threads of
+// ranks with a known node are pinned to its CPUs, so what they allocate and fill stays local.
+void rank_set_run(const RankSet *set, RankWork work, void *arg);
+
+#endif /* __RANKS_H__ */
@@ -0,0 +1,250 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "repartition.h"
+#include "timing.h"
+
+void repartition_init(Repartitioner *rp, Node *root, uint32_t nr_dpus, Point *points, int num_points, double threshold)
+{
+    memset(rp, 0, sizeof(Repartitioner));
+    rp->points = points;
+    rp->num_points = num_points;
+    rp->num_partitions = root->isLeaf ? 1 : root->count;
+    // Partition p lives on DPU p, and the per-DPU arrays of the session only have nr_dpus entries
+    if ((uint32_t)rp->num_partitions > nr_dpus)
+    {
+        printf(ANSI_COLOR_RED "Cannot repartition %d partitions over %u DPUs" ANSI_COLOR_RESET "\n", rp->num_partitions, nr_dpus);
+        exit(1);
+    }
+    rp->threshold = threshold;
+    rp->bounds = (int *)zalloc(rp->num_partitions + 1, sizeof(int));
+    rp->next_bounds = (int *)zalloc(rp->num_partitions + 1, sizeof(int));
+    rp->changed = (bool *)zalloc(rp->num_partitions, sizeof(bool));
+    rp->mbrs = (MBR *)zalloc(rp->num_partitions, sizeof(MBR));
+    rp->queries = (uint64_t *)zalloc(rp->num_partitions, sizeof(uint64_t));
+    rp->cycles = (uint64_t *)zalloc(rp->num_partitions, sizeof(uint64_t));
+    pthread_mutex_init(&rp->lock, NULL);
+
+    // createRTree hands each child of the root a contiguous run of the sorted points
+    for (int p = 0; p < rp->num_partitions; p++)
+    {
+        Node *partition = getPartition(root, p);
+        rp->bounds[p + 1] = rp->bounds[p] + countPointsInSubtree(partition);
+        rp->mbrs[p] = partition->mbr;
+    }
+}
+
+// Function to join the builder and free the layout it built
+static void free_next_layout(Repartitioner *rp)
+{
+    pthread_join(rp->builder, NULL);
+    rp->building = false;
+    for (int p = 0; p < rp->num_partitions; p++)
+        free(rp->next_partitions[p].serialized);
+    free(rp->next_partitions);
+    rp->next_partitions = NULL;
+    freeRTree(rp->next_root);
+    rp->next_root = NULL;
+}
+
+void repartition_destroy(Repartitioner *rp)
+{
+    if (rp->building)
+        free_next_layout(rp);
+    pthread_mutex_destroy(&rp->lock);
+    free(rp->cycles);
+    free(rp->queries);
+    free(rp->mbrs);
+    free(rp->changed);
+    free(rp->next_bounds);
+    free(rp->bounds);
+}
+
+// Function to get the ratio of the largest to the mean of n loads, 1.0 when they are all zero
+static double max_over_mean(const uint64_t *load, int n, uint64_t total)
+{
+    uint64_t max = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (load[i] > max)
+            max = load[i];
+    }
+    return total ? (double)max * n / total : 1.0;
+}
+
+double repartition_observe(Repartitioner *rp, const Point *queries, int num_queries, const uint64_t *dpu_cycles)
+{
+    for (int q = 0; q < num_queries; q++)
+    {
+        for (int p = 0; p < rp->num_partitions; p++)
+        {
+            if (isPointInMBR(&rp->mbrs[p], queries[q]))
+                rp->queries[p]++;
+        }
+    }
+    uint64_t total = 0;
+    for (int p = 0; p < rp->num_partitions; p++)
+    {
+        rp->cycles[p] += dpu_cycles[p];
+        total += dpu_cycles[p];
+    }
+    return max_over_mean(dpu_cycles, rp->num_partitions, total);
+}
+
+// Function to pick the load the layout is balanced on: cycles, or query counts when there are none
+static const uint64_t *observed_load(const Repartitioner *rp, uint64_t *total)
+{
+    const uint64_t *load = rp->cycles;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        *total = 0;
+        for (int p = 0; p < rp->num_partitions; p++)
+            *total += load[p];
+        if (*total > 0)
+            break;
+        load = rp->queries;
+    }
+    return load;
+}
+
+double repartition_imbalance(const Repartitioner *rp)
+{
+    uint64_t total;
+    const uint64_t *load = observed_load(rp, &total);
+    return max_over_mean(load, rp->num_partitions, total);
+}
+
+// Function to cut the sorted points into partitions of equal weight. Every point of partition p weighs
+// a uniform share plus its part of p's load, so hot partitions shrink and cold ones grow.
+static void weighted_bounds(const Repartitioner *rp, const uint64_t *load, uint64_t total, int *bounds)
+{
+    int n = rp->num_points;
+    int parts = rp->num_partitions;
+    double covered = 0.0; // Weight of the partitions before p, the total weight being 1
+    int cut = 1;
+    bounds[0] = 0;
+    for (int p = 0; p < parts && cut < parts; p++)
+    {
+        int size = rp->bounds[p + 1] - rp->bounds[p];
+        if (size == 0)
+            continue;
+        double weight = REPARTITION_UNIFORM_SHARE / n + (1.0 - REPARTITION_UNIFORM_SHARE) * load[p] / ((double)total * size);
+        while (cut < parts && covered + weight * size >= (double)cut / parts)
+        {
+            int at = rp->bounds[p] + (int)(((double)cut / parts - covered) / weight + 0.5);
+            // Keep at least one point on each side of every cut
+            if (at < bounds[cut - 1] + 1)
+                at = bounds[cut - 1] + 1;
+            if (at > n - (parts - cut))
+                at = n - (parts - cut);
+            bounds[cut++] = at;
+        }
+        covered += weight * size;
+    }
+    for (; cut < parts; cut++)
+        bounds[cut] = n - (parts - cut);
+    bounds[parts] = n;
+
+    // A cut that would barely move stays where it is, sparing both of its partitions a migration
+    int tolerance = n / parts / REPARTITION_SHIFT_DIVISOR;
+    for (cut = 1; cut < parts; cut++)
+    {
+        int old = rp->bounds[cut];
+        if (abs(bounds[cut] - old) <= tolerance && old > bounds[cut - 1] && old < bounds[cut + 1])
+            bounds[cut] = old;
+    }
+}
+
+// Builder thread: bulk load the new layout and serialize its changed partitions
+static void *builder_main(void *arg)
+{
+    Repartitioner *rp = (Repartitioner *)arg;
+    Node *root = createRTreeWithBounds(rp->points, rp->next_bounds, rp->num_partitions);
+    Partition *partitions = (Partition *)zalloc(rp->num_partitions, sizeof(Partition));
+    for (int p = 0; p < rp->num_partitions; p++)
+    {
+        if (!rp->changed[p])
+            continue;
+        Node *partition = getPartition(root, p);
+        partitions[p].num_nodes = serialize_rtree_wrapper(partition, &partitions[p].serialized, countNodesInSubtree(partition));
+    }
+
+    pthread_mutex_lock(&rp->lock);
+    rp->next_root = root;
+    rp->next_partitions = partitions;
+    rp->stats.build_time += timing_now() - rp->build_start;
+    rp->ready = true;
+    pthread_mutex_unlock(&rp->lock);
+    return NULL;
+}
+
+bool repartition_start(Repartitioner *rp)
+{
+    if (rp->building || rp->num_partitions < 2 || repartition_imbalance(rp) <= rp->threshold)
+        return false;
+
+    uint64_t total;
+    const uint64_t *load = observed_load(rp, &total);
+    weighted_bounds(rp, load, total, rp->next_bounds);
+    int changed = 0;
+    for (int p = 0; p < rp->num_partitions; p++)
+    {
+        rp->changed[p] = rp->next_bounds[p] != rp->bounds[p] || rp->next_bounds[p + 1] != rp->bounds[p + 1];
+        changed += rp->changed[p];
+    }
+    if (changed == 0)
+        return false;
+
+    // Building only reads the points and next_bounds, which stay put until the swap
+    rp->ready = false;
+    rp->building = true;
+    rp->build_start = timing_now();
+    rp->stats.rebuilds++;
+    pthread_create(&rp->builder, NULL, builder_main, rp);
+    return true;
+}
+
+bool repartition_ready(Repartitioner *rp)
+{
+    pthread_mutex_lock(&rp->lock);
+    bool ready = rp->building && rp->ready;
+    pthread_mutex_unlock(&rp->lock);
+    return ready;
+}
+
+Node *repartition_swap(Repartitioner *rp, Partition *partitions)
+{
+    pthread_join(rp->builder, NULL);
+    rp->building = false;
+    for (int p = 0; p < rp->num_partitions; p++)
+    {
+        if (rp->changed[p])
+        {
+            free(partitions[p].serialized);
+            partitions[p] = rp->next_partitions[p];
+            rp->stats.migrated++;
+        }
+        rp->mbrs[p] = getPartition(rp->next_root, p)->mbr;
+        rp->queries[p] = 0;
+        rp->cycles[p] = 0;
+    }
+    memcpy(rp->bounds, rp->next_bounds, (rp->num_partitions + 1) * sizeof(int));
+    free(rp->next_partitions);
+    rp->next_partitions = NULL;
+    rp->stats.swaps++;
+
+    Node *root = rp->next_root;
+    rp->next_root = NULL;
+    return root;
+}
+
+void repartition_discard(Repartitioner *rp)
+{
+    free_next_layout(rp);
+    for (int p = 0; p < rp->num_partitions; p++)
+    {
+        rp->queries[p] = 0;
+        rp->cycles[p] = 0;
+    }
+}
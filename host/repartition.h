@@ -0,0 +1,81 @@
+#ifndef __REPARTITION_H__
+#define __REPARTITION_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "rtree.h"
+#include "update.h"
+
+#define REPARTITION_UNIFORM_SHARE 0.5 // Part of the point weights spread evenly, bounds partition sizes at 2x the mean
+#define REPARTITION_SHIFT_DIVISOR 8   // Cuts moving by less than the mean partition size over this stay put
+
+/* Counters of the load-driven repartitioning */
+typedef struct RepartitionStats
+{
+    int rebuilds;          // Layouts built in the background
+    int swaps;             // Layouts pushed to the DPUs
+    int migrated;          // Partitions re-pushed by the swaps
+    size_t bytes;          // Tree image bytes pushed by the swaps
+    double build_time;     // Seconds the background builds took
+    double swap_time;      // Seconds the swaps held the DPUs
+} RepartitionStats;
+
+/* Observed load of the partitions and the layout being built to even it out. Partition p holds the
+ * Z-sorted points [bounds[p], bounds[p + 1]) and lives on DPU p, so a new layout only moves bounds
+ * and only the partitions whose range changed are pushed again. */
+typedef struct Repartitioner
+{
+    Point *points; // Z-sorted points of the tree, read by the builder
+    int num_points;
+    int num_partitions;
+    int *bounds;
+    MBR *mbrs;          // Of each partition, to count the queries it may hold
+    uint64_t *queries;  // Queries inside each partition's MBR since the last swap
+    uint64_t *cycles;   // Kernel cycles of each partition's DPU since the last swap
+    double threshold;   // Max/mean cycles that triggers a rebuild
+
+    pthread_mutex_t lock; // Guards ready
+    pthread_t builder;
+    bool building; // A builder was started and not joined yet
+    bool ready;    // The builder finished next_root and next_partitions
+
+    int *next_bounds;
+    bool *changed;             // Partitions whose range differs in next_bounds
+    Node *next_root;
+    Partition *next_partitions; // Serialized images of the changed partitions
+    double build_start;
+
+    RepartitionStats stats;
+} Repartitioner;
+
+// Start observing the partitions of root, built by createRTree over the Z-sorted points with at most
+// one partition per DPU; exits when root has more
+void repartition_init(Repartitioner *rp, Node *root, uint32_t nr_dpus, Point *points, int num_points, double threshold);
+
+// Join a builder still running and release everything not handed out by repartition_swap
+void repartition_destroy(Repartitioner *rp);
+
+// Add the queries of one dispatch and the cycles each partition's DPU spent on them.
+// Returns the max/mean cycles of this dispatch alone.
+double repartition_observe(Repartitioner *rp, const Point *queries, int num_queries, const uint64_t *dpu_cycles);
+
+// Max/mean cycles over the partitions since the last swap, query counts when no cycles were recorded
+double repartition_imbalance(const Repartitioner *rp);
+
+// Start a background build of bounds weighted by the observed load when the imbalance exceeds the
+// threshold and no build is running. Returns true when a builder was started.
+bool repartition_start(Repartitioner *rp);
+
+// Whether a started build has finished, so repartition_swap will not block
+bool repartition_ready(Repartitioner *rp);
+
+// Wait for the builder and adopt its layout: the changed partitions get the new images (the old ones
+// are freed) and the counters restart. Returns the new tree, the caller frees the old one.
+Node *repartition_swap(Repartitioner *rp, Partition *partitions);
+
+// Drop a finished layout instead, e.g. when a DPU cannot hold one of its images; the current layout
+// stays and the counters restart
+void repartition_discard(Repartitioner *rp);
+
+#endif /* __REPARTITION_H__ */
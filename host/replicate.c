@@ -0,0 +1,290 @@
+#include <dpu.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "replicate.h"
+#include "timing.h"
+
+/* Queries of one launch, QUERY_BATCH_SIZE per DPU */
+typedef struct RoutedBatch
+{
+    EncodedPoint *queries; // nr_dpus * QUERY_BATCH_SIZE
+    int *owners;           // Query of each entry
+    uint32_t *counts;      // Entries per DPU
+    BatchArgs *args;
+    uint64_t *results;
+    TaskletStats *counters;
+    int num_queries; // Queries routed into the batch
+} RoutedBatch;
+
+uint32_t replica_root_fanout(uint32_t nr_dpus)
+{
+    uint32_t partitions = nr_dpus - nr_dpus * REPLICA_SPARE_PERCENT / 100;
+    return partitions >= 2 ? partitions : 2;
+}
+
+void replica_plan(ReplicaMap *map, Node *root, uint32_t nr_dpus, const Point *queries, int num_queries, int sample_size)
+{
+    uint32_t num_partitions = root->isLeaf ? 1 : (uint32_t)root->count;
+    // A partition without a DPU would never be routed to, so its points could not be found
+    if (num_partitions > nr_dpus)
+    {
+        printf(ANSI_COLOR_RED "Cannot route %u partitions over %u DPUs" ANSI_COLOR_RESET "\n", num_partitions, nr_dpus);
+        exit(1);
+    }
+    map->nr_dpus = nr_dpus;
+    map->num_partitions = num_partitions;
+    map->mbrs = (MBR *)zalloc(num_partitions, sizeof(MBR));
+    map->replica_start = (uint32_t *)zalloc(num_partitions + 1, sizeof(uint32_t));
+    map->dpus = (uint32_t *)zalloc(nr_dpus, sizeof(uint32_t));
+    map->next = (uint32_t *)zalloc(num_partitions, sizeof(uint32_t));
+    map->partition_of_dpu = (int *)zalloc(nr_dpus, sizeof(int));
+    map->partition_load = (uint64_t *)zalloc(num_partitions, sizeof(uint64_t));
+    map->dpu_load = (uint64_t *)zalloc(nr_dpus, sizeof(uint64_t));
+
+    for (uint32_t p = 0; p < num_partitions; p++)
+        map->mbrs[p] = getPartition(root, (int)p)->mbr;
+
+    // Sampled load of each partition, every (num_queries / sample_size)-th query
+    uint64_t *sampled = (uint64_t *)zalloc(num_partitions, sizeof(uint64_t));
+    uint32_t *replicas = (uint32_t *)zalloc(num_partitions, sizeof(uint32_t));
+    int stride = sample_size > 0 && num_queries > sample_size ? num_queries / sample_size : 1;
+    for (int q = 0; sample_size > 0 && q < num_queries; q += stride)
+    {
+        for (uint32_t p = 0; p < num_partitions; p++)
+        {
+            if (isPointInMBR(&map->mbrs[p], queries[q]))
+                sampled[p]++;
+        }
+    }
+
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        map->partition_of_dpu[d] = d < num_partitions ? (int)d : -1;
+    }
+    for (uint32_t p = 0; p < num_partitions; p++)
+    {
+        replicas[p] = 1;
+    }
+    if (sample_size > 0 && num_partitions >= nr_dpus)
+    {
+        printf(ANSI_COLOR_RED "No spare DPU for replicas: all %u DPU(s) hold a partition" ANSI_COLOR_RESET "\n", nr_dpus);
+    }
+    for (uint32_t d = num_partitions; d < nr_dpus && sample_size > 0; d++)
+    {
+        // Compare sampled[p] / replicas[p] without dividing
+        int hottest = -1;
+        for (uint32_t p = 0; p < num_partitions; p++)
+        {
+            if (sampled[p] > 0 && (hottest < 0 || sampled[p] * replicas[hottest] > sampled[hottest] * replicas[p]))
+                hottest = (int)p;
+        }
+        if (hottest < 0)
+            break;
+        map->partition_of_dpu[d] = hottest;
+        replicas[hottest]++;
+    }
+
+    // Group the DPUs of each partition, the primary first
+    for (uint32_t p = 0; p < num_partitions; p++)
+    {
+        map->replica_start[p + 1] = map->replica_start[p] + replicas[p];
+        replicas[p] = 0;
+    }
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        int p = map->partition_of_dpu[d];
+        if (p >= 0)
+            map->dpus[map->replica_start[p] + replicas[p]++] = d;
+    }
+    free(replicas);
+    free(sampled);
+}
+
+void replica_free(ReplicaMap *map)
+{
+    free(map->dpu_load);
+    free(map->partition_load);
+    free(map->partition_of_dpu);
+    free(map->next);
+    free(map->dpus);
+    free(map->replica_start);
+    free(map->mbrs);
+}
+
+// Function to push the queries of a batch, run it and fold the answers into found
+static void launch_batch(struct dpu_set_t dpu_set, uint32_t nr_dpus, RoutedBatch *batch, uint32_t batch_flags, uint8_t *found,
+                         PipelineStats *stats, KernelStats *kernel_stats)
+{
+    struct dpu_set_t dpu;
+    uint32_t dpu_index;
+    uint32_t max_count = 0;
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        batch->args[d].buffer = 0;
+        batch->args[d].count = batch->counts[d];
+        batch->args[d].flags = batch_flags;
+        if (batch->counts[d] > max_count)
+            max_count = batch->counts[d];
+    }
+    if (max_count == 0)
+    {
+        batch->num_queries = 0;
+        return;
+    }
+
+    // Query lists differ per DPU; each transfer moves the longest one
+    double start = timing_now();
+    DPU_FOREACH(dpu_set, dpu, dpu_index)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->queries[dpu_index * QUERY_BATCH_SIZE]));
+    }
+    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_QUERIES", 0, max_count * sizeof(EncodedPoint), DPU_XFER_DEFAULT));
+    DPU_FOREACH(dpu_set, dpu, dpu_index)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->args[dpu_index]));
+    }
+    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_BATCH_ARGS", 0, sizeof(BatchArgs), DPU_XFER_DEFAULT));
+    double pushed = timing_now();
+
+    DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+    double executed = timing_now();
+
+    DPU_FOREACH(dpu_set, dpu, dpu_index)
+    {
+        DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->results[dpu_index * QUERY_BATCH_SIZE]));
+    }
+    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, "DPU_RESULTS", 0, max_count * sizeof(uint64_t), DPU_XFER_DEFAULT));
+    if (kernel_stats != NULL)
+    {
+        DPU_FOREACH(dpu_set, dpu, dpu_index)
+        {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, &batch->counters[dpu_index * NR_TASKLETS]));
+        }
+        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, "DPU_STATS", 0, NR_TASKLETS * sizeof(TaskletStats), DPU_XFER_DEFAULT));
+    }
+    double pulled = timing_now();
+
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        for (uint32_t r = 0; r < batch->counts[d]; r++)
+        {
+            if (batch->results[d * QUERY_BATCH_SIZE + r])
+                found[batch->owners[d * QUERY_BATCH_SIZE + r]] = 1;
+        }
+        batch->counts[d] = 0;
+    }
+    if (kernel_stats != NULL)
+        kernel_stats_add_launch(kernel_stats, batch->counters, (uint32_t)batch->num_queries);
+    double merged = timing_now();
+
+    stats->transfer_in_time += pushed - start;
+    stats->launch_time += executed - pushed;
+    stats->transfer_out_time += pulled - executed;
+    stats->merge_time += merged - pulled;
+    stats->num_batches++;
+    batch->num_queries = 0;
+}
+
+void run_routed_queries(struct dpu_set_t dpu_set, ReplicaMap *map, const Point *points, const EncodedPoint *queries,
+                        int num_queries, uint32_t batch_flags, uint8_t *found, PipelineStats *stats, KernelStats *kernel_stats)
+{
+    uint32_t nr_dpus = map->nr_dpus;
+    RoutedBatch batch;
+    batch.queries = (EncodedPoint *)calloc((size_t)nr_dpus * QUERY_BATCH_SIZE, sizeof(EncodedPoint));
+    batch.owners = (int *)calloc((size_t)nr_dpus * QUERY_BATCH_SIZE, sizeof(int));
+    batch.counts = (uint32_t *)calloc(nr_dpus, sizeof(uint32_t));
+    batch.args = (BatchArgs *)calloc(nr_dpus, sizeof(BatchArgs));
+    batch.results = (uint64_t *)calloc((size_t)nr_dpus * QUERY_BATCH_SIZE, sizeof(uint64_t));
+    batch.counters = (TaskletStats *)calloc((size_t)nr_dpus * NR_TASKLETS, sizeof(TaskletStats));
+    batch.num_queries = 0;
+    uint32_t *targets = (uint32_t *)malloc((map->num_partitions > 0 ? map->num_partitions : 1) * sizeof(uint32_t));
+    if (batch.queries == NULL || batch.owners == NULL || batch.counts == NULL || batch.args == NULL ||
+        batch.results == NULL || batch.counters == NULL || targets == NULL)
+    {
+        perror("Failed to allocate routed batch");
+        exit(1);
+    }
+    memset(found, 0, (size_t)num_queries);
+    memset(stats, 0, sizeof(PipelineStats));
+
+    double start = timing_now();
+    for (int q = 0; q < num_queries; q++)
+    {
+        double route_start = timing_now();
+        uint32_t num_targets = 0;
+        for (uint32_t p = 0; p < map->num_partitions; p++)
+        {
+            if (isPointInMBR(&map->mbrs[p], points[q]))
+                targets[num_targets++] = p;
+        }
+
+        // Launch what is queued when a replica this query may go to is full
+        bool full = false;
+        for (uint32_t t = 0; t < num_targets && !full; t++)
+        {
+            for (uint32_t r = map->replica_start[targets[t]]; r < map->replica_start[targets[t] + 1] && !full; r++)
+                full = batch.counts[map->dpus[r]] == QUERY_BATCH_SIZE;
+        }
+        stats->queue_time += timing_now() - route_start;
+        if (full)
+            launch_batch(dpu_set, nr_dpus, &batch, batch_flags, found, stats, kernel_stats);
+
+        route_start = timing_now();
+        for (uint32_t t = 0; t < num_targets; t++)
+        {
+            uint32_t p = targets[t];
+            uint32_t replicas = map->replica_start[p + 1] - map->replica_start[p];
+            uint32_t d = map->dpus[map->replica_start[p] + map->next[p]++ % replicas];
+            uint32_t r = batch.counts[d]++;
+            batch.queries[d * QUERY_BATCH_SIZE + r] = queries[q];
+            batch.owners[d * QUERY_BATCH_SIZE + r] = q;
+            map->partition_load[p]++;
+            map->dpu_load[d]++;
+        }
+        batch.num_queries++;
+        stats->queue_time += timing_now() - route_start;
+    }
+    launch_batch(dpu_set, nr_dpus, &batch, batch_flags, found, stats, kernel_stats);
+    stats->total_time = timing_now() - start;
+
+    free(targets);
+    free(batch.counters);
+    free(batch.results);
+    free(batch.args);
+    free(batch.counts);
+    free(batch.owners);
+    free(batch.queries);
+}
+
+// Function to compute the ratio of the largest to the mean of n loads (1.0 means perfectly balanced)
+static double skew(const uint64_t *loads, uint32_t n, uint32_t total_slots)
+{
+    uint64_t max = 0, sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        sum += loads[i];
+        if (loads[i] > max)
+            max = loads[i];
+    }
+    return sum ? (double)max * total_slots / sum : 1.0;
+}
+
+void replica_report(const ReplicaMap *map)
+{
+    uint32_t replicated = 0, busiest = 0;
+    for (uint32_t p = 0; p < map->num_partitions; p++)
+    {
+        if (map->replica_start[p + 1] - map->replica_start[p] > 1)
+            replicated++;
+        if (map->partition_load[p] > map->partition_load[busiest])
+            busiest = p;
+    }
+    // With one DPU per partition the partition loads are the DPU loads, the other DPUs idle
+    printf("Routed load skew (max/mean over %u DPUs): %.2f with one DPU per partition, %.2f with replicas\n",
+           map->nr_dpus, skew(map->partition_load, map->num_partitions, map->nr_dpus), skew(map->dpu_load, map->nr_dpus, map->nr_dpus));
+    printf("%u of %u partition(s) replicated; hottest partition %u: %lu queries over %u DPU(s)\n", replicated, map->num_partitions,
+           busiest, (unsigned long)map->partition_load[busiest], map->replica_start[busiest + 1] - map->replica_start[busiest]);
+}
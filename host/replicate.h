@@ -0,0 +1,46 @@
+#ifndef __REPLICATE_H__
+#define __REPLICATE_H__
+
+#include <dpu.h>
+#include <stdint.h>
+#include "common.h"
+#include "kernelstats.h"
+#include "pipeline.h"
+#include "rtree.h"
+
+/* Which DPUs hold which partition (child of the root) when queries are routed instead of broadcast.
+ * Partition p always lives on DPU p; DPUs beyond the last partition hold extra replicas of the hottest. */
+typedef struct ReplicaMap
+{
+    uint32_t nr_dpus;
+    uint32_t num_partitions;  // Children of the root, 1 when the root is a leaf
+    MBR *mbrs;                // Of each partition, what routing tests queries against
+    uint32_t *replica_start;  // Replicas of partition p are dpus[replica_start[p] .. replica_start[p + 1])
+    uint32_t *dpus;
+    uint32_t *next;           // Round-robin cursor of each partition
+    int *partition_of_dpu;    // -1 for a DPU without a partition
+    uint64_t *partition_load; // Queries routed to each partition
+    uint64_t *dpu_load;       // Queries routed to each DPU
+} ReplicaMap;
+
+#define REPLICA_SPARE_PERCENT 25 // DPUs kept free of partitions for replicas when replicating
+
+// Most partitions (children of the root) to build when replicating on nr_dpus DPUs, so that
+// REPLICA_SPARE_PERCENT of them are left for replicas even when the fanout could fill them all
+uint32_t replica_root_fanout(uint32_t nr_dpus);
+
+// Map the partitions of root onto nr_dpus DPUs. Spare DPUs go one by one to the partition with the
+// most sampled queries per replica; sample_size 0 leaves them idle (routing without replication).
+// Exits when root has more partitions than there are DPUs.
+void replica_plan(ReplicaMap *map, Node *root, uint32_t nr_dpus, const Point *queries, int num_queries, int sample_size);
+void replica_free(ReplicaMap *map);
+
+// Send each query to one replica, round-robin, of every partition whose MBR holds it, and set found[q]
+// when any of them reports it. Queries are in the encoding of the trees; points are used for routing.
+void run_routed_queries(struct dpu_set_t dpu_set, ReplicaMap *map, const Point *points, const EncodedPoint *queries,
+                        int num_queries, uint32_t batch_flags, uint8_t *found, PipelineStats *stats, KernelStats *kernel_stats);
+
+// Print the routed load skew (max/mean over all DPUs) with one DPU per partition and with the replicas
+void replica_report(const ReplicaMap *map);
+
+#endif /* __REPLICATE_H__ */
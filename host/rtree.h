@@ -0,0 +1,73 @@
+#ifndef __RTREE_H__
+#define __RTREE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Structure for a node
+typedef struct Node
+{
+    int isLeaf; // 1 if it's a leaf node, 0 if it's an internal node
+    int count;  // Number of entries in the node
+    MBR mbr;    // Bounding box for the node
+    union
+    {
+        struct Node **children; // Child nodes (internal node)
+        Point *points;          // Points (leaf node)
+    };
+} Node;
+
+// Shape of the trees createRTree builds and updates maintain, FANOUT/BUNDLEFACTOR by default
+extern TreeParams tree_params;
+
+// Set the tree shape, false when it does not fit a SerializedNode
+bool setTreeParams(uint32_t fanout, uint32_t bundlefactor);
+
+// Minimum occupancy m of a non-root node (40% of the maximum M, as in Guttman's R-tree).
+// createRTree never packs below it and deletes dissolve nodes that fall below it.
+#define MIN_LEAF_FILL ((int)tree_params.bundlefactor * 2 / 5 > 0 ? (int)tree_params.bundlefactor * 2 / 5 : 1)
+#define MIN_NODE_FILL ((int)tree_params.fanout * 2 / 5 > 0 ? (int)tree_params.fanout * 2 / 5 : 1)
+
+// TREE_ENCODING_* stamped into the headers of serialized trees, float unless the host quantizes
+extern uint32_t tree_encoding;
+
+// Target occupancy of packed nodes in percent of M, never below m; lower values leave room for inserts
+extern int tree_fill_percent;
+
+// Most children createRTree gives the root, i.e. DPU partitions; 0 for the fanout
+extern uint32_t tree_root_fanout;
+
+// Helper functions of rtreefunction.c
+void initMBR(MBR *mbr);
+void updateMBRWithPoint(MBR *mbr, Point p);
+bool isPointInMBR(MBR *mbr, Point p);
+int readPointsFromFile(const char *filename, Point points[], int max_points);
+void printPoints(Point points[], int num_points);
+Node *createRTree(Point *ptArr, int low, int high);
+Node *createRTreeWithBounds(Point *ptArr, const int *bounds, int num_children);
+void printRTree(Node *node, int level);
+bool searchRTree(Node *node, Point queryPoint);
+void freeRTree(Node *node);
+int countNodesInSubtree(Node *root);
+int countPointsInSubtree(Node *root);
+void *zalloc(size_t count, size_t size);
+uint64_t next_random(uint64_t *state);
+int treeHeight(Node *root);
+int serialize_rtree_wrapper(Node *root, SerializedNode **output, int max_nodes);
+void print_serialisedtree(int node_index, int depth, SerializedNode *serialized_tree);
+uint32_t checksum_image(const void *image, size_t size);
+void make_image_header(TreeHeader *header, const void *image, size_t size, int num_nodes);
+void make_tree_header(TreeHeader *header, SerializedNode *serialized_tree, int num_nodes);
+Node *copySubtree(Node *root);
+Node *getSubtree(Node *root, int targetIndex);
+Node *getPartition(Node *root, int dpu_id);
+
+// Z-order sorting of zordering.c; *extent receives the bounding box the Morton keys are taken over
+void Zsorting(Point points[], int num_points, MBR *extent);
+// order[i] receives the index of the i-th point in Z-order over extent (e.g. the data set's, so the
+// order follows the tree's leaves); the points stay where they are
+void Zorder(const Point points[], int num_points, const MBR *extent, int order[]);
+
+#endif /* __RTREE_H__ */
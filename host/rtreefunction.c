@@ -4,47 +4,24 @@
 #include <string.h>
 #include <stdio.h>
 #include <common.h>
+#include "rtree.h"
 #include<float.h>
 
 
+TreeParams tree_params = {FANOUT, BUNDLEFACTOR};
+int tree_fill_percent = 100;
+uint32_t tree_root_fanout = 0;
+uint32_t tree_encoding = TREE_ENCODING_FLOAT;
 
-// Structure to define a point
-typedef struct Point
+// Function to choose the tree shape at run time, bounded by the capacity of a SerializedNode
+bool setTreeParams(uint32_t fanout, uint32_t bundlefactor)
 {
-    float x, y;
-} Point;
-
-// Structure to define a bounding box (MBR)
-typedef struct MBR
-{
-    float xmin, ymin;
-    float xmax, ymax;
-} MBR;
-
-// Structure for a node
-typedef struct Node
-{
-    int isLeaf; // 1 if it's a leaf node, 0 if it's an internal node
-    int count;  // Number of entries in the node
-    MBR mbr;    // Bounding box for the node
-    union
-    {
-        struct Node **children; // Child nodes (internal node)
-        Point *points;          // Points (leaf node)
-    };
-} Node;
-
-typedef struct SerializedNode
-{
-    int isLeaf;          // 1 if it's a leaf node, 0 if it's an internal node
-    int count;           // Number of entries in the node
-    MBR mbr;             // Bounding box for the node
-    int children[16];    // Indices of child nodes (internal node), max FANOUT assumed to be 16
-    Point points[16];    // Points (leaf node), max BUNDLEFACTOR assumed to be 16
-} SerializedNode;
-
-Node *copySubtree(Node *root);
-
+    if (fanout < 2 || fanout > FANOUT || bundlefactor < 1 || bundlefactor > BUNDLEFACTOR)
+        return false;
+    tree_params.fanout = fanout;
+    tree_params.bundlefactor = bundlefactor;
+    return true;
+}
 
 // Function to initialize a bounding box
 void initMBR(MBR *mbr)
@@ -98,65 +75,162 @@ Node *createLeaf(Point *ptArr, int low, int high)
     return leaf;
 }
 
-// Function to get the range of points for each child node
-void getRange(int *range, int childID, int low, int high)
+// Function to extend an MBR so it covers another one
+static void extendMBRWithMBR(MBR *mbr, MBR *other)
 {
-    int rangeSize = high - low + 1;
-    int partitionSize = rangeSize / FANOUT;
+    if (other->xmin < mbr->xmin)
+        mbr->xmin = other->xmin;
+    if (other->ymin < mbr->ymin)
+        mbr->ymin = other->ymin;
+    if (other->xmax > mbr->xmax)
+        mbr->xmax = other->xmax;
+    if (other->ymax > mbr->ymax)
+        mbr->ymax = other->ymax;
+}
 
-    range[0] = low + childID * partitionSize;
-    if (childID == FANOUT - 1)
-    {
-        range[1] = high;
-    }
-    else
+// Function to get the number of entries a packed leaf / internal node is filled to
+static int targetLeafFill(void)
+{
+    int target = (int)tree_params.bundlefactor * tree_fill_percent / 100;
+    return target > MIN_LEAF_FILL ? target : MIN_LEAF_FILL;
+}
+
+static int targetNodeFill(void)
+{
+    int target = (int)tree_params.fanout * tree_fill_percent / 100;
+    if (target < MIN_NODE_FILL)
+        target = MIN_NODE_FILL;
+    return target > 1 ? target : 2; // A node of one child would never shrink the range
+}
+
+// Function to get the number of points a packed subtree of the given height holds
+static long subtreeCapacity(int height)
+{
+    long capacity = targetLeafFill();
+    for (int h = 0; h < height; h++)
+        capacity *= targetNodeFill();
+    return capacity;
+}
+
+// Function to get the fewest points a subtree of the given height can hold with every node at m
+static long subtreeMinimum(int height)
+{
+    long minimum = MIN_LEAF_FILL;
+    for (int h = 0; h < height; h++)
+        minimum *= MIN_NODE_FILL;
+    return minimum;
+}
+
+// Function to choose how many children of the given height share size points: as few as the
+// target fill allows, but at least m as long as each child still gets its minimum
+static int packedChildren(long size, int child_height)
+{
+    long children = (size + subtreeCapacity(child_height) - 1) / subtreeCapacity(child_height);
+    long widest = size / subtreeMinimum(child_height);
+    long minimum = widest < MIN_NODE_FILL ? widest : MIN_NODE_FILL;
+    return (int)(children > minimum ? children : minimum);
+}
+
+// Function to pack the sorted points [low, high] into an internal node of num_children children,
+// each a subtree of child_height (0 for leaves). The range is cut into near-equal parts, so sibling
+// sizes differ by at most one point and every node lands between m and the target fill.
+// Partition roots only get as many children as the target fill needs.
+static Node *packNode(Point *ptArr, int low, int high, int num_children, int child_height, bool partition_roots)
+{
+    Node *node = (Node *)malloc(sizeof(Node));
+    node->isLeaf = 0;
+    node->count = num_children;
+    node->children = (Node **)malloc(num_children * sizeof(Node *));
+    initMBR(&node->mbr);
+
+    int size = high - low + 1;
+    int first = low;
+    for (int childID = 0; childID < num_children; childID++)
     {
-        range[1] = range[0] + partitionSize - 1;
+        int part = size / num_children + (childID < size % num_children ? 1 : 0);
+        Node *child;
+        if (child_height == 0)
+        {
+            child = createLeaf(ptArr, first, first + part - 1);
+        }
+        else
+        {
+            long below = subtreeCapacity(child_height - 1);
+            int grandchildren = partition_roots ? (int)((part + below - 1) / below) : packedChildren(part, child_height - 1);
+            child = packNode(ptArr, first, first + part - 1, grandchildren, child_height - 1, false);
+        }
+        node->children[childID] = child;
+        extendMBRWithMBR(&node->mbr, &child->mbr);
+        first += part;
     }
+    return node;
 }
 
-// Function to create an R-tree node recursively
+// Function to bulk load an R-tree from points sorted along a space-filling curve
 Node *createRTree(Point *ptArr, int low, int high)
 {
-    Node *root;
-
-    if ((high - low + 1) <= BUNDLEFACTOR)
+    int n = high - low + 1;
+    if (n <= (int)tree_params.bundlefactor)
     {
         // If the number of points is less than or equal to the bundle factor, create a leaf node
-        root = createLeaf(ptArr, low, high);
+        return createLeaf(ptArr, low, high);
     }
-    else
-    {
-        // Otherwise, create an internal node
-        root = (Node *)malloc(sizeof(Node));
-        root->isLeaf = 0;
-        root->count = FANOUT;
 
-        // Temporary array to hold children nodes
-        Node **tempChildren = (Node **)malloc(FANOUT * sizeof(Node *));
+    // The root fans out as wide as allowed, since each of its children becomes one DPU partition,
+    // but never so wide that a child would hold fewer than m points
+    int num_children = n / MIN_LEAF_FILL;
+    if (num_children > (int)tree_params.fanout)
+        num_children = tree_params.fanout;
+    if (tree_root_fanout > 0 && num_children > (int)tree_root_fanout)
+        num_children = tree_root_fanout;
+    if (num_children < 2)
+        num_children = 2;
+
+    // All children get the smallest height that holds the largest share, keeping the tree balanced.
+    // Partition roots are roots of their own subtree and may hold fewer than m children; every
+    // node below them is packed between m and the target fill.
+    int largest = (n + num_children - 1) / num_children;
+    int child_height = 0;
+    while (subtreeCapacity(child_height) < largest)
+        child_height++;
+
+    Node *root = packNode(ptArr, low, high, num_children, child_height, true);
+    //printf("\nCreating rtree mbr (%.1f,%.1f), (%.1f,%.1f) ",root->mbr.xmin,root->mbr.ymin,root->mbr.xmax,root->mbr.ymax );
+    return root;
+}
 
-        for (int childID = 0; childID < FANOUT; childID++)
-        {
-            int range[2];
-            getRange(range, childID, low, high);
+// Function to bulk load an R-tree whose root has one child per given range of the sorted points:
+// child i holds [bounds[i], bounds[i + 1]) packed at the smallest height that fits it. Unlike
+// createRTree the partitions may differ in size and height.
+Node *createRTreeWithBounds(Point *ptArr, const int *bounds, int num_children)
+{
+    Node *root = (Node *)malloc(sizeof(Node));
+    root->isLeaf = 0;
+    root->count = num_children;
+    root->children = (Node **)malloc(num_children * sizeof(Node *));
+    initMBR(&root->mbr);
 
-            Node *child = createRTree(ptArr, range[0], range[1]);
-            tempChildren[childID] = child;
+    for (int childID = 0; childID < num_children; childID++)
+    {
+        int low = bounds[childID];
+        int high = bounds[childID + 1] - 1;
+        int part = high - low + 1;
+        Node *child;
+        if (part <= (int)tree_params.bundlefactor)
+        {
+            child = createLeaf(ptArr, low, high);
         }
-
-        root->children = tempChildren;
-
-        // Calculate the MBR for the internal node
-        MBR *parentMBR = (MBR *)malloc(sizeof(MBR));
-        initMBR(parentMBR);
-        for (int i = 0; i < FANOUT; i++)
+        else
         {
-            *parentMBR = *unionJoin(parentMBR, &root->children[i]->mbr);
+            int height = 1;
+            while (subtreeCapacity(height) < part)
+                height++;
+            long below = subtreeCapacity(height - 1);
+            child = packNode(ptArr, low, high, (int)((part + below - 1) / below), height - 1, false);
         }
-        root->mbr = *parentMBR;
-        //printf("\nCreating rtree mbr (%.1f,%.1f), (%.1f,%.1f) ",root->mbr.xmin,root->mbr.ymin,root->mbr.xmax,root->mbr.ymax );
+        root->children[childID] = child;
+        extendMBRWithMBR(&root->mbr, &child->mbr);
     }
-
     return root;
 }
 
@@ -230,6 +304,37 @@ bool searchRTree(Node *node, Point queryPoint)
         return false; // Point not found in any children
     }
 }
+// Function to free a tree built by createRTree or copySubtree
+void freeRTree(Node *node)
+{
+    if (node == NULL)
+        return;
+
+    if (node->isLeaf)
+    {
+        free(node->points);
+    }
+    else
+    {
+        for (int i = 0; i < node->count; i++)
+            freeRTree(node->children[i]);
+        free(node->children);
+    }
+    free(node);
+}
+
+// Function to get the number of levels below a node (0 for a leaf)
+int treeHeight(Node *root)
+{
+    int height = 0;
+    while (root != NULL && !root->isLeaf && root->count > 0)
+    {
+        root = root->children[0];
+        height++;
+    }
+    return height;
+}
+
 // Function to count the number of nodes in a subtree
 int countNodesInSubtree(Node *root)
 {
@@ -251,6 +356,40 @@ int countNodesInSubtree(Node *root)
     return count;
 }
 
+// Function to count the points stored below a node
+int countPointsInSubtree(Node *root)
+{
+    if (root == NULL)
+        return 0;
+    if (root->isLeaf)
+        return root->count;
+    int count = 0;
+    for (int i = 0; i < root->count; i++)
+        count += countPointsInSubtree(root->children[i]);
+    return count;
+}
+
+// Function to allocate zeroed memory for count elements (at least one) or exit
+void *zalloc(size_t count, size_t size)
+{
+    void *memory = calloc(count > 0 ? count : 1, size);
+    if (memory == NULL)
+    {
+        perror("Failed to allocate memory");
+        exit(1);
+    }
+    return memory;
+}
+
+// Function to draw the next xorshift64* value, so a seed draws the same sequence on every machine
+uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
 
 // Function to read points from a file
 int readPointsFromFile(const char *filename, Point points[], int max_points) {
@@ -282,9 +421,19 @@ int readPointsFromFile(const char *filename, Point points[], int max_points) {
     // Close the file after reading
     fclose(file);
 
-    // Parse points from the buffer
+    // Parse points from the buffer; strtof, unlike sscanf on a string, does not rescan the rest of
+    // the buffer for its length on every line, which made reading quadratic in the file size
     char *line = buffer;
-    while (num_points < max_points && sscanf(line, "%f, %f", &points[num_points].x, &points[num_points].y) == 2) {
+    while (num_points < max_points) {
+        char *end;
+        points[num_points].x = strtof(line, &end);
+        if (end == line || *end != ',')
+            break;
+        line = end + 1;
+        points[num_points].y = strtof(line, &end);
+        if (end == line)
+            break;
+        line = end;
         num_points++;
         // Move to the next line or point
         line = strchr(line, '\n');
@@ -340,8 +489,8 @@ int serialize_rtree(Node *node, SerializedNode *serialized_tree, int *current_in
 // Wrapper function to start serialization
 int serialize_rtree_wrapper(Node *root, SerializedNode **output, int max_nodes)
 {
-    // Allocate memory for the serialized tree
-    *output = (SerializedNode *)malloc(max_nodes * sizeof(SerializedNode));
+    // Allocate zeroed memory for the serialized tree so unused slots checksum the same every run
+    *output = (SerializedNode *)calloc(max_nodes > 0 ? max_nodes : 1, sizeof(SerializedNode));
     if (*output == NULL)
     {
         perror("Failed to allocate memory for serialized tree");
@@ -353,6 +502,37 @@ int serialize_rtree_wrapper(Node *root, SerializedNode **output, int max_nodes)
     return current_index; // Return the total number of serialized nodes
 }
 
+// Function to compute the FNV-1a checksum of a tree image
+uint32_t checksum_image(const void *image, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)image;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Function to fill the MRAM header describing a tree image of any encoding
+void make_image_header(TreeHeader *header, const void *image, size_t size, int num_nodes)
+{
+    header->magic = TREE_MAGIC;
+    header->version = TREE_VERSION;
+    header->num_nodes = (uint32_t)num_nodes;
+    header->checksum = checksum_image(image, size);
+    header->params = tree_params;
+    header->encoding = tree_encoding;
+    header->image_bytes = (uint32_t)size;
+}
+
+// Function to fill the MRAM header describing a serialized tree
+void make_tree_header(TreeHeader *header, SerializedNode *serialized_tree, int num_nodes)
+{
+    make_image_header(header, serialized_tree, (size_t)num_nodes * sizeof(SerializedNode), num_nodes);
+}
 
 void print_serialisedtree(int node_index, int depth, SerializedNode *serialized_tree) {
     if (node_index < 0) {
@@ -465,3 +645,12 @@ Node *getSubtree(Node *root, int targetIndex)
     return extractSubtree(root, targetIndex, &currentIndex);
 }
 
+// Function to get the subtree held by a DPU: child dpu_id of the root, or the root itself
+// for DPU 0 when the whole tree is a single leaf
+Node *getPartition(Node *root, int dpu_id)
+{
+    if (root->isLeaf)
+        return dpu_id == 0 ? root : NULL;
+    return dpu_id < root->count ? root->children[dpu_id] : NULL;
+}
+
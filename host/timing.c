@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "timing.h"
+
+static const char *phase_names[NR_PHASES] = {
+    "read", "sort", "build", "partition", "serialize", "transfer_in", "launch", "transfer_out", "merge"};
+
+static const char *counter_names[NR_COUNTERS] = {
+    "cache_lookups", "cache_hits", "cache_coalesced", "cache_evictions", "cache_invalidations",
+    "bloom_checks", "bloom_passed", "bloom_false_pos", "bloom_rejected"};
+
+double timing_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+const char *timing_phase_name(Phase phase)
+{
+    return phase_names[phase];
+}
+
+const char *timing_counter_name(Counter counter)
+{
+    return counter_names[counter];
+}
+
+void timing_init(Timing *timing)
+{
+    memset(timing, 0, sizeof(Timing));
+}
+
+void timing_start(Timing *timing, Phase phase)
+{
+    timing->started[phase] = timing_now();
+}
+
+double timing_stop(Timing *timing, Phase phase)
+{
+    double span = timing_now() - timing->started[phase];
+    timing_add(timing, phase, span);
+    return span;
+}
+
+void timing_add(Timing *timing, Phase phase, double seconds)
+{
+    if (timing->num_runs < MAX_RUNS)
+        timing->spans[timing->num_runs][phase] += seconds;
+}
+
+void timing_count(Timing *timing, Counter counter, uint64_t n)
+{
+    if (timing->num_runs < MAX_RUNS)
+        timing->counts[timing->num_runs][counter] += n;
+}
+
+void timing_end_run(Timing *timing)
+{
+    if (timing->num_runs < MAX_RUNS)
+        timing->num_runs++;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Function to compute the median of a sorted array
+static double sorted_median(const double *values, int n)
+{
+    return n ? (n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2) : 0.0;
+}
+
+double timing_median(const double *values, int n)
+{
+    double sorted[MAX_RUNS];
+    n = n < MAX_RUNS ? n : MAX_RUNS;
+    memcpy(sorted, values, n * sizeof(double));
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    return sorted_median(sorted, n);
+}
+
+void timing_summary(Timing *timing, Phase phase, double *min, double *median, double *p99)
+{
+    int n = timing->num_runs;
+    double values[MAX_RUNS];
+    for (int r = 0; r < n; r++)
+        values[r] = timing->spans[r][phase] * 1000000;
+    qsort(values, n, sizeof(double), compare_doubles);
+
+    *min = n ? values[0] : 0.0;
+    *median = sorted_median(values, n);
+    int rank = (99 * n + 99) / 100; // ceil(0.99 * n)
+    *p99 = n ? values[rank - 1] : 0.0;
+}
+
+// Function to sum a counter over the finished runs
+static uint64_t counter_total(Timing *timing, Counter counter)
+{
+    uint64_t total = 0;
+    for (int r = 0; r < timing->num_runs; r++)
+        total += timing->counts[r][counter];
+    return total;
+}
+
+void timing_report(Timing *timing)
+{
+    printf(ANSI_COLOR_LIGHT_BLUE "\n%-14s %14s %14s %14s   (μs over %d run(s))" ANSI_COLOR_RESET "\n",
+           "phase", "min", "median", "p99", timing->num_runs);
+    for (int p = 0; p < NR_PHASES; p++)
+    {
+        double min, median, p99;
+        timing_summary(timing, (Phase)p, &min, &median, &p99);
+        printf("%-14s %14.3f %14.3f %14.3f\n", phase_names[p], min, median, p99);
+    }
+
+    uint64_t lookups = counter_total(timing, COUNTER_CACHE_LOOKUPS);
+    uint64_t checks = counter_total(timing, COUNTER_BLOOM_CHECKS);
+    if (lookups > 0 || checks > 0)
+    {
+        printf(ANSI_COLOR_LIGHT_BLUE "\n%-20s %14s" ANSI_COLOR_RESET "\n", "counter", "total");
+        for (int c = 0; c < NR_COUNTERS; c++)
+            printf("%-20s %14lu\n", counter_names[c], (unsigned long)counter_total(timing, (Counter)c));
+    }
+    if (lookups > 0)
+    {
+        uint64_t hits = counter_total(timing, COUNTER_CACHE_HITS);
+        uint64_t coalesced = counter_total(timing, COUNTER_CACHE_COALESCED);
+        printf("Cache hit rate %.1f%%, %.1f%% more saved by coalescing repeats\n",
+               100.0 * hits / lookups, 100.0 * coalesced / lookups);
+    }
+    if (checks > 0)
+    {
+        // The false-positive rate is over the probes of partitions that do not hold the point
+        uint64_t passed = counter_total(timing, COUNTER_BLOOM_PASSED);
+        uint64_t false_pos = counter_total(timing, COUNTER_BLOOM_FALSE_POS);
+        uint64_t negatives = checks - (passed - false_pos);
+        printf("Bloom false-positive rate %.3f%%, %lu queries never dispatched\n",
+               negatives ? 100.0 * false_pos / negatives : 0.0,
+               (unsigned long)counter_total(timing, COUNTER_BLOOM_REJECTED));
+    }
+}
+
+static void write_csv(Timing *timing, FILE *file)
+{
+    fprintf(file, "run");
+    for (int p = 0; p < NR_PHASES; p++)
+        fprintf(file, ",%s_us", phase_names[p]);
+    for (int c = 0; c < NR_COUNTERS; c++)
+        fprintf(file, ",%s", counter_names[c]);
+    fprintf(file, "\n");
+
+    for (int r = 0; r < timing->num_runs; r++)
+    {
+        fprintf(file, "%d", r);
+        for (int p = 0; p < NR_PHASES; p++)
+            fprintf(file, ",%.3f", timing->spans[r][p] * 1000000);
+        for (int c = 0; c < NR_COUNTERS; c++)
+            fprintf(file, ",%lu", (unsigned long)timing->counts[r][c]);
+        fprintf(file, "\n");
+    }
+
+    const char *labels[3] = {"min", "median", "p99"};
+    for (int s = 0; s < 3; s++)
+    {
+        fprintf(file, "%s", labels[s]);
+        for (int p = 0; p < NR_PHASES; p++)
+        {
+            double values[3];
+            timing_summary(timing, (Phase)p, &values[0], &values[1], &values[2]);
+            fprintf(file, ",%.3f", values[s]);
+        }
+        // Counters only have totals
+        for (int c = 0; c < NR_COUNTERS; c++)
+            fprintf(file, ",");
+        fprintf(file, "\n");
+    }
+}
+
+static void write_json(Timing *timing, FILE *file)
+{
+    fprintf(file, "{\n  \"unit\": \"us\",\n  \"runs\": [\n");
+    for (int r = 0; r < timing->num_runs; r++)
+    {
+        fprintf(file, "    {");
+        for (int p = 0; p < NR_PHASES; p++)
+            fprintf(file, "%s\"%s\": %.3f", p ? ", " : "", phase_names[p], timing->spans[r][p] * 1000000);
+        for (int c = 0; c < NR_COUNTERS; c++)
+            fprintf(file, ", \"%s\": %lu", counter_names[c], (unsigned long)timing->counts[r][c]);
+        fprintf(file, "}%s\n", r + 1 < timing->num_runs ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"summary\": {\n");
+    for (int p = 0; p < NR_PHASES; p++)
+    {
+        double min, median, p99;
+        timing_summary(timing, (Phase)p, &min, &median, &p99);
+        fprintf(file, "    \"%s\": {\"min\": %.3f, \"median\": %.3f, \"p99\": %.3f}%s\n",
+                phase_names[p], min, median, p99, p + 1 < NR_PHASES ? "," : "");
+    }
+    fprintf(file, "  },\n  \"totals\": {");
+    for (int c = 0; c < NR_COUNTERS; c++)
+        fprintf(file, "%s\"%s\": %lu", c ? ", " : "", counter_names[c], (unsigned long)counter_total(timing, (Counter)c));
+    fprintf(file, "}\n}\n");
+}
+
+int timing_write(Timing *timing, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        perror("Unable to open timing output");
+        return -1;
+    }
+
+    size_t length = strlen(path);
+    if (length >= 5 && strcmp(path + length - 5, ".json") == 0)
+        write_json(timing, file);
+    else
+        write_csv(timing, file);
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include <stdint.h>
+
+#define MAX_RUNS 100
+
+/* Phases of one host session, in execution order */
+typedef enum Phase
+{
+    PHASE_READ,         // Reading the data set
+    PHASE_SORT,         // Z-order sort
+    PHASE_BUILD,        // Pointer tree construction
+    PHASE_PARTITION,    // Assigning subtrees to DPUs
+    PHASE_SERIALIZE,    // Flattening subtrees into SerializedNode arrays
+    PHASE_TRANSFER_IN,  // Host to MRAM: trees, updates, queries
+    PHASE_LAUNCH,       // Kernel execution
+    PHASE_TRANSFER_OUT, // MRAM to host: results
+    PHASE_MERGE,        // Folding per-DPU results
+    NR_PHASES
+} Phase;
+
+/* Events counted during a session, next to the phase spans */
+typedef enum Counter
+{
+    COUNTER_CACHE_LOOKUPS,       // Queries checked against the result cache
+    COUNTER_CACHE_HITS,          // Answered from a cached result
+    COUNTER_CACHE_COALESCED,     // Repeats sent to the DPUs once
+    COUNTER_CACHE_EVICTIONS,     // Cached results dropped to make room
+    COUNTER_CACHE_INVALIDATIONS, // Cached results dropped by an update
+    COUNTER_BLOOM_CHECKS,        // Partition filter probes, one per query and partition
+    COUNTER_BLOOM_PASSED,        // Probes a filter accepted
+    COUNTER_BLOOM_FALSE_POS,     // Accepted although the partition does not hold the point
+    COUNTER_BLOOM_REJECTED,      // Queries answered on the host because every filter rejected them
+    NR_COUNTERS
+} Counter;
+
+/* Wall-clock spans per phase and event counts, one row per run */
+typedef struct Timing
+{
+    int num_runs;
+    double spans[MAX_RUNS][NR_PHASES]; // Seconds
+    double started[NR_PHASES];
+    uint64_t counts[MAX_RUNS][NR_COUNTERS];
+} Timing;
+
+// Seconds on CLOCK_MONOTONIC
+double timing_now(void);
+
+void timing_init(Timing *timing);
+
+// Open and close a span of a phase; spans of the same phase in one run add up
+void timing_start(Timing *timing, Phase phase);
+double timing_stop(Timing *timing, Phase phase);
+
+// Add a span measured elsewhere (e.g. in an SDK callback) to the current run
+void timing_add(Timing *timing, Phase phase, double seconds);
+
+// Add events to a counter of the current run
+void timing_count(Timing *timing, Counter counter, uint64_t n);
+
+// Close the current run and start the next one
+void timing_end_run(Timing *timing);
+
+// Min, median and p99 (nearest rank) of one phase over the finished runs, in μs
+void timing_summary(Timing *timing, Phase phase, double *min, double *median, double *p99);
+
+// Median of up to MAX_RUNS values, in their own unit
+double timing_median(const double *values, int n);
+
+// Print min/median/p99 per phase over the finished runs, and the counters that were used
+void timing_report(Timing *timing);
+
+// Write the per-run spans, counts and the aggregates as JSON when path ends in ".json", CSV otherwise
+int timing_write(Timing *timing, const char *path);
+
+const char *timing_phase_name(Phase phase);
+const char *timing_counter_name(Counter counter);
+
+#endif /* __TIMING_H__ */
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "treestats.h"
+
+#define LISTED_DPUS 64 // Partitions get a row each up to this many DPUs, a summary beyond
+
+static double mbr_area(const MBR *mbr)
+{
+    if (mbr->xmax <= mbr->xmin || mbr->ymax <= mbr->ymin)
+        return 0.0;
+    return ((double)mbr->xmax - mbr->xmin) * ((double)mbr->ymax - mbr->ymin);
+}
+
+static double intersection_area(const MBR *a, const MBR *b)
+{
+    MBR both = {a->xmin > b->xmin ? a->xmin : b->xmin, a->ymin > b->ymin ? a->ymin : b->ymin,
+                a->xmax < b->xmax ? a->xmax : b->xmax, a->ymax < b->ymax ? a->ymax : b->ymax};
+    return mbr_area(&both);
+}
+
+static TreeLevelStats *level_of(TreeStats *stats, int depth)
+{
+    return &stats->levels[depth < TREE_STATS_MAX_LEVELS ? depth : TREE_STATS_MAX_LEVELS - 1];
+}
+
+// Recursive function to add a node and its subtree to the level statistics
+static void walk(TreeStats *stats, Node *node, int depth, uint64_t *rng)
+{
+    TreeLevelStats *level = level_of(stats, depth);
+    int capacity = node->isLeaf ? (int)tree_params.bundlefactor : (int)tree_params.fanout;
+    int bucket = capacity > 0 ? node->count * TREE_STATS_FILL_BUCKETS / capacity : 0;
+    level->nodes++;
+    level->entries += node->count;
+    level->empty += node->count == 0;
+    level->fill[bucket < TREE_STATS_FILL_BUCKETS ? bucket : TREE_STATS_FILL_BUCKETS - 1]++;
+    level->area += mbr_area(&node->mbr);
+    stats->nodes++;
+    stats->depth = depth + 1 > stats->depth ? depth + 1 : stats->depth;
+    stats->host_bytes += sizeof(Node) + node->count * (node->isLeaf ? sizeof(Point) : sizeof(Node *));
+    if (node->isLeaf)
+    {
+        level->leaves++;
+        stats->points += node->count;
+        return;
+    }
+
+    // Siblings that overlap all have to be entered by a query in the shared area
+    TreeLevelStats *children = level_of(stats, depth + 1);
+    for (int i = 0; i < node->count; i++)
+    {
+        for (int j = i + 1; j < node->count; j++)
+            children->overlap += intersection_area(&node->children[i]->mbr, &node->children[j]->mbr);
+    }
+
+    // Dead space: the part of the MBR where a query passes this node but no child
+    if (mbr_area(&node->mbr) > 0.0)
+    {
+        for (int s = 0; s < TREE_STATS_DEAD_SPACE_SAMPLES; s++)
+        {
+            Point p;
+            p.x = node->mbr.xmin + (float)((next_random(rng) >> 11) * (1.0 / 9007199254740992.0) * (node->mbr.xmax - node->mbr.xmin));
+            p.y = node->mbr.ymin + (float)((next_random(rng) >> 11) * (1.0 / 9007199254740992.0) * (node->mbr.ymax - node->mbr.ymin));
+            bool covered = false;
+            for (int i = 0; i < node->count && !covered; i++)
+                covered = isPointInMBR(&node->children[i]->mbr, p);
+            level->dead_samples++;
+            level->dead_hits += !covered;
+        }
+    }
+
+    for (int i = 0; i < node->count; i++)
+        walk(stats, node->children[i], depth + 1, rng);
+}
+
+// Recursive function to search like searchRTree, counting the nodes entered on each level
+static bool count_visits(TreeStats *stats, Node *node, int depth, Point query)
+{
+    level_of(stats, depth)->visits++;
+    if (!isPointInMBR(&node->mbr, query))
+        return false;
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->count; i++)
+        {
+            if (node->points[i].x == query.x && node->points[i].y == query.y)
+                return true;
+        }
+        return false;
+    }
+    for (int i = 0; i < node->count; i++)
+    {
+        if (count_visits(stats, node->children[i], depth + 1, query))
+            return true;
+    }
+    return false;
+}
+
+// Function to pick every stride-th query so the sample spans the whole query set
+static int sample_stride(int num_queries, int sample_size)
+{
+    return sample_size > 0 && num_queries > sample_size ? num_queries / sample_size : 1;
+}
+
+void tree_stats_collect(TreeStats *stats, Node *root, const Point *queries, int num_queries, int sample_size)
+{
+    memset(stats, 0, sizeof(TreeStats));
+    if (root == NULL)
+        return;
+    uint64_t rng = 1;
+    walk(stats, root, 0, &rng);
+
+    int stride = sample_stride(num_queries, sample_size);
+    for (int q = 0; sample_size > 0 && q < num_queries && stats->sample < sample_size; q += stride)
+    {
+        count_visits(stats, root, 0, queries[q]);
+        stats->sample++;
+    }
+}
+
+void tree_stats_print(const TreeStats *stats)
+{
+    printf(ANSI_COLOR_LIGHT_BLUE "\nTree shape: depth %d, %d nodes, %lu points, %.1f KB on the host (fanout %u, bundlefactor %u)"
+           ANSI_COLOR_RESET "\n", stats->depth, stats->nodes, (unsigned long)stats->points, stats->host_bytes / 1024.0,
+           tree_params.fanout, tree_params.bundlefactor);
+    // The fill columns count nodes by entries over capacity, in steps of 20%
+    printf("%-6s %8s %8s %6s %10s  %7s%7s%7s%7s%7s %9s %11s %13s\n", "level", "nodes", "leaves", "empty", "mean fill", "<20%",
+           "<40%", "<60%", "<80%", "<=100%", "overlap", "dead space", "visits/query");
+
+    double total_visits = 0.0;
+    int levels = stats->depth < TREE_STATS_MAX_LEVELS ? stats->depth : TREE_STATS_MAX_LEVELS;
+    for (int l = 0; l < levels; l++)
+    {
+        const TreeLevelStats *level = &stats->levels[l];
+        double capacity = (double)level->leaves * tree_params.bundlefactor + (double)(level->nodes - level->leaves) * tree_params.fanout;
+        double visits = stats->sample > 0 ? (double)level->visits / stats->sample : 0.0;
+        total_visits += visits;
+        printf("%-6d %8d %8d %6d %9.1f%%  ", l, level->nodes, level->leaves, level->empty,
+               capacity > 0 ? 100.0 * level->entries / capacity : 0.0);
+        for (int b = 0; b < TREE_STATS_FILL_BUCKETS; b++)
+            printf(" %6d", level->fill[b]);
+        // Overlap is between siblings, so the root has none; leaves have no children to cover them
+        if (l > 0 && level->area > 0.0)
+            printf(" %8.1f%%", 100.0 * level->overlap / level->area);
+        else
+            printf(" %9s", "-");
+        if (level->dead_samples > 0)
+            printf(" %10.1f%%", 100.0 * level->dead_hits / level->dead_samples);
+        else
+            printf(" %11s", "-");
+        printf(" %13.2f\n", visits);
+    }
+    if (stats->sample > 0)
+    {
+        printf("Expected nodes visited per query in the pointer tree: %.2f over %d sampled queries\n", total_visits, stats->sample);
+    }
+}
+
+// Recursive function to find the depth of a serialized image, bounded so a corrupt one cannot loop
+static int serialized_depth(const SerializedNode *nodes, int num_nodes, int index, int depth)
+{
+    if (index < 0 || index >= num_nodes || depth >= TREE_STATS_MAX_LEVELS)
+        return 0;
+    const SerializedNode *node = &nodes[index];
+    int deepest = 0;
+    for (int i = 0; !node->isLeaf && i < node->count && i < FANOUT; i++)
+    {
+        int child = serialized_depth(nodes, num_nodes, node->children[i], depth + 1);
+        deepest = child > deepest ? child : deepest;
+    }
+    return deepest + 1;
+}
+
+void partition_stats_print(const Partition *partitions, Node *const *subtrees, const size_t *image_sizes, uint32_t nr_dpus,
+                           const Point *queries, int num_queries, int sample_size)
+{
+    if (nr_dpus == 0)
+        return;
+    uint64_t *visits = (uint64_t *)calloc(nr_dpus, sizeof(uint64_t));
+    uint64_t *rejected = (uint64_t *)calloc(nr_dpus, sizeof(uint64_t));
+    if (visits == NULL || rejected == NULL)
+    {
+        perror("Failed to allocate partition statistics");
+        exit(1);
+    }
+
+    // Every DPU searches every query it is sent; a partition whose root MBR misses costs one visit
+    int stride = sample_stride(num_queries, sample_size);
+    int sample = 0;
+    TreeStats scratch;
+    for (int q = 0; sample_size > 0 && q < num_queries && sample < sample_size; q += stride)
+    {
+        for (uint32_t d = 0; d < nr_dpus; d++)
+        {
+            if (subtrees[d] == NULL)
+                continue;
+            memset(scratch.levels, 0, sizeof(scratch.levels));
+            count_visits(&scratch, subtrees[d], 0, queries[q]);
+            for (int l = 0; l < TREE_STATS_MAX_LEVELS; l++)
+                visits[d] += scratch.levels[l].visits;
+            rejected[d] += !isPointInMBR(&subtrees[d]->mbr, queries[q]);
+        }
+        sample++;
+    }
+
+    size_t capacity = MAX_NODES * sizeof(SerializedNode);
+    size_t total_bytes = 0, max_bytes = 0, min_bytes = (size_t)-1;
+    int max_nodes = 0, min_nodes = -1, min_depth = -1, max_depth = 0, empty = 0;
+    uint64_t total_visits = 0, max_visits = 0, total_rejected = 0;
+    uint32_t largest = 0, busiest = 0;
+    bool listed = nr_dpus <= LISTED_DPUS;
+    if (listed)
+    {
+        printf("%-6s %10s %8s %6s %8s %6s %8s %13s\n", "dpu", "bytes", "nodes", "depth", "leaves", "empty", "points", "visits/query");
+    }
+    for (uint32_t d = 0; d < nr_dpus; d++)
+    {
+        const Partition *partition = &partitions[d];
+        int leaves = 0, empty_nodes = 0, depth = 0;
+        uint64_t points = 0;
+        for (int n = 0; n < partition->num_nodes; n++)
+        {
+            const SerializedNode *node = &partition->serialized[n];
+            leaves += node->isLeaf != 0;
+            empty_nodes += node->count == 0;
+            points += node->isLeaf ? (uint64_t)node->count : 0;
+        }
+        if (partition->num_nodes > 0)
+            depth = serialized_depth(partition->serialized, partition->num_nodes, 0, 0);
+
+        total_bytes += image_sizes[d];
+        if (image_sizes[d] > max_bytes)
+        {
+            max_bytes = image_sizes[d];
+            largest = d;
+        }
+        min_bytes = image_sizes[d] < min_bytes ? image_sizes[d] : min_bytes;
+        max_nodes = partition->num_nodes > max_nodes ? partition->num_nodes : max_nodes;
+        min_nodes = min_nodes < 0 || partition->num_nodes < min_nodes ? partition->num_nodes : min_nodes;
+        max_depth = depth > max_depth ? depth : max_depth;
+        min_depth = min_depth < 0 || depth < min_depth ? depth : min_depth;
+        empty += empty_nodes;
+        total_visits += visits[d];
+        total_rejected += rejected[d];
+        if (visits[d] > max_visits)
+        {
+            max_visits = visits[d];
+            busiest = d;
+        }
+        if (listed)
+        {
+            printf("%-6u %10zu %8d %6d %8d %6d %8lu %13.2f\n", d, image_sizes[d], partition->num_nodes, depth, leaves, empty_nodes,
+                   (unsigned long)points, sample > 0 ? (double)visits[d] / sample : 0.0);
+        }
+    }
+
+    double mean_visits = (double)total_visits / nr_dpus;
+    printf("Partitions on %u DPU(s): %zu bytes in all, %zu to %zu per DPU (DPU %u at %.1f%% of DPU_TREE)\n", nr_dpus, total_bytes,
+           min_bytes, max_bytes, largest, 100.0 * max_bytes / capacity);
+    if (max_nodes > 0)
+    {
+        printf("Serialized nodes %d to %d per DPU, depth %d to %d, %d empty node(s)\n", min_nodes, max_nodes, min_depth, max_depth,
+               empty);
+    }
+    else
+    {
+        printf("Leaf-only images, no serialized tree shape to report\n");
+    }
+    if (sample > 0)
+    {
+        printf("Expected nodes visited per query on the DPUs: %.2f over all of them (%.2f of those root MBR misses), "
+               "busiest DPU %u with %.2f (max/mean %.2f)\n",
+               (double)total_visits / sample, (double)total_rejected / sample, busiest, (double)max_visits / sample,
+               mean_visits > 0 ? max_visits / mean_visits : 0.0);
+    }
+    free(rejected);
+    free(visits);
+}
@@ -0,0 +1,52 @@
+#ifndef __TREESTATS_H__
+#define __TREESTATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "rtree.h"
+#include "update.h"
+
+#define TREE_STATS_MAX_LEVELS 16
+#define TREE_STATS_FILL_BUCKETS 5         // Node fill in fifths of the capacity, full nodes in the last
+#define TREE_STATS_DEAD_SPACE_SAMPLES 64  // Points drawn in each internal node's MBR to measure dead space
+
+/* Shape of one level of the pointer tree, the root being level 0 */
+typedef struct TreeLevelStats
+{
+    int nodes;
+    int leaves;
+    int empty;
+    uint64_t entries;                     // Children or points
+    int fill[TREE_STATS_FILL_BUCKETS];    // Nodes by entries over the capacity of their kind
+    double area;                          // Sum of the MBR areas
+    double overlap;                       // Pairwise intersection area of sibling MBRs
+    uint64_t dead_samples;                // Points drawn in the MBRs of the level's internal nodes
+    uint64_t dead_hits;                   // Of those, points no child MBR holds
+    uint64_t visits;                      // Nodes of the level the query sample entered
+} TreeLevelStats;
+
+/* Quality and footprint of a pointer tree and of its DPU partitions */
+typedef struct TreeStats
+{
+    int depth; // Levels
+    int nodes;
+    uint64_t points;
+    size_t host_bytes; // Nodes with their child and point arrays
+    TreeLevelStats levels[TREE_STATS_MAX_LEVELS];
+    int sample; // Queries the visit counts are over
+} TreeStats;
+
+// Walk the tree level by level and search sample_size of the queries (evenly spread) to count the
+// nodes a query enters on each level, the way searchRTree descends
+void tree_stats_collect(TreeStats *stats, Node *root, const Point *queries, int num_queries, int sample_size);
+
+void tree_stats_print(const TreeStats *stats);
+
+// Shape, bytes and expected visits of each DPU's partition: partitions[d] is the serialized image
+// (num_nodes 0 for leaf-only hybrid images), image_sizes[d] what DPU d receives and subtrees[d]
+// the pointer subtree it came from, searched with the same query sample
+void partition_stats_print(const Partition *partitions, Node *const *subtrees, const size_t *image_sizes, uint32_t nr_dpus,
+                           const Point *queries, int num_queries, int sample_size);
+
+#endif /* __TREESTATS_H__ */
@@ -0,0 +1,531 @@
+#include <dpu.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "rtree.h"
+#include "update.h"
+
+// Function to check if an MBR has never been extended
+static bool isEmptyMBR(MBR *mbr)
+{
+    return mbr->xmin > mbr->xmax;
+}
+
+// Function to compute the area of an MBR (0 for an empty one)
+static double areaMBR(MBR *mbr)
+{
+    if (isEmptyMBR(mbr))
+        return 0.0;
+    return ((double)mbr->xmax - mbr->xmin) * ((double)mbr->ymax - mbr->ymin);
+}
+
+// Function to grow an MBR so it also covers another one
+static void extendMBR(MBR *mbr, MBR *other)
+{
+    if (isEmptyMBR(other))
+        return;
+    if (other->xmin < mbr->xmin)
+        mbr->xmin = other->xmin;
+    if (other->ymin < mbr->ymin)
+        mbr->ymin = other->ymin;
+    if (other->xmax > mbr->xmax)
+        mbr->xmax = other->xmax;
+    if (other->ymax > mbr->ymax)
+        mbr->ymax = other->ymax;
+}
+
+// Function to compute how much an MBR grows when it has to cover another one
+static double enlargement(MBR *mbr, MBR *other)
+{
+    MBR grown = *mbr;
+    extendMBR(&grown, other);
+    return areaMBR(&grown) - areaMBR(mbr);
+}
+
+static MBR pointMBR(Point p)
+{
+    MBR mbr = {p.x, p.y, p.x, p.y};
+    return mbr;
+}
+
+// Function to recompute the MBR of a node from its entries
+static void recomputeMBR(Node *node)
+{
+    initMBR(&node->mbr);
+    for (int i = 0; i < node->count; i++)
+    {
+        if (node->isLeaf)
+            updateMBRWithPoint(&node->mbr, node->points[i]);
+        else
+            extendMBR(&node->mbr, &node->children[i]->mbr);
+    }
+}
+
+// Function to find the slot holding the subtree of a partition
+static Node **partitionSlot(Node *root, int partition)
+{
+    if (root->isLeaf || partition >= root->count)
+        return NULL;
+    return &root->children[partition];
+}
+
+// Guttman's quadratic split: assign each of n entries to group 0 or 1,
+// keeping at least min_fill entries in each group
+static void quadraticSplit(MBR *entries, int n, int min_fill, int *group)
+{
+    int seed0 = 0, seed1 = 1;
+    double worst = -1.0;
+
+    // PickSeeds: the pair that would waste the most area if kept together
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = i + 1; j < n; j++)
+        {
+            MBR both = entries[i];
+            extendMBR(&both, &entries[j]);
+            double waste = areaMBR(&both) - areaMBR(&entries[i]) - areaMBR(&entries[j]);
+            if (waste > worst)
+            {
+                worst = waste;
+                seed0 = i;
+                seed1 = j;
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+        group[i] = -1;
+    group[seed0] = 0;
+    group[seed1] = 1;
+    MBR cover[2] = {entries[seed0], entries[seed1]};
+    int size[2] = {1, 1};
+    int remaining = n - 2;
+
+    while (remaining > 0)
+    {
+        // If one group needs every remaining entry to reach the minimum fill, give them all to it
+        for (int g = 0; g < 2 && remaining > 0; g++)
+        {
+            if (size[g] + remaining <= min_fill)
+            {
+                for (int i = 0; i < n; i++)
+                {
+                    if (group[i] == -1)
+                    {
+                        group[i] = g;
+                        size[g]++;
+                    }
+                }
+                remaining = 0;
+            }
+        }
+        if (remaining == 0)
+            break;
+
+        // PickNext: the entry with the strongest preference for one of the groups
+        int next = -1;
+        double best_diff = -1.0;
+        for (int i = 0; i < n; i++)
+        {
+            if (group[i] != -1)
+                continue;
+            double diff = fabs(enlargement(&cover[0], &entries[i]) - enlargement(&cover[1], &entries[i]));
+            if (diff > best_diff)
+            {
+                best_diff = diff;
+                next = i;
+            }
+        }
+
+        double grow0 = enlargement(&cover[0], &entries[next]);
+        double grow1 = enlargement(&cover[1], &entries[next]);
+        int g;
+        if (grow0 != grow1)
+            g = grow0 < grow1 ? 0 : 1;
+        else if (areaMBR(&cover[0]) != areaMBR(&cover[1]))
+            g = areaMBR(&cover[0]) < areaMBR(&cover[1]) ? 0 : 1;
+        else
+            g = size[0] <= size[1] ? 0 : 1;
+
+        group[next] = g;
+        extendMBR(&cover[g], &entries[next]);
+        size[g]++;
+        remaining--;
+    }
+}
+
+// Function to split an overfull node in two; the node keeps group 0 and the new sibling gets group 1
+static Node *splitNode(Node *node)
+{
+    int n = node->count;
+    MBR *entries = (MBR *)malloc(n * sizeof(MBR));
+    int *group = (int *)malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++)
+        entries[i] = node->isLeaf ? pointMBR(node->points[i]) : node->children[i]->mbr;
+    quadraticSplit(entries, n, node->isLeaf ? MIN_LEAF_FILL : MIN_NODE_FILL, group);
+
+    Node *sibling = (Node *)malloc(sizeof(Node));
+    sibling->isLeaf = node->isLeaf;
+    sibling->count = 0;
+    int kept = 0;
+    if (node->isLeaf)
+    {
+        sibling->points = (Point *)malloc(n * sizeof(Point));
+        for (int i = 0; i < n; i++)
+        {
+            if (group[i] == 0)
+                node->points[kept++] = node->points[i];
+            else
+                sibling->points[sibling->count++] = node->points[i];
+        }
+    }
+    else
+    {
+        sibling->children = (Node **)malloc(n * sizeof(Node *));
+        for (int i = 0; i < n; i++)
+        {
+            if (group[i] == 0)
+                node->children[kept++] = node->children[i];
+            else
+                sibling->children[sibling->count++] = node->children[i];
+        }
+    }
+    node->count = kept;
+    recomputeMBR(node);
+    recomputeMBR(sibling);
+
+    free(entries);
+    free(group);
+    return sibling;
+}
+
+// Function to pick, among the first count children, the one needing the least enlargement to cover p
+// (ties: smaller area)
+static int chooseSubtree(Node *node, int count, Point p)
+{
+    MBR target = pointMBR(p);
+    int best = -1;
+    double best_grow = 0.0, best_area = 0.0;
+
+    for (int i = 0; i < count; i++)
+    {
+        MBR *mbr = &node->children[i]->mbr;
+        if (isEmptyMBR(mbr))
+            continue; // Empty children from the bulk load are only used as a last resort
+        double grow = enlargement(mbr, &target);
+        double area = areaMBR(mbr);
+        if (best == -1 || grow < best_grow || (grow == best_grow && area < best_area))
+        {
+            best = i;
+            best_grow = grow;
+            best_area = area;
+        }
+    }
+    return best == -1 ? 0 : best;
+}
+
+// Recursive insert; returns the new sibling when node had to be split, NULL otherwise
+static Node *insertRecursive(Node *node, Point p)
+{
+    updateMBRWithPoint(&node->mbr, p);
+
+    if (node->isLeaf)
+    {
+        node->points = (Point *)realloc(node->points, (node->count + 1) * sizeof(Point));
+        node->points[node->count++] = p;
+        return node->count > (int)tree_params.bundlefactor ? splitNode(node) : NULL;
+    }
+
+    Node *sibling = insertRecursive(node->children[chooseSubtree(node, node->count, p)], p);
+    if (sibling == NULL)
+        return NULL;
+
+    node->children = (Node **)realloc(node->children, (node->count + 1) * sizeof(Node *));
+    node->children[node->count++] = sibling;
+    return node->count > (int)tree_params.fanout ? splitNode(node) : NULL;
+}
+
+// Function to insert a point into the subtree stored in *slot, growing a new subtree root on split
+static void insertIntoSlot(Node **slot, Point p)
+{
+    Node *sibling = insertRecursive(*slot, p);
+    if (sibling == NULL)
+        return;
+
+    Node *newRoot = (Node *)malloc(sizeof(Node));
+    newRoot->isLeaf = 0;
+    newRoot->count = 2;
+    newRoot->children = (Node **)malloc(2 * sizeof(Node *));
+    newRoot->children[0] = *slot;
+    newRoot->children[1] = sibling;
+    recomputeMBR(newRoot);
+    *slot = newRoot;
+}
+
+int choosePartition(Node *root, int num_partitions, Point p)
+{
+    if (root->isLeaf || root->count == 0)
+        return -1;
+
+    // Only route to subtrees that are actually held by a DPU
+    int count = root->count < num_partitions ? root->count : num_partitions;
+    return chooseSubtree(root, count, p);
+}
+
+void insertIntoSubtree(Node **subtree, Point p)
+{
+    insertIntoSlot(subtree, p);
+}
+
+void insertIntoPartition(Node *root, int partition, Point p)
+{
+    insertIntoSlot(partitionSlot(root, partition), p);
+    updateMBRWithPoint(&root->mbr, p);
+}
+
+void replacePartition(Node *root, int partition, Node *subtree)
+{
+    Node **slot = partitionSlot(root, partition);
+    if (slot == NULL)
+        return;
+    freeRTree(*slot);
+    *slot = subtree;
+    recomputeMBR(root);
+}
+
+int insertPoint(Node *root, Partition *partitions, int num_partitions, Point p)
+{
+    int partition = choosePartition(root, num_partitions, p);
+    if (partition < 0)
+        return -1;
+
+    insertIntoPartition(root, partition, p);
+    partitions[partition].dirty = true;
+    return partition;
+}
+
+// Function to append every point of a subtree to a growable array
+static void collectPoints(Node *node, Point **points, int *num_points, int *capacity)
+{
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->count; i++)
+        {
+            if (*num_points == *capacity)
+            {
+                *capacity = *capacity ? *capacity * 2 : 64;
+                *points = (Point *)realloc(*points, *capacity * sizeof(Point));
+            }
+            (*points)[(*num_points)++] = node->points[i];
+        }
+        return;
+    }
+    for (int i = 0; i < node->count; i++)
+        collectPoints(node->children[i], points, num_points, capacity);
+}
+
+// Recursive delete with condensing: underfull children are dissolved and their points
+// appended to orphans for reinsertion. Returns true if p was removed below node.
+static bool deleteRecursive(Node *node, Point p, Point **orphans, int *num_orphans, int *capacity)
+{
+    if (!isPointInMBR(&node->mbr, p))
+        return false;
+
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->count; i++)
+        {
+            if (node->points[i].x == p.x && node->points[i].y == p.y)
+            {
+                node->points[i] = node->points[--node->count];
+                recomputeMBR(node);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (int i = 0; i < node->count; i++)
+    {
+        Node *child = node->children[i];
+        if (!deleteRecursive(child, p, orphans, num_orphans, capacity))
+            continue;
+
+        if (child->count < (child->isLeaf ? MIN_LEAF_FILL : MIN_NODE_FILL))
+        {
+            collectPoints(child, orphans, num_orphans, capacity);
+            freeRTree(child);
+            node->children[i] = node->children[--node->count];
+        }
+        recomputeMBR(node);
+        return true;
+    }
+    return false;
+}
+
+bool deleteFromSubtree(Node **slot, Point p)
+{
+    Point *orphans = NULL;
+    int num_orphans = 0, capacity = 0;
+    if (!deleteRecursive(*slot, p, &orphans, &num_orphans, &capacity))
+        return false;
+
+    // The subtree root is exempt from the minimum fill, but shorten it when it has a single child
+    Node *subtree = *slot;
+    while (!subtree->isLeaf && subtree->count == 1)
+    {
+        *slot = subtree->children[0];
+        free(subtree->children);
+        free(subtree);
+        subtree = *slot;
+    }
+    if (!subtree->isLeaf && subtree->count == 0)
+    {
+        subtree->isLeaf = 1;
+        free(subtree->children);
+        subtree->points = NULL;
+        initMBR(&subtree->mbr);
+    }
+
+    for (int i = 0; i < num_orphans; i++)
+        insertIntoSlot(slot, orphans[i]);
+    free(orphans);
+    return true;
+}
+
+bool deleteFromPartition(Node *root, int partition, Point p)
+{
+    Node **slot = partitionSlot(root, partition);
+    if (slot == NULL || !deleteFromSubtree(slot, p))
+        return false;
+    recomputeMBR(root);
+    return true;
+}
+
+int deletePoint(Node *root, Partition *partitions, int num_partitions, Point p)
+{
+    if (root->isLeaf)
+        return -1;
+
+    int count = root->count < num_partitions ? root->count : num_partitions;
+    for (int partition = 0; partition < count; partition++)
+    {
+        if (deleteFromPartition(root, partition, p))
+        {
+            partitions[partition].dirty = true;
+            return partition;
+        }
+    }
+    return -1;
+}
+
+int applyUpdatesFromFile(const char *filename, Node *root, Partition *partitions, int num_partitions,
+                         QueryCache *cache, int *inserted, int *deleted)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        perror("Unable to open update file");
+        return -1;
+    }
+
+    // One operation per line: "i x,y" inserts the point, "d x,y" deletes one occurrence of it
+    char op;
+    Point p;
+    int applied = 0;
+    *inserted = 0;
+    *deleted = 0;
+    while (fscanf(file, " %c %f, %f", &op, &p.x, &p.y) == 3)
+    {
+        if (cache != NULL)
+        {
+            query_cache_invalidate(cache, p);
+        }
+        if (op == 'i' && insertPoint(root, partitions, num_partitions, p) >= 0)
+        {
+            (*inserted)++;
+            applied++;
+        }
+        else if (op == 'd' && deletePoint(root, partitions, num_partitions, p) >= 0)
+        {
+            (*deleted)++;
+            applied++;
+        }
+    }
+    fclose(file);
+    return applied;
+}
+
+int serialize_partition(Node *subtree, SerializedNode **image)
+{
+    int num_nodes = countNodesInSubtree(subtree);
+    if (num_nodes > MAX_NODES)
+    {
+        printf("Partition grew to %d nodes, more than the %d DPU_TREE can hold\n", num_nodes, MAX_NODES);
+        return -1;
+    }
+    return serialize_rtree_wrapper(subtree, image, num_nodes);
+}
+
+bool push_partition_delta(struct dpu_set_t dpu, Node *subtree, Partition *partition, DeltaStats *stats)
+{
+    SerializedNode *image;
+    int num_nodes = serialize_partition(subtree, &image);
+    if (num_nodes < 0)
+        return false;
+
+    push_image_delta(dpu, image, num_nodes, partition, stats);
+    return true;
+}
+
+void push_image_delta(struct dpu_set_t dpu, SerializedNode *image, int num_nodes, Partition *partition, DeltaStats *stats)
+{
+    // Rewrite runs of nodes that differ from the resident image, merging runs separated by small gaps
+    TreeHeader header;
+    bool invalidated = false;
+    int i = 0;
+    while (i < num_nodes)
+    {
+        if (i < partition->num_nodes && memcmp(&image[i], &partition->serialized[i], sizeof(SerializedNode)) == 0)
+        {
+            i++;
+            continue;
+        }
+
+        int first = i, last = i;
+        for (int j = i + 1; j < num_nodes && j - last <= DELTA_MERGE_GAP; j++)
+        {
+            if (j >= partition->num_nodes || memcmp(&image[j], &partition->serialized[j], sizeof(SerializedNode)) != 0)
+                last = j;
+        }
+
+        // The old header describes a complete tree, so it must not survive the first rewritten node
+        if (!invalidated)
+        {
+            memset(&header, 0, sizeof(TreeHeader));
+            DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE_HEADER", 0, &header, sizeof(TreeHeader)));
+            stats->bytes += sizeof(TreeHeader);
+            invalidated = true;
+        }
+        size_t size = (size_t)(last - first + 1) * sizeof(SerializedNode);
+        DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE", first * sizeof(SerializedNode), &image[first], size));
+        stats->ranges++;
+        stats->nodes += last - first + 1;
+        stats->bytes += size;
+        i = last + 1;
+    }
+
+    // The header goes last, as on a full push, so a valid header never covers unwritten nodes
+    make_tree_header(&header, image, num_nodes);
+    DPU_ASSERT(dpu_copy_to(dpu, "DPU_TREE_HEADER", 0, &header, sizeof(TreeHeader)));
+    stats->bytes += sizeof(TreeHeader);
+
+    free(partition->serialized);
+    partition->serialized = image;
+    partition->num_nodes = num_nodes;
+    partition->dirty = false;
+}
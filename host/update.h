@@ -0,0 +1,66 @@
+#ifndef __UPDATE_H__
+#define __UPDATE_H__
+
+#include <dpu.h>
+#include <stdbool.h>
+#include "querycache.h"
+#include "rtree.h"
+
+#define DELTA_MERGE_GAP 4 // Unchanged nodes tolerated inside one delta transfer
+
+/* Host copy of the serialized subtree a DPU holds, used to compute delta pushes */
+typedef struct Partition
+{
+    SerializedNode *serialized; // Image currently resident in the DPU's MRAM
+    int num_nodes;              // Number of nodes in the image
+    bool dirty;                 // Subtree changed since the image was pushed
+} Partition;
+
+/* Transfer volume of one delta push */
+typedef struct DeltaStats
+{
+    int ranges;   // Number of MRAM writes issued
+    int nodes;    // Number of nodes rewritten
+    size_t bytes; // Bytes written to MRAM, header included
+} DeltaStats;
+
+// Pick the partition whose subtree needs the least enlargement to cover p, -1 when the root is a leaf
+int choosePartition(Node *root, int num_partitions, Point p);
+
+// Insert p into / delete one occurrence of p from the subtree of one partition
+void insertIntoPartition(Node *root, int partition, Point p);
+bool deleteFromPartition(Node *root, int partition, Point p);
+
+// The same on a subtree held outside the tree, e.g. a copy of a partition; *subtree may get a new root
+void insertIntoSubtree(Node **subtree, Point p);
+bool deleteFromSubtree(Node **subtree, Point p);
+
+// Install subtree as the subtree of one partition, freeing the one it replaces
+void replacePartition(Node *root, int partition, Node *subtree);
+
+// Insert p into the partition whose subtree needs the least enlargement.
+// Returns the partition index, or -1 when the tree has no partitions.
+int insertPoint(Node *root, Partition *partitions, int num_partitions, Point p);
+
+// Delete one occurrence of p. Returns the partition index it was removed from, or -1 if absent.
+int deletePoint(Node *root, Partition *partitions, int num_partitions, Point p);
+
+// Apply the insert ("i x,y") and delete ("d x,y") lines of a file to the host tree, dropping the
+// cached result of every point touched when cache is not NULL.
+// Returns the number of operations applied, or -1 if the file cannot be read.
+int applyUpdatesFromFile(const char *filename, Node *root, Partition *partitions, int num_partitions,
+                         QueryCache *cache, int *inserted, int *deleted);
+
+// Serialize the subtree of a partition into a new image. Returns the node count, or -1 when the
+// subtree no longer fits in DPU_TREE.
+int serialize_partition(Node *subtree, SerializedNode **image);
+
+// Rewrite only the MRAM node ranges of image that differ from the resident image, then the header.
+// The partition takes ownership of image.
+void push_image_delta(struct dpu_set_t dpu, SerializedNode *image, int num_nodes, Partition *partition, DeltaStats *stats);
+
+// Re-serialize a dirty partition and rewrite only the MRAM node ranges that differ from the
+// resident image. Returns false when the subtree no longer fits in DPU_TREE.
+bool push_partition_delta(struct dpu_set_t dpu, Node *subtree, Partition *partition, DeltaStats *stats);
+
+#endif /* __UPDATE_H__ */
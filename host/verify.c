@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "verify.h"
+
+Point *verify_make_queries(const Point *queries, int *num_queries, const Point *points, int num_points, int num_generated,
+                           uint64_t seed)
+{
+    if (num_points <= 0)
+        num_generated = 0;
+    int total = *num_queries + 2 * num_generated;
+    Point *all = (Point *)malloc((total > 0 ? total : 1) * sizeof(Point));
+    if (all == NULL)
+    {
+        perror("Failed to allocate verification queries");
+        exit(1);
+    }
+    memcpy(all, queries, *num_queries * sizeof(Point));
+
+    MBR extent;
+    initMBR(&extent);
+    for (int i = 0; i < num_points; i++)
+        updateMBRWithPoint(&extent, points[i]);
+
+    uint64_t state = seed ? seed : 1;
+    Point *hits = all + *num_queries;
+    Point *probes = hits + num_generated;
+    for (int i = 0; i < num_generated; i++)
+    {
+        hits[i] = points[next_random(&state) % (uint64_t)num_points];
+        Point p = points[next_random(&state) % (uint64_t)num_points];
+        switch (i % 3)
+        {
+        case 0:
+            p.x += 0.5f; // Off the integer grid, never matches a quantized tree
+            break;
+        case 1:
+            p.x = extent.xmax + 1.0f + (float)(i % 1000); // Outside every MBR
+            break;
+        default:
+            p.y += 1.0f; // Next grid point, which may or may not be stored
+            break;
+        }
+        probes[i] = p;
+    }
+    *num_queries = total;
+    return all;
+}
+
+void verify_init(VerifyReport *report, int num_queries, int num_hits, int num_probes, bool check_hits)
+{
+    memset(report, 0, sizeof(VerifyReport));
+    report->num_queries = num_queries;
+    report->num_hits = num_hits;
+    report->num_probes = num_probes;
+    report->check_hits = check_hits;
+}
+
+static VerifyEngine *add_engine(VerifyReport *report, const char *name, double time)
+{
+    if (report->num_engines == VERIFY_MAX_ENGINES)
+        return NULL;
+    VerifyEngine *engine = &report->engines[report->num_engines++];
+    snprintf(engine->name, sizeof(engine->name), "%s", name);
+    engine->time = time;
+    engine->mismatches = 0;
+    return engine;
+}
+
+void verify_reference(VerifyReport *report, const char *name, double time, const uint8_t *found)
+{
+    VerifyEngine *engine = add_engine(report, name, time);
+    if (engine != NULL)
+        engine->mismatches = -1;
+
+    int first_hit = report->num_queries - report->num_hits - report->num_probes;
+    report->missed_hits = 0;
+    for (int q = first_hit; report->check_hits && q < first_hit + report->num_hits; q++)
+        report->missed_hits += !found[q];
+}
+
+bool verify_engine(VerifyReport *report, const char *name, double time, const uint8_t *found, const uint8_t *reference,
+                   const Point *queries)
+{
+    int mismatches = 0;
+    for (int q = 0; q < report->num_queries; q++)
+    {
+        if (found[q] == reference[q])
+            continue;
+        if (mismatches++ < VERIFY_MAX_REPORTED)
+        {
+            printf("Query %d (%.1f, %.1f) " ANSI_COLOR_RED "MISMATCH" ANSI_COLOR_RESET ": %s says %s\n", q, queries[q].x,
+                   queries[q].y, name, found[q] ? "found" : "not found");
+        }
+    }
+    VerifyEngine *engine = add_engine(report, name, time);
+    if (engine != NULL)
+        engine->mismatches = mismatches;
+    return mismatches == 0;
+}
+
+// Recursive function to search a float image (SerializedNode array), as searchSerializedTree in test2.c
+static bool search_float(const SerializedNode *nodes, int num_nodes, int index, Point query)
+{
+    if (index < 0 || index >= num_nodes)
+        return false;
+    const SerializedNode *node = &nodes[index];
+    if (!(query.x >= node->mbr.xmin && query.x <= node->mbr.xmax && query.y >= node->mbr.ymin && query.y <= node->mbr.ymax))
+        return false;
+
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->count && i < BUNDLEFACTOR; i++)
+        {
+            if (node->points[i].x == query.x && node->points[i].y == query.y)
+                return true;
+        }
+        return false;
+    }
+    for (int i = 0; i < node->count && i < FANOUT; i++)
+    {
+        if (search_float(nodes, num_nodes, node->children[i], query))
+            return true;
+    }
+    return false;
+}
+
+// Recursive function to search a TREE_ENCODING_U32 image (QuantizedNode array)
+static bool search_quantized(const QuantizedNode *nodes, int num_nodes, int index, QPoint query)
+{
+    if (index < 0 || index >= num_nodes)
+        return false;
+    const QuantizedNode *node = &nodes[index];
+    if (!(query.x >= node->mbr.xmin && query.x <= node->mbr.xmax && query.y >= node->mbr.ymin && query.y <= node->mbr.ymax))
+        return false;
+
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->count && i < BUNDLEFACTOR; i++)
+        {
+            if (node->points[i].x == query.x && node->points[i].y == query.y)
+                return true;
+        }
+        return false;
+    }
+    for (int i = 0; i < node->count && i < FANOUT; i++)
+    {
+        if (search_quantized(nodes, num_nodes, node->children[i], query))
+            return true;
+    }
+    return false;
+}
+
+// Recursive function to search a TREE_ENCODING_REL16 stream; offset is the node's position in words
+static bool search_relative(const uint64_t *words, size_t num_words, uint32_t offset, QPoint query)
+{
+    // A corrupt offset or count must read as a miss, not outside the image
+    if ((size_t)offset * sizeof(uint64_t) + sizeof(RelNode) > num_words * sizeof(uint64_t))
+        return false;
+    const RelNode *node = (const RelNode *)(words + offset);
+    size_t end = offset * sizeof(uint64_t) + sizeof(RelNode) + (size_t)node->count * (node->flags & REL_WIDE ? sizeof(QPoint) : sizeof(uint32_t));
+    if (end > num_words * sizeof(uint64_t))
+        return false;
+    if (!(query.x >= node->mbr.xmin && query.x <= node->mbr.xmax && query.y >= node->mbr.ymin && query.y <= node->mbr.ymax))
+        return false;
+
+    if (node->flags & REL_WIDE)
+    {
+        const QPoint *points = (const QPoint *)(node + 1);
+        for (uint32_t i = 0; i < node->count; i++)
+        {
+            if (points[i].x == query.x && points[i].y == query.y)
+                return true;
+        }
+        return false;
+    }
+    const uint32_t *entries = (const uint32_t *)(node + 1);
+    if (node->flags & REL_LEAF)
+    {
+        uint32_t packed = REL_PACK(query.x - node->mbr.xmin, query.y - node->mbr.ymin);
+        for (uint32_t i = 0; i < node->count; i++)
+        {
+            if (entries[i] == packed)
+                return true;
+        }
+        return false;
+    }
+    for (uint32_t i = 0; i < node->count; i++)
+    {
+        if (search_relative(words, num_words, entries[i], query))
+            return true;
+    }
+    return false;
+}
+
+bool verify_search_image(uint32_t encoding, const void *image, size_t image_size, EncodedPoint query)
+{
+    if (image == NULL || image_size == 0)
+        return false;
+    switch (encoding)
+    {
+    case TREE_ENCODING_FLOAT:
+        return search_float((const SerializedNode *)image, (int)(image_size / sizeof(SerializedNode)), 0, query.f);
+    case TREE_ENCODING_U32:
+        return search_quantized((const QuantizedNode *)image, (int)(image_size / sizeof(QuantizedNode)), 0, query.q);
+    case TREE_ENCODING_REL16:
+        return search_relative((const uint64_t *)image, image_size / sizeof(uint64_t), 0, query.q);
+    default:
+        return false;
+    }
+}
+
+bool verify_print(const VerifyReport *report)
+{
+    bool agreed = report->missed_hits == 0;
+    printf(ANSI_COLOR_LIGHT_BLUE "\nDifferential check of %d queries: %d from the query set, %d stored points, %d probes next to them"
+           ANSI_COLOR_RESET "\n", report->num_queries, report->num_queries - report->num_hits - report->num_probes, report->num_hits,
+           report->num_probes);
+    printf("%-40s %14s %14s %12s\n", "engine", "time (μs)", "queries/s", "mismatches");
+    for (int e = 0; e < report->num_engines; e++)
+    {
+        const VerifyEngine *engine = &report->engines[e];
+        char mismatches[16];
+        if (engine->mismatches < 0)
+            snprintf(mismatches, sizeof(mismatches), "reference");
+        else
+            snprintf(mismatches, sizeof(mismatches), "%d", engine->mismatches);
+        agreed = agreed && engine->mismatches <= 0;
+        if (engine->time > 0)
+            printf("%-40s %14.3f %14.0f %12s\n", engine->name, engine->time * 1000000, report->num_queries / engine->time, mismatches);
+        else
+            printf("%-40s %14s %14s %12s\n", engine->name, "-", "-", mismatches);
+    }
+    if (report->missed_hits > 0)
+    {
+        printf(ANSI_COLOR_RED "%d stored points not found by the reference" ANSI_COLOR_RESET "\n", report->missed_hits);
+    }
+    printf("%s\n", agreed ? ANSI_COLOR_GREEN "All engines agree" ANSI_COLOR_RESET : ANSI_COLOR_RED "Engines disagree" ANSI_COLOR_RESET);
+    return agreed;
+}
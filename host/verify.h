@@ -0,0 +1,56 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "rtree.h"
+
+#define VERIFY_MAX_ENGINES 8
+#define VERIFY_MAX_REPORTED 10 // Mismatching queries printed per engine
+#define VERIFY_SEED 1          // Draw of the generated queries
+
+/* Answers of one search path, held against the pointer tree's */
+typedef struct VerifyEngine
+{
+    char name[64];
+    double time;    // Seconds to answer the whole query set, 0 when not timed on its own
+    int mismatches; // -1 for the reference itself
+} VerifyEngine;
+
+/* Differential check of every search path of a session over the same query set */
+typedef struct VerifyReport
+{
+    int num_queries;
+    int num_hits;   // Generated from stored points, each one must be found
+    int num_probes; // Generated next to stored points
+    bool check_hits; // Off when updates may have deleted some of the stored points
+    int missed_hits;
+    int num_engines;
+    VerifyEngine engines[VERIFY_MAX_ENGINES];
+} VerifyReport;
+
+// Copy the query set to a new array followed by num_generated stored points and num_generated
+// probes next to stored points (half a unit off, just outside the data set, or one unit off).
+// The draw is seeded so every run checks the same queries. Returns the array, *num_queries grows.
+Point *verify_make_queries(const Point *queries, int *num_queries, const Point *points, int num_points, int num_generated,
+                           uint64_t seed);
+
+void verify_init(VerifyReport *report, int num_queries, int num_hits, int num_probes, bool check_hits);
+
+// Record the reference answers; generated stored points it does not find count as missed hits
+void verify_reference(VerifyReport *report, const char *name, double time, const uint8_t *found);
+
+// Compare an engine against the reference, printing the first mismatching queries. False on any mismatch.
+bool verify_engine(VerifyReport *report, const char *name, double time, const uint8_t *found, const uint8_t *reference,
+                   const Point *queries);
+
+// Search one serialized tree image on the host: the exact bytes a DPU holds, in any encoding but
+// TREE_ENCODING_LEAVES. The query is encoded like the tree.
+bool verify_search_image(uint32_t encoding, const void *image, size_t image_size, EncodedPoint query);
+
+// Throughput and mismatch table of all engines, true when every engine agreed with the reference
+bool verify_print(const VerifyReport *report);
+
+#endif /* __VERIFY_H__ */
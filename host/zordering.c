@@ -3,57 +3,89 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include "common.h"
 
+// Function to spread the bits of a 32-bit value over the even bits of a 64-bit one
+static uint64_t spreadBits(uint32_t v) {
+    uint64_t x = v;
+    x = (x ^ (x << 16)) & 0x0000ffff0000ffff;
+    x = (x ^ (x << 8))  & 0x00ff00ff00ff00ff;
+    x = (x ^ (x << 4))  & 0x0f0f0f0f0f0f0f0f;
+    x = (x ^ (x << 2))  & 0x3333333333333333;
+    x = (x ^ (x << 1))  & 0x5555555555555555;
+    return x;
+}
 
-typedef struct {
-    int x, y;
-} Point;
+// Function to scale a coordinate to 32 bits over [min, min + size], clamping what lies outside
+static uint32_t scaleToGrid(double v, double min, double size) {
+    if (size <= 0 || v <= min)
+        return 0;
+    if (v >= min + size)
+        return 4294967295u;
+    return (uint32_t)((v - min) / size * 4294967295.0);
+}
 
-// Function to compute Z-value (Morton code) of a point
-int Zval(Point P) {    
-    int x = P.x;
-    x = (x ^ (x << 16)) & 0x0000ffff0000ffff; 
-    x = (x ^ (x << 8))  & 0x00ff00ff00ff00ff; 
-    x = (x ^ (x << 4))  & 0x0f0f0f0f0f0f0f0f; 
-    x = (x ^ (x << 2))  & 0x3333333333333333; 
-    x = (x ^ (x << 1))  & 0x5555555555555555; 
-    
-    int y = P.y;
-    y = (y ^ (y << 16)) & 0x0000ffff0000ffff; 
-    y = (y ^ (y << 8))  & 0x00ff00ff00ff00ff; 
-    y = (y ^ (y << 4))  & 0x0f0f0f0f0f0f0f0f; 
-    y = (y ^ (y << 2))  & 0x3333333333333333; 
-    y = (y ^ (y << 1))  & 0x5555555555555555; 
-    
-    return (y << 1) | x;
+// Function to compute Z-value (Morton code) of a point, coordinates scaled to 32 bits over the data set's extent
+uint64_t Zval(Point P, const MBR *extent) {
+    uint32_t x = scaleToGrid(P.x, extent->xmin, (double)extent->xmax - extent->xmin);
+    uint32_t y = scaleToGrid(P.y, extent->ymin, (double)extent->ymax - extent->ymin);
+    return (spreadBits(y) << 1) | spreadBits(x);
 }
 
 // Struct to store Z-value and index of each point for sorting
 typedef struct {
-    int z_value;
+    uint64_t z_value;
     int index;
 } ZPoint;
 
 // Comparison function for sorting ZPoints by Z-value
 int compareZPoints(const void *a, const void *b) {
-    return ((ZPoint*)a)->z_value - ((ZPoint*)b)->z_value;
+    uint64_t za = ((ZPoint*)a)->z_value, zb = ((ZPoint*)b)->z_value;
+    return (za > zb) - (za < zb);
 }
 
-// Function to sort points based on Z-values
-void Zsorting(Point points[], int num_points) {
-    ZPoint zpoints[num_points];
-    
+// Function to sort the indices of points by Z-value over the given extent
+static ZPoint *sortedZPoints(const Point points[], int num_points, const MBR *extent) {
+    // Heap buffer: a million points would overflow the stack as a VLA
+    ZPoint *zpoints = (ZPoint *)malloc(num_points * sizeof(ZPoint));
+    if (zpoints == NULL) {
+        perror("Unable to allocate memory");
+        exit(1);
+    }
+
     // Compute Z-values and store them with indices
     for (int i = 0; i < num_points; i++) {
-        zpoints[i].z_value = Zval(points[i]);
+        zpoints[i].z_value = Zval(points[i], extent);
         zpoints[i].index = i;
     }
     
     // Sort ZPoints array based on Z-values
     qsort(zpoints, num_points, sizeof(ZPoint), compareZPoints);
-    
+    return zpoints;
+}
+
+// Function to sort points based on Z-values over their own extent, which is stored in *extent
+void Zsorting(Point points[], int num_points, MBR *extent) {
+    *extent = (MBR){0, 0, 0, 0};
+    if (num_points > 0) {
+        extent->xmin = extent->xmax = points[0].x;
+        extent->ymin = extent->ymax = points[0].y;
+    }
+    for (int i = 1; i < num_points; i++) {
+        if (points[i].x < extent->xmin) extent->xmin = points[i].x;
+        if (points[i].x > extent->xmax) extent->xmax = points[i].x;
+        if (points[i].y < extent->ymin) extent->ymin = points[i].y;
+        if (points[i].y > extent->ymax) extent->ymax = points[i].y;
+    }
+
+    ZPoint *zpoints = sortedZPoints(points, num_points, extent);
+    Point *sorted_points = (Point *)malloc(num_points * sizeof(Point));
+    if (sorted_points == NULL) {
+        perror("Unable to allocate memory");
+        exit(1);
+    }
+
     // Create a temporary array to store sorted points
-    Point sorted_points[num_points];
     for (int i = 0; i < num_points; i++) {
         sorted_points[i] = points[zpoints[i].index];
     }
@@ -62,5 +94,16 @@ void Zsorting(Point points[], int num_points) {
     for (int i = 0; i < num_points; i++) {
         points[i] = sorted_points[i];
     }
+    free(sorted_points);
+    free(zpoints);
 }
 
+
+// Function to list the indices of points in Z-order over extent without moving the points
+void Zorder(const Point points[], int num_points, const MBR *extent, int order[]) {
+    ZPoint *zpoints = sortedZPoints(points, num_points, extent);
+    for (int i = 0; i < num_points; i++) {
+        order[i] = zpoints[i].index;
+    }
+    free(zpoints);
+}